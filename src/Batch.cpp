@@ -0,0 +1,424 @@
+#include "Batch.h"
+#include "Chip8Lockstep.h"
+#include <map>
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+namespace
+{
+	uint64_t packRange(uint32_t next, uint32_t end)
+	{
+		return (static_cast<uint64_t>(next) << 32) | end;
+	}
+
+	uint32_t rangeNext(uint64_t range)
+	{
+		return static_cast<uint32_t>(range >> 32);
+	}
+
+	uint32_t rangeEnd(uint64_t range)
+	{
+		return static_cast<uint32_t>(range);
+	}
+
+	bool readFile(const std::string &path, std::vector<uint8_t> &data)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+		{
+			return false;
+		}
+		data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		return true;
+	}
+}
+
+bool loadJobList(const char *path, std::vector<BatchJob> &jobs)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cerr << "Failed to open job list: " << path << "\n";
+		return false;
+	}
+	std::string line;
+	for (unsigned int lineNumber = 1; std::getline(file, line); ++lineNumber)
+	{
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		BatchJob job;
+		if (!(fields >> job.romPath))
+		{
+			// Blank or comment
+			continue;
+		}
+		if (!(fields >> job.cycles))
+		{
+			std::cerr << path << ":" << lineNumber << ": expected <rom> <cycles> [input script|-] [seed]\n";
+			return false;
+		}
+		if (fields >> job.inputPath && !(fields >> job.seed) && !fields.eof())
+		{
+			std::cerr << path << ":" << lineNumber << ": invalid seed\n";
+			return false;
+		}
+		if (job.inputPath == "-")
+		{
+			job.inputPath.clear();
+		}
+		jobs.push_back(job);
+	}
+	return true;
+}
+
+BatchRunner::BatchRunner(unsigned int threadCount, Engine engine, unsigned int cpuFrequency)
+	: threadCount(threadCount), engine(engine), cpuFrequency(cpuFrequency)
+{
+	if (this->threadCount == 0)
+	{
+		this->threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+}
+
+unsigned int BatchRunner::getThreadCount() const
+{
+	return threadCount;
+}
+
+void BatchRunner::setLockstep(bool enabled)
+{
+	lockstep = enabled;
+}
+
+void BatchRunner::setCorpus(const RomCorpus *corpus)
+{
+	this->corpus = corpus;
+}
+
+void BatchRunner::setQuirkProfile(QuirkProfile profile)
+{
+	quirksSet = true;
+	quirks = profile;
+}
+
+QuirkProfile BatchRunner::jobQuirks(uint32_t job) const
+{
+	return quirksSet ? quirks : quirkProfileForRom((*jobs)[job].romPath);
+}
+
+bool BatchRunner::loadInputScript(const std::string &path, std::vector<InputEvent> &events)
+{
+	// "<frame> <hex key mask>" per line, the keys stay held until the next line
+	std::ifstream file(path);
+	if (!file)
+	{
+		return false;
+	}
+	std::string line;
+	while (std::getline(file, line))
+	{
+		line = line.substr(0, line.find('#'));
+		std::istringstream fields(line);
+		InputEvent event;
+		if (!(fields >> event.frame))
+		{
+			continue;
+		}
+		if (!(fields >> std::hex >> event.keys))
+		{
+			return false;
+		}
+		events.push_back(event);
+	}
+	std::stable_sort(events.begin(), events.end(), [](const InputEvent &a, const InputEvent &b)
+					 { return a.frame < b.frame; });
+	return true;
+}
+
+std::vector<BatchResult> BatchRunner::run(const std::vector<BatchJob> &jobs)
+{
+	std::vector<BatchResult> results(jobs.size());
+	this->jobs = &jobs;
+	this->results = &results;
+
+	// Load every distinct file once, workers only read them
+	std::unordered_map<std::string, int> romIndex;
+	std::unordered_map<std::string, int> inputIndex;
+	roms.clear();
+	romFiles.clear();
+	inputs.clear();
+	jobRom.assign(jobs.size(), -1);
+	jobInput.assign(jobs.size(), -1);
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		auto rom = romIndex.find(jobs[i].romPath);
+		if (rom == romIndex.end())
+		{
+			RomView view;
+			std::vector<uint8_t> data;
+			int index = -1;
+			if (corpus && corpus->find(jobs[i].romPath, view))
+			{
+				index = static_cast<int>(roms.size());
+				roms.push_back(view);
+			}
+			else if (readFile(jobs[i].romPath, data) && data.size() <= MEMORY_SIZE - ROM_START_ADDRESS)
+			{
+				// Moving the vector keeps its buffer, so the view stays valid
+				index = static_cast<int>(roms.size());
+				roms.push_back({data.data(), data.size(), hashBytes(data.data(), data.size())});
+				romFiles.push_back(std::move(data));
+			}
+			else
+			{
+				std::cerr << "Failed to load ROM: " << jobs[i].romPath << "\n";
+			}
+			rom = romIndex.emplace(jobs[i].romPath, index).first;
+		}
+		jobRom[i] = rom->second;
+
+		if (jobs[i].inputPath.empty())
+		{
+			continue;
+		}
+		auto input = inputIndex.find(jobs[i].inputPath);
+		if (input == inputIndex.end())
+		{
+			std::vector<InputEvent> events;
+			int index = -1;
+			if (loadInputScript(jobs[i].inputPath, events))
+			{
+				index = static_cast<int>(inputs.size());
+				inputs.push_back(std::move(events));
+			}
+			else
+			{
+				std::cerr << "Failed to load input script: " << jobs[i].inputPath << "\n";
+			}
+			input = inputIndex.emplace(jobs[i].inputPath, index).first;
+		}
+		jobInput[i] = input->second;
+		if (input->second < 0)
+		{
+			jobRom[i] = -1;
+		}
+	}
+
+	// Work units: one job each, or up to LANES jobs with the same ROM and
+	// cycle count in lockstep mode
+	units.clear();
+	std::map<std::pair<int, uint64_t>, uint32_t> openUnit;
+	for (uint32_t i = 0; i < jobs.size(); ++i)
+	{
+		if (!lockstep || jobRom[i] < 0)
+		{
+			units.push_back({i});
+			continue;
+		}
+		auto key = std::make_pair(jobRom[i], jobs[i].cycles);
+		auto open = openUnit.find(key);
+		if (open == openUnit.end() || units[open->second].size() == Chip8Lockstep::LANES)
+		{
+			open = openUnit.insert_or_assign(key, static_cast<uint32_t>(units.size())).first;
+			units.emplace_back();
+		}
+		units[open->second].push_back(i);
+	}
+
+	// Split the units into one contiguous range per worker
+	const uint32_t unitCount = static_cast<uint32_t>(units.size());
+	ranges.reset(new WorkRange[threadCount]);
+	for (unsigned int w = 0; w < threadCount; ++w)
+	{
+		uint32_t first = static_cast<uint32_t>(uint64_t(unitCount) * w / threadCount);
+		uint32_t end = static_cast<uint32_t>(uint64_t(unitCount) * (w + 1) / threadCount);
+		ranges[w].range.store(packRange(first, end), std::memory_order_relaxed);
+	}
+
+	std::vector<std::thread> threads;
+	for (unsigned int w = 1; w < threadCount; ++w)
+	{
+		threads.emplace_back(&BatchRunner::worker, this, w);
+	}
+	worker(0);
+	for (std::thread &thread : threads)
+	{
+		thread.join();
+	}
+
+	ranges.reset();
+	units.clear();
+	this->jobs = nullptr;
+	this->results = nullptr;
+	return results;
+}
+
+void BatchRunner::worker(unsigned int index)
+{
+	uint32_t unit;
+	while (takeUnit(index, unit))
+	{
+		if (units[unit].size() == 1)
+		{
+			runJob(units[unit][0]);
+		}
+		else
+		{
+			runLockstep(units[unit]);
+		}
+	}
+}
+
+bool BatchRunner::takeUnit(unsigned int worker, uint32_t &unit)
+{
+	// Own range first, from the front
+	std::atomic<uint64_t> &own = ranges[worker].range;
+	uint64_t range = own.load(std::memory_order_relaxed);
+	while (rangeNext(range) < rangeEnd(range))
+	{
+		if (own.compare_exchange_weak(range, packRange(rangeNext(range) + 1, rangeEnd(range)), std::memory_order_relaxed))
+		{
+			unit = rangeNext(range);
+			return true;
+		}
+	}
+
+	// Own range is empty, so no thief can take from it until it is refilled:
+	// steal the back half of the first non-empty range
+	for (unsigned int i = 1; i < threadCount; ++i)
+	{
+		std::atomic<uint64_t> &victim = ranges[(worker + i) % threadCount].range;
+		range = victim.load(std::memory_order_relaxed);
+		while (rangeNext(range) < rangeEnd(range))
+		{
+			uint32_t next = rangeNext(range);
+			uint32_t end = rangeEnd(range);
+			uint32_t split = end - (end - next + 1) / 2;
+			if (victim.compare_exchange_weak(range, packRange(next, split), std::memory_order_relaxed))
+			{
+				// Run the first stolen unit, keep the rest for ourselves
+				unit = split;
+				own.store(packRange(split + 1, end), std::memory_order_relaxed);
+				return true;
+			}
+		}
+	}
+	// Units that are still in flight between two ranges belong to the thief
+	return false;
+}
+
+const std::vector<BatchRunner::InputEvent> &BatchRunner::jobEvents(uint32_t job) const
+{
+	static const std::vector<InputEvent> noInput;
+	return jobInput[job] < 0 ? noInput : inputs[jobInput[job]];
+}
+
+void BatchRunner::applyInput(Chip8 &chip8, const std::vector<InputEvent> &events, size_t &nextEvent, uint64_t frame)
+{
+	while (nextEvent < events.size() && events[nextEvent].frame <= frame)
+	{
+		chip8.setKeys(events[nextEvent].keys);
+		++nextEvent;
+	}
+}
+
+void BatchRunner::storeResult(const Chip8 &chip8, BatchResult &result)
+{
+	result.videoHash = chip8.videoHash();
+	result.cycles = chip8.getCycleCount();
+	result.frames = chip8.getFrameCount();
+	for (uint8_t r = 0; r < REGISTER_COUNT; ++r)
+	{
+		result.REG[r] = chip8.getRegister(r);
+	}
+	result.R_I = chip8.getIndexRegister();
+	result.R_PC = chip8.getProgramCounter();
+	result.ok = true;
+}
+
+void BatchRunner::runJob(uint32_t job)
+{
+	const BatchJob &spec = (*jobs)[job];
+	BatchResult &result = (*results)[job];
+	if (jobRom[job] < 0)
+	{
+		return;
+	}
+	const RomView rom = roms[jobRom[job]];
+	const std::vector<InputEvent> &events = jobEvents(job);
+
+	auto start = std::chrono::steady_clock::now();
+
+	// Chip8 is large (decode cache), keep it off the worker stack
+	auto chip8 = std::make_unique<Chip8>();
+	chip8->loadROM(rom);
+	if (!chip8->setEngine(engine))
+	{
+		return;
+	}
+	chip8->setQuirkProfile(jobQuirks(job));
+	chip8->setCpuFrequency(cpuFrequency);
+	chip8->setSeed(spec.seed);
+
+	// Input changes only between frames, so run up to the next timer event
+	size_t nextEvent = 0;
+	uint64_t remaining = spec.cycles;
+	while (remaining > 0)
+	{
+		applyInput(*chip8, events, nextEvent, chip8->getFrameCount());
+		unsigned int slice = static_cast<unsigned int>(std::min<uint64_t>(remaining, chip8->getCyclesUntilTimer()));
+		chip8->run(slice);
+		remaining -= slice;
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	storeResult(*chip8, result);
+	result.elapsedMs = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void BatchRunner::runLockstep(const std::vector<uint32_t> &unit)
+{
+	// Every job of the unit has the same ROM and cycle count
+	const RomView rom = roms[jobRom[unit[0]]];
+	const unsigned int laneCount = static_cast<unsigned int>(unit.size());
+
+	auto start = std::chrono::steady_clock::now();
+
+	auto machines = std::make_unique<Chip8Lockstep>();
+	// Same ROM path, same profile
+	machines->setQuirkProfile(jobQuirks(unit[0]));
+	machines->loadROM(rom.data, rom.size, laneCount);
+	machines->setCpuFrequency(cpuFrequency);
+	// Each lane draws random bytes from its own Chip8
+	for (unsigned int l = 0; l < laneCount; ++l)
+	{
+		machines->lane(l).setSeed((*jobs)[unit[l]].seed);
+	}
+
+	std::vector<size_t> nextEvent(laneCount);
+	uint64_t remaining = (*jobs)[unit[0]].cycles;
+	while (remaining > 0)
+	{
+		// Lane frame counts are only synced at the end, use the shared one
+		for (unsigned int l = 0; l < laneCount; ++l)
+		{
+			applyInput(machines->lane(l), jobEvents(unit[l]), nextEvent[l], machines->getFrameCount());
+		}
+		unsigned int slice = static_cast<unsigned int>(std::min<uint64_t>(remaining, machines->getCyclesUntilTimer()));
+		machines->run(slice);
+		remaining -= slice;
+	}
+	machines->sync();
+
+	auto end = std::chrono::steady_clock::now();
+	// Lanes share the run time
+	double elapsedMs = std::chrono::duration<double, std::milli>(end - start).count() / laneCount;
+	for (unsigned int l = 0; l < laneCount; ++l)
+	{
+		BatchResult &result = (*results)[unit[l]];
+		storeResult(machines->lane(l), result);
+		result.elapsedMs = elapsedMs;
+	}
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+#include "RomCorpus.h"
+
+// One emulation run: a ROM, how long to run it and optional keypad input
+struct BatchJob
+{
+	std::string romPath;
+	uint64_t cycles{};
+	// Empty for no input
+	std::string inputPath;
+	// See Chip8::setSeed
+	uint64_t seed{};
+};
+
+// Machine state at the end of a BatchJob
+struct BatchResult
+{
+	// False if the ROM or input script could not be loaded
+	bool ok{};
+	uint64_t videoHash{};
+	uint64_t cycles{};
+	uint64_t frames{};
+	uint8_t REG[REGISTER_COUNT]{};
+	uint16_t R_I{};
+	uint16_t R_PC{};
+	double elapsedMs{};
+};
+
+// Read "<rom> <cycles> [input script|-] [seed]" lines, # starts a comment
+bool loadJobList(const char *path, std::vector<BatchJob> &jobs);
+
+// Runs a job list on a pool of worker threads.
+// Every worker owns a contiguous range of job indices and takes jobs from
+// its front; a worker that runs dry steals the back half of another
+// worker's range. Both ends of a range live in one atomic word, so taking
+// and stealing are a single compare-and-swap and no lock is held while
+// jobs run. Each job writes only its own result slot.
+// ROMs and input scripts are read once, before the workers start; ROMs
+// found in a RomCorpus are not read at all, jobs copy them straight from
+// the mapped corpus.
+// In lockstep mode jobs with the same ROM and cycle count are packed into
+// the lanes of a Chip8Lockstep and a work unit is one such pack.
+class BatchRunner
+{
+public:
+	// threadCount 0 uses every hardware thread
+	BatchRunner(unsigned int threadCount, Engine engine, unsigned int cpuFrequency);
+
+	// results[i] is the result of jobs[i]
+	std::vector<BatchResult> run(const std::vector<BatchJob> &jobs);
+	unsigned int getThreadCount() const;
+	// Run jobs in Chip8Lockstep lanes instead of one Chip8 each,
+	// the engine is not used then
+	void setLockstep(bool enabled);
+	// Take job ROMs named like a corpus entry from the corpus instead of
+	// the file system, nullptr for none. The corpus must outlive run()
+	void setCorpus(const RomCorpus *corpus);
+	// Run every job with profile instead of the one quirkProfileForRom
+	// picks from its ROM path
+	void setQuirkProfile(QuirkProfile profile);
+
+private:
+	// Keypad state from frame onwards, bit k = key k
+	struct InputEvent
+	{
+		uint64_t frame;
+		uint16_t keys;
+	};
+	// Unit indices [next, end) packed as next << 32 | end
+	struct alignas(64) WorkRange
+	{
+		std::atomic<uint64_t> range{};
+	};
+
+	static bool loadInputScript(const std::string &path, std::vector<InputEvent> &events);
+	// Set the keypad from the events due at frame
+	static void applyInput(Chip8 &chip8, const std::vector<InputEvent> &events, size_t &nextEvent, uint64_t frame);
+	static void storeResult(const Chip8 &chip8, BatchResult &result);
+	const std::vector<InputEvent> &jobEvents(uint32_t job) const;
+	QuirkProfile jobQuirks(uint32_t job) const;
+	void worker(unsigned int index);
+	bool takeUnit(unsigned int worker, uint32_t &unit);
+	void runJob(uint32_t job);
+	void runLockstep(const std::vector<uint32_t> &unit);
+
+	unsigned int threadCount;
+	Engine engine;
+	unsigned int cpuFrequency;
+	bool lockstep{};
+	const RomCorpus *corpus{};
+	bool quirksSet{};
+	QuirkProfile quirks = QuirkProfile::Default;
+
+	// Valid during run()
+	std::unique_ptr<WorkRange[]> ranges;
+	std::vector<RomView> roms;
+	// Contents of the ROMs read from files, roms points into them
+	std::vector<std::vector<uint8_t>> romFiles;
+	std::vector<std::vector<InputEvent>> inputs;
+	// Index into roms/inputs per job, -1 if it failed to load
+	std::vector<int> jobRom;
+	std::vector<int> jobInput;
+	// Jobs of each work unit
+	std::vector<std::vector<uint32_t>> units;
+	const std::vector<BatchJob> *jobs{};
+	std::vector<BatchResult> *results{};
+};
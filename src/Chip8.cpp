@@ -1,10 +1,88 @@
 #include "Chip8.h"
+#include "Chip8Aot.h"
+#include "Chip8Jit.h"
+#include "Chip8Opcodes.h"
+#include "Chip8Profile.h"
+#include "Chip8Quirks.h"
+#include "Chip8Trace.h"
+#include <type_traits>
+#include <cctype>
+
+static_assert(std::is_trivially_copyable<Chip8State>::value, "Chip8State is saved with memcpy");
+
+namespace
+{
+	// 00FB/00FC: move rows of Words words 4 pixels, each word takes the
+	// pixels shifted out of its neighbour. Rows are independent and the
+	// word count is fixed, so the row loop vectorizes
+	template <unsigned int Words>
+	void shiftRowsRight(uint64_t *video, unsigned int rowCount)
+	{
+		for (unsigned int y = 0; y < rowCount; ++y)
+		{
+			uint64_t *row = video + y * Words;
+			for (unsigned int w = Words - 1; w > 0; --w)
+			{
+				row[w] = (row[w] >> 4) | (row[w - 1] << 60);
+			}
+			row[0] >>= 4;
+		}
+	}
+
+	// Bit y set for every row of Words words with a pixel on
+	template <unsigned int Words>
+	uint64_t litRows(const uint64_t *video, unsigned int rowCount)
+	{
+		uint64_t rows = 0;
+		for (unsigned int y = 0; y < rowCount; ++y)
+		{
+			uint64_t lit = 0;
+			for (unsigned int w = 0; w < Words; ++w)
+			{
+				lit |= video[y * Words + w];
+			}
+			rows |= static_cast<uint64_t>(lit != 0) << y;
+		}
+		return rows;
+	}
+
+	template <unsigned int Words>
+	void shiftRowsLeft(uint64_t *video, unsigned int rowCount)
+	{
+		for (unsigned int y = 0; y < rowCount; ++y)
+		{
+			uint64_t *row = video + y * Words;
+			for (unsigned int w = 0; w + 1 < Words; ++w)
+			{
+				row[w] = (row[w] << 4) | (row[w + 1] >> 60);
+			}
+			row[Words - 1] <<= 4;
+		}
+	}
+}
+
+// Save state file header, followed by the Chip8State bytes
+static const char STATE_FILE_MAGIC[4] = {'C', '8', 'S', 'T'};
+static const uint32_t STATE_FILE_VERSION = 3;
 
 uint8_t Chip8::getRandomByte()
 {
-	static std::mt19937 rng{std::random_device{}()};
-	static std::uniform_int_distribution<int> dist(0, 255);
-	return static_cast<uint8_t>(dist(rng));
+	// PCG32 (XSH RR), top byte of the 32-bit output
+	uint64_t state = rngState;
+	rngState = state * 6364136223846793005ull + 1442695040888963407ull;
+	uint32_t xorShifted = static_cast<uint32_t>(((state >> 18) ^ state) >> 27);
+	uint32_t rotation = static_cast<uint32_t>(state >> 59);
+	uint32_t output = (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+	return static_cast<uint8_t>(output >> 24);
+}
+
+void Chip8::setSeed(uint64_t seed)
+{
+	// PCG32 seeding: step, add the seed, step
+	rngState = 0;
+	getRandomByte();
+	rngState += seed;
+	getRandomByte();
 }
 
 Chip8::Chip8()
@@ -12,15 +90,41 @@ Chip8::Chip8()
 	// Initialize PC
 	R_PC = ROM_START_ADDRESS;
 
+	// Initialize timer schedule
+	scheduleTimer();
+
+#ifdef CHIP8_PROFILE
+	profile = std::make_unique<Chip8Profile>();
+#endif
+#ifdef CHIP8_TRACE
+	trace = std::make_unique<Chip8Trace>();
+#endif
+
+	setSeed(0);
+
 	// Load font set into memory
 	for (unsigned int i = 0; i < FONTSET_SIZE; ++i)
 	{
 		memory[FONTSET_START_ADDRESS + i] = FONTSET[i];
 	}
+	for (unsigned int i = 0; i < BIG_FONTSET_SIZE; ++i)
+	{
+		memory[BIG_FONTSET_START_ADDRESS + i] = BIG_FONTSET[i];
+	}
+
+	buildTables<QuirksDefault>();
+}
+
+Chip8::~Chip8() = default;
 
+template <typename Quirks>
+void Chip8::buildTables()
+{
 	// Route opcodes to function handlers
 	// using member function pointers
-	routerTable[0] = &Chip8::SubHandlerFn0;
+	// Nibbles 0, 8, E and F are routed through
+	// the sub-tables when decoding (see decode)
+	routerTable[0] = &Chip8::DO_NOTHING;
 	routerTable[1] = &Chip8::OP_1nnn;
 	routerTable[2] = &Chip8::OP_2nnn;
 	routerTable[3] = &Chip8::OP_3xkk;
@@ -28,43 +132,54 @@ Chip8::Chip8()
 	routerTable[5] = &Chip8::OP_5xy0;
 	routerTable[6] = &Chip8::OP_6xkk;
 	routerTable[7] = &Chip8::OP_7xkk;
-	routerTable[8] = &Chip8::SubHandlerFn8;
+	routerTable[8] = &Chip8::DO_NOTHING;
 	routerTable[9] = &Chip8::OP_9xy0;
 	routerTable[0xA] = &Chip8::OP_Annn;
-	routerTable[0xB] = &Chip8::OP_Bnnn;
+	routerTable[0xB] = &Chip8::OP_Bnnn<Quirks>;
 	routerTable[0xC] = &Chip8::OP_Cxkk;
-	routerTable[0xD] = &Chip8::OP_Dxyn;
-	routerTable[0xE] = &Chip8::SubHandlerFnE;
-	routerTable[0xF] = &Chip8::SubHandlerFnF;
+	routerTable[0xD] = &Chip8::OP_Dxyn<Quirks>;
+	routerTable[0xE] = &Chip8::DO_NOTHING;
+	routerTable[0xF] = &Chip8::DO_NOTHING;
 
 	// Initialize sub-tables with DO_NOTHING
 	for (size_t i = 0; i <= 15; i++)
 	{
-		subTable0[i] = &Chip8::DO_NOTHING;
 		subTable8[i] = &Chip8::DO_NOTHING;
 		subTableE[i] = &Chip8::DO_NOTHING;
 	}
 	for (size_t i = 0; i <= 255; i++)
 	{
+		subTable0[i] = &Chip8::DO_NOTHING;
 		subTableF[i] = &Chip8::DO_NOTHING;
 	}
 
-	subTable0[0x0] = &Chip8::OP_00E0;
-	subTable0[0xE] = &Chip8::OP_00EE;
+	for (size_t n = 0; n <= 15; n++)
+	{
+		subTable0[0xC0 + n] = &Chip8::OP_00Cn;
+		subTable0[0xD0 + n] = &Chip8::OP_00Dn;
+	}
+	subTable0[0xE0] = &Chip8::OP_00E0;
+	subTable0[0xEE] = &Chip8::OP_00EE;
+	subTable0[0xFB] = &Chip8::OP_00FB;
+	subTable0[0xFC] = &Chip8::OP_00FC;
+	subTable0[0xFD] = &Chip8::OP_00FD;
+	subTable0[0xFE] = &Chip8::OP_00FE;
+	subTable0[0xFF] = &Chip8::OP_00FF;
 
 	subTable8[0x0] = &Chip8::OP_8xy0;
-	subTable8[0x1] = &Chip8::OP_8xy1;
-	subTable8[0x2] = &Chip8::OP_8xy2;
-	subTable8[0x3] = &Chip8::OP_8xy3;
+	subTable8[0x1] = &Chip8::OP_8xy1<Quirks>;
+	subTable8[0x2] = &Chip8::OP_8xy2<Quirks>;
+	subTable8[0x3] = &Chip8::OP_8xy3<Quirks>;
 	subTable8[0x4] = &Chip8::OP_8xy4;
 	subTable8[0x5] = &Chip8::OP_8xy5;
-	subTable8[0x6] = &Chip8::OP_8xy6;
+	subTable8[0x6] = &Chip8::OP_8xy6<Quirks>;
 	subTable8[0x7] = &Chip8::OP_8xy7;
-	subTable8[0xE] = &Chip8::OP_8xyE;
+	subTable8[0xE] = &Chip8::OP_8xyE<Quirks>;
 
 	subTableE[0x1] = &Chip8::OP_ExA1;
 	subTableE[0xE] = &Chip8::OP_Ex9E;
 
+	subTableF[0x01] = &Chip8::OP_Fn01;
 	subTableF[0x07] = &Chip8::OP_Fx07;
 	subTableF[0x0A] = &Chip8::OP_Fx0A;
 	subTableF[0x15] = &Chip8::OP_Fx15;
@@ -72,182 +187,1170 @@ Chip8::Chip8()
 	subTableF[0x1E] = &Chip8::OP_Fx1E;
 	subTableF[0x29] = &Chip8::OP_Fx29;
 	subTableF[0x33] = &Chip8::OP_Fx33;
-	subTableF[0x55] = &Chip8::OP_Fx55;
-	subTableF[0x65] = &Chip8::OP_Fx65;
+	subTableF[0x55] = &Chip8::OP_Fx55<Quirks>;
+	subTableF[0x65] = &Chip8::OP_Fx65<Quirks>;
+	subTableF[0x30] = &Chip8::OP_Fx30;
+	subTableF[0x75] = &Chip8::OP_Fx75;
+	subTableF[0x85] = &Chip8::OP_Fx85;
+}
+
+const char *engineName(Engine engine)
+{
+	switch (engine)
+	{
+	case Engine::Jit:
+		return "jit";
+	case Engine::Threaded:
+		return "threaded";
+	case Engine::Aot:
+		return "aot";
+	default:
+		return "interpreter";
+	}
+}
+
+bool engineFromName(const std::string &name, Engine &engine)
+{
+	for (Engine candidate : {Engine::Interpreter, Engine::Jit, Engine::Threaded, Engine::Aot})
+	{
+		if (name == engineName(candidate))
+		{
+			engine = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+void Chip8::setDecodeCache(bool enabled)
+{
+	decodeCaching = enabled;
+}
+
+bool Chip8::setEngine(Engine newEngine)
+{
+#if defined(CHIP8_PROFILE) || defined(CHIP8_TRACE)
+	// execute() steps every instruction here, another engine would never run
+	if (newEngine != Engine::Interpreter)
+	{
+		std::cerr << "Profiled and traced builds only run the interpreter\n";
+		return false;
+	}
+#endif
+	if (newEngine == Engine::Jit)
+	{
+		if (!Chip8Jit::isSupported())
+		{
+			std::cerr << "JIT is not supported on this platform\n";
+			return false;
+		}
+		if (!jit)
+		{
+			jit = std::make_unique<Chip8Jit>(*this);
+		}
+	}
+	if (newEngine == Engine::Aot)
+	{
+		if (!Chip8Aot::hasProgram(romHash))
+		{
+			std::cerr << "No ahead-of-time program for this ROM, see make aot\n";
+			return false;
+		}
+		if (!aot)
+		{
+			aot = std::make_unique<Chip8Aot>(*this);
+		}
+	}
+	engine = newEngine;
+	return true;
+}
+
+Engine Chip8::getEngine() const
+{
+	return engine;
+}
+
+const char *quirkProfileName(QuirkProfile profile)
+{
+	switch (profile)
+	{
+	case QuirkProfile::Chip8:
+		return "chip8";
+	case QuirkProfile::Schip:
+		return "schip";
+	case QuirkProfile::XoChip:
+		return "xochip";
+	default:
+		return "default";
+	}
+}
+
+bool quirkProfileFromName(const std::string &name, QuirkProfile &profile)
+{
+	for (QuirkProfile candidate : {QuirkProfile::Default, QuirkProfile::Chip8, QuirkProfile::Schip, QuirkProfile::XoChip})
+	{
+		if (name == quirkProfileName(candidate))
+		{
+			profile = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+QuirkProfile quirkProfileForRom(const std::string &path)
+{
+	size_t dot = path.find_last_of('.');
+	std::string extension = dot == std::string::npos ? "" : path.substr(dot);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c)
+				   { return static_cast<char>(std::tolower(c)); });
+	if (extension == ".sc8")
+	{
+		return QuirkProfile::Schip;
+	}
+	if (extension == ".xo8")
+	{
+		return QuirkProfile::XoChip;
+	}
+	return QuirkProfile::Default;
+}
+
+void Chip8::setQuirkProfile(QuirkProfile profile)
+{
+	withQuirks(profile, [this](auto quirks)
+			   { buildTables<decltype(quirks)>(); });
+	quirkProfile = profile;
+	// Decoded handlers and translations belong to the old profile
+	invalidateCode(0, MEMORY_SIZE);
+}
+
+QuirkProfile Chip8::getQuirkProfile() const
+{
+	return quirkProfile;
+}
+
+void Chip8::run(unsigned int cycles)
+{
+	// Engines run in slices that end on timer events
+	while (cycles > 0)
+	{
+		unsigned int slice = std::min(cycles, cyclesUntilTimer);
+		runSlice(slice);
+		cycles -= slice;
+	}
+}
+
+unsigned int Chip8::runUntilNextTimerEvent()
+{
+	unsigned int cycles = cyclesUntilTimer;
+	runSlice(cycles);
+	return cycles;
+}
+
+void Chip8::runSlice(unsigned int cycles)
+{
+	execute(cycles);
+	advanceClock(cycles);
+}
+
+void Chip8::setBuzzerEvents(bool enabled)
+{
+	buzzerEventsEnabled = enabled;
+	buzzerOn = R_BUZZER_TIMER > 0;
+}
+
+void Chip8::buzzerSet(uint8_t value, unsigned int left)
+{
+	// The buzzer only switches here and at timer ticks (advanceClock)
+	if (buzzerEventsEnabled && (value > 0) != buzzerOn)
+	{
+		buzzerOn = !buzzerOn;
+		buzzerEvents.push_back({runEndCycle - left, buzzerOn});
+	}
+}
+
+void Chip8::takeBuzzerEvents(std::vector<BuzzerEvent> &events)
+{
+	events.insert(events.end(), buzzerEvents.begin(), buzzerEvents.end());
+	buzzerEvents.clear();
+}
+
+void Chip8::runFrame()
+{
+	runUntilNextTimerEvent();
+}
+
+void Chip8::setCpuFrequency(unsigned int hz)
+{
+	// At least one instruction per timer tick
+	cpuFrequency = std::max(hz, TIMER_FREQUENCY);
+	timerBaseCycle = cycleCount;
+	timerTicks = 0;
+	scheduleTimer();
+}
+
+unsigned int Chip8::getCpuFrequency() const
+{
+	return cpuFrequency;
+}
+
+uint64_t Chip8::getCycleCount() const
+{
+	return cycleCount;
+}
+
+uint64_t Chip8::getFrameCount() const
+{
+	return frameCount;
+}
+
+unsigned int Chip8::getCyclesUntilTimer() const
+{
+	return cyclesUntilTimer;
+}
+
+uint8_t Chip8::getRegister(uint8_t index) const
+{
+	return REG[index % REGISTER_COUNT];
+}
+
+uint16_t Chip8::getIndexRegister() const
+{
+	return R_I;
+}
+
+uint16_t Chip8::getProgramCounter() const
+{
+	return R_PC;
+}
+
+void Chip8::setKeys(uint16_t keys)
+{
+	for (unsigned int key = 0; key < KEY_COUNT; ++key)
+	{
+		keypadMemory[key] = (keys >> key) & 1u;
+	}
+}
+
+uint16_t Chip8::getKeys() const
+{
+	uint16_t keys = 0;
+	for (unsigned int key = 0; key < KEY_COUNT; ++key)
+	{
+		keys |= (keypadMemory[key] ? 1u : 0u) << key;
+	}
+	return keys;
+}
+
+void Chip8::execute(unsigned int cycles)
+{
+#if defined(CHIP8_PROFILE) || defined(CHIP8_TRACE)
+	// Only step() counts and traces, so profiled and traced builds run
+	// every engine through it and idle loops like any other code
+	runEndCycle = cycleCount + cycles;
+	for (unsigned int cycle = 0; cycle < cycles; ++cycle)
+	{
+		runLeft = cycles - cycle - 1;
+#ifdef CHIP8_TRACE
+		traceStep(cycleCount + cycle);
+#else
+		step();
+#endif
+	}
+	return;
+#endif
+	const uint64_t endCycle = cycleCount + cycles;
+	while (cycles > 0)
+	{
+		cycles = skipIdleLoop(cycles);
+		// Run up to the next idle loop check, or everything if none is due
+		// (skipping off, or the cycles left are too few to check)
+		unsigned int chunk = idleCheckDelay > 0 ? std::min(cycles, idleCheckDelay) : cycles;
+		runEndCycle = endCycle - (cycles - chunk);
+		runEngine(chunk);
+		idleCheckDelay -= std::min(idleCheckDelay, chunk);
+		cycles -= chunk;
+	}
+}
+
+unsigned int Chip8::skipIdleLoop(unsigned int cycles)
+{
+#if defined(CHIP8_PROFILE) || defined(CHIP8_TRACE)
+	// Every instruction is counted or traced
+	return cycles;
+#endif
+	// A check simulates up to MAX_IDLE_LOOP instructions, not worth it for
+	// fewer cycles than that or before the back off delay has run out
+	if (!idleSkip || cycles <= MAX_IDLE_LOOP || idleCheckDelay > 0)
+	{
+		return cycles;
+	}
+	// Most of the time PC is in code no idle loop can run through, which
+	// takes no simulation once known
+	IdleCode &code = idleCode[R_PC % MEMORY_SIZE];
+	if (code == IdleCode::Unknown)
+	{
+		code = canReturn(R_PC, R_PC, 0) ? IdleCode::Loop : IdleCode::Busy;
+		idleCodeKnown = true;
+	}
+	IdleLoop loop;
+	if (code == IdleCode::Busy || !findIdleLoop(loop))
+	{
+		// Busy: check less and less often, up to MAX_IDLE_CHECK_INTERVAL,
+		// but at least at the start of every slice, since a wait for the
+		// delay timer may begin in any frame
+		idleCheckDelay = std::min(idleCheckInterval, cycles);
+		idleCheckInterval = std::min(idleCheckInterval * 2, MAX_IDLE_CHECK_INTERVAL);
+		return cycles;
+	}
+	idleCheckInterval = IDLE_CHECK_INTERVAL;
+	if (cycles < loop.firstLength)
+	{
+		return cycles;
+	}
+	// Keys and timers do not change within a slice, so after the first
+	// pass every pass ends where it started: apply the first one, count
+	// the whole passes that fit in cycles and only run the rest. Check
+	// again at the start of the next slice
+	std::memcpy(REG, loop.V, sizeof(REG));
+	R_I = loop.i;
+	const unsigned int skipped = cycles - (cycles - loop.firstLength) % loop.length;
+	idleCycles += skipped;
+	return cycles - skipped;
+}
+
+void Chip8::runEngine(unsigned int cycles)
+{
+	switch (engine)
+	{
+	case Engine::Jit:
+		jit->run(cycles);
+		break;
+	case Engine::Threaded:
+		runThreaded(cycles);
+		break;
+	case Engine::Aot:
+		aot->run(cycles);
+		break;
+	default:
+		for (runLeft = cycles; runLeft > 0;)
+		{
+			--runLeft;
+			step();
+		}
+		break;
+	}
+}
+
+bool Chip8::findIdleLoop(IdleLoop &loop) const
+{
+	// The first pass starts from the registers as they are, which may
+	// still hold what the loop read before the last timer tick. The
+	// second pass starts from what the first one left and must end there
+	std::memcpy(loop.V, REG, sizeof(loop.V));
+	loop.i = R_I;
+	loop.firstLength = simulateIdlePass(loop.V, loop.i);
+	if (!loop.firstLength)
+	{
+		return false;
+	}
+	uint8_t V[REGISTER_COUNT];
+	std::memcpy(V, loop.V, sizeof(V));
+	uint16_t i = loop.i;
+	loop.length = simulateIdlePass(V, i);
+	return loop.length && i == loop.i && std::memcmp(V, loop.V, sizeof(V)) == 0;
+}
+
+unsigned int Chip8::simulateIdlePass(uint8_t *V, uint16_t &i) const
+{
+	// Only opcodes that write nothing but V0-VF, I and PC qualify, and
+	// none whose result depends on the quirk profile
+	uint16_t pc = R_PC;
+	for (unsigned int length = 1; length <= MAX_IDLE_LOOP; ++length)
+	{
+		const uint16_t address = pc % MEMORY_SIZE;
+		const uint16_t opcode = (memory[address] << 8) | memory[(address + 1) % MEMORY_SIZE];
+		const uint8_t x = (opcode & 0x0F00u) >> 8u;
+		const uint8_t y = (opcode & 0x00F0u) >> 4u;
+		const uint8_t kk = opcode & 0x00FFu;
+		const uint16_t nnn = opcode & 0x0FFFu;
+		pc += 2;
+		switch (classifyOpcode(opcode))
+		{
+		case K_NOP:
+			break;
+		case K_00FD:
+			pc -= 2;
+			break;
+		case K_1nnn:
+			pc = nnn;
+			break;
+		case K_3xkk:
+			pc += V[x] == kk ? 2 : 0;
+			break;
+		case K_4xkk:
+			pc += V[x] != kk ? 2 : 0;
+			break;
+		case K_5xy0:
+			pc += V[x] == V[y] ? 2 : 0;
+			break;
+		case K_9xy0:
+			pc += V[x] != V[y] ? 2 : 0;
+			break;
+		case K_6xkk:
+			V[x] = kk;
+			break;
+		case K_7xkk:
+			V[x] += kk;
+			break;
+		case K_8xy0:
+			V[x] = V[y];
+			break;
+		case K_Annn:
+			i = nnn;
+			break;
+		case K_Ex9E:
+			pc += keypadMemory[V[x] % KEY_COUNT] ? 2 : 0;
+			break;
+		case K_ExA1:
+			pc += keypadMemory[V[x] % KEY_COUNT] ? 0 : 2;
+			break;
+		case K_Fx07:
+			V[x] = R_DELAY_TIMER;
+			break;
+		case K_Fx0A:
+		{
+			const uint8_t *key = std::find_if(keypadMemory, keypadMemory + KEY_COUNT, [](uint8_t down)
+											  { return down != 0; });
+			if (key == keypadMemory + KEY_COUNT)
+			{
+				pc -= 2;
+			}
+			else
+			{
+				V[x] = static_cast<uint8_t>(key - keypadMemory);
+			}
+			break;
+		}
+		default:
+			return 0;
+		}
+		if (pc == R_PC)
+		{
+			return length;
+		}
+	}
+	return 0;
+}
+
+bool Chip8::canReturn(uint16_t start, uint16_t address, unsigned int depth) const
+{
+	if (depth == MAX_IDLE_LOOP)
+	{
+		return false;
+	}
+	address %= MEMORY_SIZE;
+	const uint16_t opcode = (memory[address] << 8) | memory[(address + 1) % MEMORY_SIZE];
+	// Where the instruction may go next, as in simulateIdlePass
+	uint16_t next[2] = {static_cast<uint16_t>(address + 2)};
+	unsigned int count = 1;
+	switch (classifyOpcode(opcode))
+	{
+	case K_NOP:
+	case K_6xkk:
+	case K_7xkk:
+	case K_8xy0:
+	case K_Annn:
+	case K_Fx07:
+		break;
+	case K_00FD:
+		next[0] = address;
+		break;
+	case K_1nnn:
+		next[0] = opcode & 0x0FFFu;
+		break;
+	case K_3xkk:
+	case K_4xkk:
+	case K_5xy0:
+	case K_9xy0:
+	case K_Ex9E:
+	case K_ExA1:
+		next[count++] = address + 4;
+		break;
+	case K_Fx0A:
+		next[count++] = address;
+		break;
+	default:
+		return false;
+	}
+	for (unsigned int n = 0; n < count; ++n)
+	{
+		if (next[n] == start || canReturn(start, next[n], depth + 1))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Chip8::isIdle() const
+{
+	IdleLoop loop;
+	return findIdleLoop(loop);
+}
+
+void Chip8::setIdleSkip(bool enabled)
+{
+	idleSkip = enabled;
+}
+
+uint64_t Chip8::getIdleCycleCount() const
+{
+	return idleCycles;
+}
+
+void Chip8::advanceClock(unsigned int cycles)
+{
+	// cycles never goes past the next timer event
+	cycleCount += cycles;
+	cyclesUntilTimer -= cycles;
+	if (cyclesUntilTimer == 0)
+	{
+		// Decrement the delay timer
+		if (R_DELAY_TIMER > 0)
+		{
+			--R_DELAY_TIMER;
+		}
+
+		// Decrement the sound timer
+		if (R_BUZZER_TIMER > 0)
+		{
+			--R_BUZZER_TIMER;
+		}
+		if (buzzerEventsEnabled && buzzerOn && R_BUZZER_TIMER == 0)
+		{
+			buzzerOn = false;
+			buzzerEvents.push_back({cycleCount, false});
+		}
+
+		++timerTicks;
+		++frameCount;
+		scheduleTimer();
+	}
+}
+
+void Chip8::scheduleTimer()
+{
+	// Timer event k happens at cycle ceil(k * cpuFrequency / TIMER_FREQUENCY),
+	// counted from the last frequency change, so they never drift
+	uint64_t next = timerBaseCycle + ((timerTicks + 1) * cpuFrequency + TIMER_FREQUENCY - 1) / TIMER_FREQUENCY;
+	cyclesUntilTimer = static_cast<unsigned int>(next - cycleCount);
 }
 
 void Chip8::loadROM(char const *filepath)
 {
-	std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+	std::ifstream file(filepath, std::ios::binary);
 	if (!file)
 	{
 		std::cerr << "Failed to open ROM: " << filepath << "\n";
 		return;
 	}
 
-	// Get file size
-	std::streampos lastPos = file.tellg();
-	file.seekg(0, std::ios::beg);
-
-	std::vector<uint8_t> buffer(lastPos);
-	if (!file.read(reinterpret_cast<char *>(buffer.data()), lastPos))
+	// Read one byte more than fits to detect ROMs that are too large
+	uint8_t buffer[MEMORY_SIZE - ROM_START_ADDRESS + 1];
+	file.read(reinterpret_cast<char *>(buffer), sizeof(buffer));
+	if (file.bad())
 	{
 		throw std::runtime_error("Failed to read file");
 	}
-	for (long i = 0; i < lastPos; ++i)
+	size_t size = static_cast<size_t>(file.gcount());
+	if (!loadROM(buffer, size))
 	{
-		memory[ROM_START_ADDRESS + i] = buffer[i];
-		// std::cout << "Buffer[" << i << "] = " << std::hex << (static_cast<uint16_t>(static_cast<uint8_t>(buffer[i]))) << "\n";
+		std::cerr << "ROM too large: " << filepath << "\n";
+		return;
 	}
 
 	file.close();
 	std::cout << "Loaded ROM: " << filepath << "\n";
-	std::cout << "ROM size = " << std::dec << lastPos << "\n";
+	std::cout << "ROM size = " << std::dec << size << "\n";
+}
+
+bool Chip8::loadROM(const uint8_t *data, size_t size)
+{
+	return loadROM(RomView{data, size, hashBytes(data, size)});
+}
+
+bool Chip8::loadROM(RomView rom)
+{
+	if (rom.size > MEMORY_SIZE - ROM_START_ADDRESS)
+	{
+		return false;
+	}
+	std::memcpy(memory + ROM_START_ADDRESS, rom.data, rom.size);
+	// Code decoded from the rest of memory still matches it, like after
+	// writeMemory. The AOT program is picked again by the new hash
+	invalidateCode(ROM_START_ADDRESS, static_cast<uint16_t>(rom.size));
+	romHash = rom.hash;
+	return true;
+}
+
+uint64_t Chip8::getRomHash() const
+{
+	return romHash;
 }
 
 void Chip8::tick()
+{
+	runEndCycle = cycleCount + 1;
+	runLeft = 0;
+#ifdef CHIP8_TRACE
+	traceStep(cycleCount);
+#else
+	step();
+#endif
+	advanceClock(1);
+}
+
+#ifdef CHIP8_TRACE
+void Chip8::traceStep(uint64_t cycle)
+{
+	const uint16_t address = R_PC % MEMORY_SIZE;
+	const uint16_t opcode = (memory[address] << 8) | memory[(address + 1) % MEMORY_SIZE];
+	uint8_t before[REGISTER_COUNT];
+	std::memcpy(before, REG, sizeof(before));
+	step();
+	trace->record(cycle, address, opcode, before, REG, R_I);
+}
+#endif
+
+void Chip8::step()
 {
 	// CPU CYCLE => FETCH, DECODE, EXECUTE
 
-	// 1) FETCH
+	// 1) FETCH + 2) DECODE
+	// Decoding is done once per address and cached,
+	// so hot loops go straight to the handler
+	const uint16_t address = R_PC % MEMORY_SIZE;
+	Instruction &ins = decodeCache[address];
+	if (!ins.handler || !decodeCaching)
+	{
+		decode(address);
+	}
+
+	// Increment the PC by 2 bytes
+	R_PC += 2;
+
+	// 3) EXECUTE
+	// ->* is pointer to member operator
+	// Call a member function of this instance
+	// using the address stored in the decoded instruction.
+	(this->*ins.handler)(ins);
+
+#ifdef CHIP8_PROFILE
+	profile->record(address, ins.opcode, R_PC);
+#endif
+}
+
+void Chip8::decode(uint16_t address)
+{
 	// Fetch 2 bytes from memory
 	// Big-endian (MSB first)
 	// Memory[0] = 0xAB = high byte at lower/first address
 	// Memory[1] = 0xCD = low byte
 	// Opcode = 0xABCD
-	uint8_t highByte = memory[R_PC];
-	uint8_t lowByte = memory[R_PC + 1];
-	opcode = (highByte << 8) | lowByte;
-	// std::cout << "Opcode: " << std::hex << opcode << "\n";
+	uint8_t highByte = memory[address];
+	uint8_t lowByte = memory[(address + 1) % MEMORY_SIZE];
+	uint16_t opcode = (highByte << 8) | lowByte;
 
-	// Increment the PC by 2 bytes
-	R_PC += 2;
-
-	// 2) DECODE
 	// 0xABCD => 2 bytes => 1 byte = 0xAB, 1 byte = 0xCD
 	// [ 1 byte ][ 1 byte ]
 	// [ 4 bits  ][ 4 bits  ][ 4 bits  ][ 4 bits  ]
 	// [ nibble3 ][ nibble2 ][ nibble1 ][ nibble0 ]
 	// OP X Y N
 	// 0xDXYN
+	// Example: 0xABCD & 0x0F00 = 0x0B00, 0x0B00 >> 8u = 0x0B
+	Instruction &ins = decodeCache[address];
+	ins.opcode = opcode;
+	ins.nnn = opcode & 0x0FFFu;
+	ins.x = (opcode & 0x0F00u) >> 8u;
+	ins.y = (opcode & 0x00F0u) >> 4u;
+	ins.kk = opcode & 0x00FFu;
+	ins.n = opcode & 0x000Fu;
+
+	// Resolve nested routing once, here, instead of on every execution
 	const uint8_t nibble3 = (opcode & 0xF000u) >> 12u;
-	assert(nibble3 >= 0);
-	assert(nibble3 <= 15);
-	auto pointerToMemberFn = routerTable[nibble3];
+	switch (nibble3)
+	{
+	case 0x0:
+		ins.handler = subTable0[ins.kk];
+		break;
+	case 0x8:
+		ins.handler = subTable8[ins.n];
+		break;
+	case 0xE:
+		ins.handler = subTableE[ins.n];
+		break;
+	case 0xF:
+		ins.handler = subTableF[ins.kk];
+		break;
+	default:
+		ins.handler = routerTable[nibble3];
+		break;
+	}
+}
 
-	// 3) EXECUTE
-	// ->* is pointer to member operator
-	// Call a member function of this instance
-	// using the address stored in pointerToFunc.
-	(this->*pointerToMemberFn)();
+void Chip8::writeMemory(unsigned int address, uint8_t value)
+{
+	address %= MEMORY_SIZE;
+	memory[address] = value;
+	invalidateCode(address, 1);
+}
 
-	// INTERNALS
-	// Decrement the delay timer
-	if (R_DELAY_TIMER > 0)
+void Chip8::invalidateCode(uint16_t address, uint16_t length)
+{
+	// An instruction at address - 1 also reads the byte at address
+	unsigned int first = address > 0 ? address - 1 : 0;
+	unsigned int last = std::min<unsigned int>(address + length, MEMORY_SIZE);
+	for (unsigned int a = first; a < last; ++a)
+	{
+		decodeCache[a].handler = nullptr;
+	}
+	// A path to any address may run through the changed code
+	if (idleCodeKnown)
+	{
+		std::fill(std::begin(idleCode), std::end(idleCode), IdleCode::Unknown);
+		idleCodeKnown = false;
+	}
+	if (jit)
 	{
-		--R_DELAY_TIMER;
+		jit->invalidate(address, length);
 	}
+	if (aot)
+	{
+		aot->invalidate(address, length);
+	}
+}
+
+bool Chip8::isHires() const
+{
+	return hires;
+}
+
+unsigned int Chip8::getVideoWidth() const
+{
+	return hires ? HIRES_WIDTH : VIDEO_WIDTH;
+}
+
+unsigned int Chip8::getVideoHeight() const
+{
+	return hires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+}
 
-	// Decrement the sound timer
-	if (R_BUZZER_TIMER > 0)
+unsigned int Chip8::getRowWords() const
+{
+	return getVideoWidth() / 64;
+}
+
+bool Chip8::getPixel(unsigned int x, unsigned int y) const
+{
+	const unsigned int word = y * getRowWords() + x / 64;
+	uint64_t lit = 0;
+	for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
 	{
-		--R_BUZZER_TIMER;
+		lit |= videoMemory[plane][word];
 	}
+	return (lit >> (63 - x % 64)) & 1u;
 }
 
-void Chip8::DO_NOTHING()
+void Chip8::expandVideo(uint32_t *pixels, unsigned int stride) const
 {
-	// NOP
+	expandVideoRows(pixels, stride, 0, getVideoHeight());
+}
+
+void Chip8::expandVideoRows(uint32_t *pixels, unsigned int stride, unsigned int firstRow, unsigned int rowCount) const
+{
+	expandRows(videoMemory, hires, firstRow, rowCount, pixels, stride);
+}
+
+void Chip8::expandRows(const uint64_t (*planes)[VIDEO_WORDS], bool hires, unsigned int firstRow, unsigned int rowCount, uint32_t *pixels, unsigned int stride)
+{
+	const unsigned int words = hires ? HIRES_WIDTH / 64 : VIDEO_WIDTH / 64;
+	// Lo-res pixels are 2x2 output pixels
+	const unsigned int scale = hires ? 1 : 2;
+	for (unsigned int y = 0; y < rowCount; ++y)
+	{
+		uint32_t *dst = pixels + y * scale * stride;
+		for (unsigned int w = 0; w < words; ++w)
+		{
+			uint64_t bits[VIDEO_PLANES];
+			for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+			{
+				bits[plane] = planes[plane][(firstRow + y) * words + w];
+			}
+			for (unsigned int x = 0; x < 64; ++x)
+			{
+				// MSB is the leftmost pixel
+				unsigned int color = 0;
+				for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+				{
+					color |= (bits[plane] >> 63u) << plane;
+					bits[plane] <<= 1;
+				}
+				for (unsigned int s = 0; s < scale; ++s)
+				{
+					dst[(w * 64 + x) * scale + s] = PLANE_COLORS[color];
+				}
+			}
+		}
+		if (scale == 2)
+		{
+			std::memcpy(dst + stride, dst, HIRES_WIDTH * sizeof(uint32_t));
+		}
+	}
+}
+
+uint64_t Chip8::takeDirtyRows()
+{
+	uint64_t rows = dirtyRows;
+	dirtyRows = 0;
+	return rows;
 }
 
-void Chip8::SubHandlerFn0()
+void Chip8::clearVideo()
 {
-	auto nibble0 = opcode & 0x000Fu;
-	assert(nibble0 >= 0);
-	assert(nibble0 <= 15);
-	(this->*subTable0[nibble0])();
+	const unsigned int height = getVideoHeight();
+	for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+	{
+		if (planeMask & (1u << plane))
+		{
+			uint64_t *video = videoMemory[plane];
+			uint64_t lit = hires ? litRows<HIRES_WIDTH / 64>(video, height) : litRows<VIDEO_WIDTH / 64>(video, height);
+			if (lit)
+			{
+				dirtyRows |= lit;
+				std::memset(video, 0, height * getRowWords() * sizeof(uint64_t));
+			}
+		}
+	}
 }
 
-void Chip8::SubHandlerFn8()
+void Chip8::scrollDown(unsigned int rows)
 {
-	auto nibble0 = opcode & 0x000Fu;
-	assert(nibble0 >= 0);
-	assert(nibble0 <= 15);
-	(this->*subTable8[nibble0])();
+	const unsigned int words = getRowWords();
+	const unsigned int height = getVideoHeight();
+	rows = std::min(rows, height);
+	for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+	{
+		if (planeMask & (1u << plane))
+		{
+			uint64_t *video = videoMemory[plane];
+			std::memmove(video + rows * words, video, (height - rows) * words * sizeof(uint64_t));
+			std::memset(video, 0, rows * words * sizeof(uint64_t));
+		}
+	}
+	dirtyRows = ~0ull;
+}
+
+void Chip8::scrollUp(unsigned int rows)
+{
+	const unsigned int words = getRowWords();
+	const unsigned int height = getVideoHeight();
+	rows = std::min(rows, height);
+	for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+	{
+		if (planeMask & (1u << plane))
+		{
+			uint64_t *video = videoMemory[plane];
+			std::memmove(video, video + rows * words, (height - rows) * words * sizeof(uint64_t));
+			std::memset(video + (height - rows) * words, 0, rows * words * sizeof(uint64_t));
+		}
+	}
+	dirtyRows = ~0ull;
+}
+
+void Chip8::scrollRight()
+{
+	for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+	{
+		if (planeMask & (1u << plane))
+		{
+			if (hires)
+			{
+				shiftRowsRight<HIRES_WIDTH / 64>(videoMemory[plane], HIRES_HEIGHT);
+			}
+			else
+			{
+				shiftRowsRight<VIDEO_WIDTH / 64>(videoMemory[plane], VIDEO_HEIGHT);
+			}
+		}
+	}
+	dirtyRows = ~0ull;
+}
+
+void Chip8::scrollLeft()
+{
+	for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+	{
+		if (planeMask & (1u << plane))
+		{
+			if (hires)
+			{
+				shiftRowsLeft<HIRES_WIDTH / 64>(videoMemory[plane], HIRES_HEIGHT);
+			}
+			else
+			{
+				shiftRowsLeft<VIDEO_WIDTH / 64>(videoMemory[plane], VIDEO_HEIGHT);
+			}
+		}
+	}
+	dirtyRows = ~0ull;
 }
 
-void Chip8::SubHandlerFnE()
+void Chip8::setHires(bool enabled)
 {
-	auto nibble0 = opcode & 0x000Fu;
-	assert(nibble0 >= 0);
-	assert(nibble0 <= 15);
-	(this->*subTableE[nibble0])();
+	hires = enabled;
+	std::memset(videoMemory, 0, sizeof(videoMemory));
+	dirtyRows = ~0ull;
 }
 
-void Chip8::SubHandlerFnF()
+uint64_t Chip8::videoHash() const
 {
-	uint8_t lowByte = opcode & 0x00FFu;
-	assert(lowByte <= 255);
-	(this->*subTableF[lowByte])();
+	return hashBytes(videoMemory, sizeof(videoMemory));
 }
 
-void Chip8::OP_00E0()
+uint64_t Chip8::stateHash() const
+{
+	uint64_t hash = hashBytes(memory, sizeof(memory));
+	hash = hashBytes(videoMemory, sizeof(videoMemory), hash);
+	hash = hashBytes(stackMemory, sizeof(stackMemory), hash);
+	hash = hashBytes(REG, sizeof(REG), hash);
+	hash = hashBytes(keypadMemory, sizeof(keypadMemory), hash);
+	hash = hashBytes(rplFlags, sizeof(rplFlags), hash);
+	const uint64_t scalars[] = {R_I, R_PC, R_SP, R_DELAY_TIMER, R_BUZZER_TIMER, hires, planeMask, cpuFrequency,
+								cyclesUntilTimer, cycleCount, timerBaseCycle, timerTicks, frameCount, rngState};
+	return hashBytes(scalars, sizeof(scalars), hash);
+}
+
+const Chip8Profile *Chip8::getProfile() const
+{
+#ifdef CHIP8_PROFILE
+	return profile.get();
+#else
+	return nullptr;
+#endif
+}
+
+Chip8Trace *Chip8::getTrace()
+{
+#ifdef CHIP8_TRACE
+	return trace.get();
+#else
+	return nullptr;
+#endif
+}
+
+void Chip8::saveState(Chip8State &state) const
+{
+	std::memcpy(&state, static_cast<const Chip8State *>(this), sizeof(Chip8State));
+}
+
+void Chip8::loadState(const Chip8State &state)
+{
+	// Only code in changed 64-byte blocks has to be decoded or translated again
+	uint64_t changedBlocks = 0;
+	for (unsigned int block = 0; block < MEMORY_SIZE / 64; ++block)
+	{
+		if (std::memcmp(memory + block * 64, state.memory + block * 64, 64) != 0)
+		{
+			changedBlocks |= 1ull << block;
+		}
+	}
+	if (hires != state.hires)
+	{
+		dirtyRows = ~0ull;
+	}
+	const unsigned int words = (state.hires ? HIRES_WIDTH : VIDEO_WIDTH) / 64;
+	for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+	{
+		for (unsigned int word = 0; word < VIDEO_WORDS; ++word)
+		{
+			if (videoMemory[plane][word] != state.videoMemory[plane][word])
+			{
+				dirtyRows |= 1ull << (word / words % 64);
+			}
+		}
+	}
+
+	std::memcpy(static_cast<Chip8State *>(this), &state, sizeof(Chip8State));
+	// Edges continue from the restored buzzer
+	buzzerOn = R_BUZZER_TIMER > 0;
+
+	for (unsigned int block = 0; block < MEMORY_SIZE / 64; ++block)
+	{
+		if (changedBlocks & (1ull << block))
+		{
+			invalidateCode(block * 64, 64);
+		}
+	}
+}
+
+bool Chip8::saveState(char const *filepath) const
+{
+	std::ofstream file(filepath, std::ios::binary);
+	uint32_t header[2] = {STATE_FILE_VERSION, sizeof(Chip8State)};
+	file.write(STATE_FILE_MAGIC, sizeof(STATE_FILE_MAGIC));
+	file.write(reinterpret_cast<const char *>(header), sizeof(header));
+	file.write(reinterpret_cast<const char *>(static_cast<const Chip8State *>(this)), sizeof(Chip8State));
+	if (!file)
+	{
+		std::cerr << "Failed to write state: " << filepath << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool Chip8::loadState(char const *filepath)
+{
+	std::ifstream file(filepath, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "Failed to open state: " << filepath << "\n";
+		return false;
+	}
+	char magic[sizeof(STATE_FILE_MAGIC)];
+	uint32_t header[2];
+	Chip8State state;
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char *>(header), sizeof(header));
+	file.read(reinterpret_cast<char *>(&state), sizeof(Chip8State));
+	if (!file || std::memcmp(magic, STATE_FILE_MAGIC, sizeof(magic)) != 0 ||
+		header[0] != STATE_FILE_VERSION || header[1] != sizeof(Chip8State))
+	{
+		std::cerr << "Not a state file for this build: " << filepath << "\n";
+		return false;
+	}
+	loadState(state);
+	return true;
+}
+
+void Chip8::DO_NOTHING(const Instruction &)
+{
+	// NOP
+}
+
+void Chip8::OP_00E0(const Instruction &ins)
 {
 	// CLS
 	// No arguments
 	// Clear the video memory with zeros
-	memset(videoMemory, 0, sizeof(videoMemory));
+	clearVideo();
 }
 
-void Chip8::OP_00EE()
+void Chip8::OP_00EE(const Instruction &ins)
 {
 	// RET
 	// No arguments
 	// Pop the last address from the stack and set the PC to it
 	--R_SP;
-	R_PC = stackMemory[R_SP];
+	R_PC = stackMemory[R_SP % STACK_LEVELS];
+}
+
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+// @@@ 00Cn–00FF — SCHIP/XO-CHIP display
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+
+void Chip8::OP_00Cn(const Instruction &ins)
+{
+	// SCD n
+	// Scroll the selected planes down n rows
+	scrollDown(ins.n);
+}
+
+void Chip8::OP_00Dn(const Instruction &ins)
+{
+	// SCU n (XO-CHIP)
+	// Scroll the selected planes up n rows
+	scrollUp(ins.n);
+}
+
+void Chip8::OP_00FB(const Instruction &ins)
+{
+	// SCR
+	// Scroll the selected planes right 4 pixels
+	scrollRight();
+}
+
+void Chip8::OP_00FC(const Instruction &ins)
+{
+	// SCL
+	// Scroll the selected planes left 4 pixels
+	scrollLeft();
+}
+
+void Chip8::OP_00FD(const Instruction &ins)
+{
+	// EXIT
+	// Stop the program by repeating this instruction forever
+	R_PC -= 2;
+}
+
+void Chip8::OP_00FE(const Instruction &ins)
+{
+	// LOW
+	// 64x32 mode, clears the display
+	setHires(false);
+}
+
+void Chip8::OP_00FF(const Instruction &ins)
+{
+	// HIGH
+	// 128x64 mode, clears the display
+	setHires(true);
 }
 
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 // @@@ 1xxx, 2xxx, Bxxx — Jumps and Calls
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 
-void Chip8::OP_1nnn()
+void Chip8::OP_1nnn(const Instruction &ins)
 {
 	// JP address
 	// Address: nnn (12 bits)
 	// Jump to address nnn
-	uint16_t address = opcode & 0x0FFFu;
+	uint16_t address = ins.nnn;
 	R_PC = address;
 }
 
-void Chip8::OP_2nnn()
+void Chip8::OP_2nnn(const Instruction &ins)
 {
 	// CALL address
 	// Address: nnn (12 bits)
 	// Call subroutine at nnn
 	// Push current PC to stack and set PC to nnn
-	uint16_t address = opcode & 0x0FFFu;
-	stackMemory[R_SP] = R_PC;
+	uint16_t address = ins.nnn;
+	stackMemory[R_SP % STACK_LEVELS] = R_PC;
 	++R_SP;
 	R_PC = address;
 }
 
-void Chip8::OP_Bnnn()
+template <typename Quirks>
+void Chip8::OP_Bnnn(const Instruction &ins)
 {
 	// Jump to NNN + V0
 	// Address: nnn (12 bits)
 	// Jump to address nnn + V0
 	// Set PC to V0 + nnn
-	uint16_t address = opcode & 0x0FFFu;
-	R_PC = REG[0] + address;
+	// SCHIP reads it as Bxnn and adds Vx instead
+	uint16_t address = ins.nnn;
+	uint8_t Vx = Quirks::JUMP_USES_VX ? ins.x : 0;
+	R_PC = REG[Vx] + address;
 }
 
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 // @@@ 3xxx, 4xxx, 5xxx and 9xxx — Conditional skips
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 
-void Chip8::OP_3xkk()
+void Chip8::OP_3xkk(const Instruction &ins)
 {
 	// skip if VX == NN
 	// Vx: (4 bits) X = values 0-F
@@ -256,49 +1359,49 @@ void Chip8::OP_3xkk()
 	// 	Opcode = 0xABCD
 	// 0xABCD & 0x0F00 = 0x0B00
 	// 0x0B00 >> 8u = 0x0B
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+	uint8_t Vx = ins.x;
+	uint8_t byte = ins.kk;
 	if (REG[Vx] == byte)
 	{
 		R_PC += 2;
 	}
 }
 
-void Chip8::OP_4xkk()
+void Chip8::OP_4xkk(const Instruction &ins)
 {
 	// skip if VX != NN
 	// Vx: (4 bits) X = values 0-F
 	// Byte: kk (8 bits)
 	// If Vx != kk, increment PC by 2
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+	uint8_t Vx = ins.x;
+	uint8_t byte = ins.kk;
 	if (REG[Vx] != byte)
 	{
 		R_PC += 2;
 	}
 }
 
-void Chip8::OP_5xy0()
+void Chip8::OP_5xy0(const Instruction &ins)
 {
 	// skip if VX == VY
 	// Vx: (4 bits) X = values 0-F
 	// Vy: (4 bits) Y = values 0-F
 	// If Vx == Vy, increment PC by 2
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = ins.x;
+	uint8_t Vy = ins.y;
 	if (REG[Vx] == REG[Vy])
 	{
 		R_PC += 2;
 	}
 }
 
-void Chip8::OP_9xy0()
+void Chip8::OP_9xy0(const Instruction &ins)
 {
 	// skip if VX != VY
 	// Vx: (4 bits) X = values 0-F
 	// Vy: (4 bits) Y = values 0-F
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = ins.x;
+	uint8_t Vy = ins.y;
 	if (REG[Vx] != REG[Vy])
 	{
 		R_PC += 2;
@@ -309,21 +1412,21 @@ void Chip8::OP_9xy0()
 // @@@ 6xxx–7xxx — Loads / Adds
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 
-void Chip8::OP_6xkk()
+void Chip8::OP_6xkk(const Instruction &ins)
 {
 	// LD Vx, byte
 	// LOAD byte kk into register Vx
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+	uint8_t Vx = ins.x;
+	uint8_t byte = ins.kk;
 	REG[Vx] = byte;
 }
 
-void Chip8::OP_7xkk()
+void Chip8::OP_7xkk(const Instruction &ins)
 {
 	// ADD Vx, byte
 	// Set Vx = Vx + kk
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+	uint8_t Vx = ins.x;
+	uint8_t byte = ins.kk;
 	REG[Vx] += byte;
 }
 
@@ -331,49 +1434,67 @@ void Chip8::OP_7xkk()
 // @@@ 8xxx — Arithmetic / Bitwise
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 
-void Chip8::OP_8xy0()
+void Chip8::OP_8xy0(const Instruction &ins)
 {
 	// LD Vx, Vy, aka, Vx <= Vy
 	// This copies the value in register Vy into register Vx.
 	// The flag register VF is not affected.
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = ins.x;
+	uint8_t Vy = ins.y;
 	REG[Vx] = REG[Vy];
 }
 
-void Chip8::OP_8xy1()
+template <typename Quirks>
+void Chip8::OP_8xy1(const Instruction &ins)
 {
 	// OR Vx, Vy
 	// 8XY1 performs a bitwise OR between two REG.
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = ins.x;
+	uint8_t Vy = ins.y;
 	REG[Vx] |= REG[Vy];
+	if constexpr (Quirks::LOGIC_RESETS_VF)
+	{
+		// COSMAC: the logic unit leaves VF at 0
+		REG[0xF] = 0;
+	}
 }
 
-void Chip8::OP_8xy2()
+template <typename Quirks>
+void Chip8::OP_8xy2(const Instruction &ins)
 {
 	// AND Vx, Vy
 	// 8XY2 performs a bitwise AND between two REG.
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = ins.x;
+	uint8_t Vy = ins.y;
 	REG[Vx] &= REG[Vy];
+	if constexpr (Quirks::LOGIC_RESETS_VF)
+	{
+		// COSMAC: the logic unit leaves VF at 0
+		REG[0xF] = 0;
+	}
 }
 
-void Chip8::OP_8xy3()
+template <typename Quirks>
+void Chip8::OP_8xy3(const Instruction &ins)
 {
 	// XOR Vx, Vy
 	// 8XY3 performs a bitwise XOR between two REG.
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = ins.x;
+	uint8_t Vy = ins.y;
 	REG[Vx] ^= REG[Vy];
+	if constexpr (Quirks::LOGIC_RESETS_VF)
+	{
+		// COSMAC: the logic unit leaves VF at 0
+		REG[0xF] = 0;
+	}
 }
 
-void Chip8::OP_8xy4()
+void Chip8::OP_8xy4(const Instruction &ins)
 {
 	// ADD Vx, Vy
 	// Set Vx = Vx + Vy, set VF = carry
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = ins.x;
+	uint8_t Vy = ins.y;
 	uint16_t sum = REG[Vx] + REG[Vy];
 	// Set carry flag
 	if (sum > 255u)
@@ -387,12 +1508,12 @@ void Chip8::OP_8xy4()
 	REG[Vx] = sum & 0xFFu;
 }
 
-void Chip8::OP_8xy5()
+void Chip8::OP_8xy5(const Instruction &ins)
 {
 	// SUB Vx, Vy
 	// Set Vx = Vx - Vy, set VF = NOT borrow
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = ins.x;
+	uint8_t Vy = ins.y;
 	if (REG[Vx] > REG[Vy])
 	{
 		REG[0xF] = 1;
@@ -404,25 +1525,27 @@ void Chip8::OP_8xy5()
 	REG[Vx] -= REG[Vy];
 }
 
-void Chip8::OP_8xy6()
+template <typename Quirks>
+void Chip8::OP_8xy6(const Instruction &ins)
 {
 	// the value in Vy is shifted right by 1.
-	// Set Vx = Vx SHR 1
-	// VF is set to the least significant bit of Vx before the shift.
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	// Set Vx = Vx SHR 1 (COSMAC: Vx = Vy SHR 1)
+	// VF is set to the least significant bit of the source before the shift.
+	uint8_t Vx = ins.x;
+	uint8_t source = Quirks::SHIFT_USES_VY ? ins.y : ins.x;
 	// Save LSB in VF
-	REG[0xF] = (REG[Vx] & 0x0001u);
-	REG[Vx] = REG[Vx] >> 1;
+	REG[0xF] = (REG[source] & 0x0001u);
+	REG[Vx] = REG[source] >> 1;
 }
 
-void Chip8::OP_8xy7()
+void Chip8::OP_8xy7(const Instruction &ins)
 {
 	// SUBN Vx, Vy
 	// This is a reverse subtract instruction
 	// Vy minus Vx → stored in Vx.
 	// Set Vx = Vy - Vx, set VF = NOT borrow
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+	uint8_t Vx = ins.x;
+	uint8_t Vy = ins.y;
 	// If no borrow, set VF to 1
 	// Has borrow if Vx >= Vy
 	// 20 − 20 = 0 => No borrow → VF = 1
@@ -437,15 +1560,17 @@ void Chip8::OP_8xy7()
 	REG[Vx] = REG[Vy] - REG[Vx];
 }
 
-void Chip8::OP_8xyE()
+template <typename Quirks>
+void Chip8::OP_8xyE(const Instruction &ins)
 {
 	// SHL Vx
-	// the value in Vx is shifted left by 1.
-	// VF = MSB (bit 7) of Vy before the shift
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t bit7 = (REG[Vx] & 0x80u) >> 7u;
+	// the value in Vx is shifted left by 1 (COSMAC: Vx = Vy SHL 1).
+	// VF = MSB (bit 7) of the source before the shift
+	uint8_t Vx = ins.x;
+	uint8_t source = Quirks::SHIFT_USES_VY ? ins.y : ins.x;
+	uint8_t bit7 = (REG[source] & 0x80u) >> 7u;
 	REG[0xF] = bit7;
-	REG[Vx] <<= 1;
+	REG[Vx] = REG[source] << 1;
 }
 
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
@@ -453,27 +1578,28 @@ void Chip8::OP_8xyE()
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 
 // Ax — Index register
-void Chip8::OP_Annn()
+void Chip8::OP_Annn(const Instruction &ins)
 {
 	// LD I, address
 	// Address: nnn (12 bits)
 	// Set index register = nnn
-	uint16_t address = opcode & 0x0FFFu;
+	uint16_t address = ins.nnn;
 	R_I = address;
 }
 
-void Chip8::OP_Cxkk()
+void Chip8::OP_Cxkk(const Instruction &ins)
 {
 	// RND Vx, byte
 	// VX = rand() & NN
 	// Set Vx = random byte AND kk
 	// Vx: (4 bits) X = values 0-F
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t byte = opcode & 0x00FFu;
+	uint8_t Vx = ins.x;
+	uint8_t byte = ins.kk;
 	REG[Vx] = getRandomByte() & byte;
 }
 
-void Chip8::OP_Dxyn()
+template <typename Quirks>
+void Chip8::OP_Dxyn(const Instruction &ins)
 {
 	// DRW Vx, Vy, height
 	// Drawing sprites to the screen
@@ -481,75 +1607,122 @@ void Chip8::OP_Dxyn()
 	// Draw N-byte sprite at (VX, VY), set VF on collision
 
 	// Vx: (4 bits) X = values 0-F
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = ins.x;
 	// Vy: (4 bits) Y = values 0-F
-	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
-	// Height: n (4 bits)
-	uint8_t numRows = opcode & 0x000Fu;
+	uint8_t Vy = ins.y;
+	// Height: n (4 bits), 0 draws a 16x16 sprite (see drawSprite)
+	uint8_t numRows = ins.n;
 
 	// Reset VF to check for collisions
 	REG[0xF] = 0;
 
+	if (drawSprite<Quirks>(REG[Vx], REG[Vy], R_I, numRows))
+	{
+		REG[0xF] = 1;
+	}
+}
+
+template <typename Quirks>
+bool Chip8::drawSprite(uint8_t x, uint8_t y, uint16_t address, uint8_t n)
+{
+	constexpr bool Clip = Quirks::CLIP_SPRITES;
 	// Wrap around screen coordinates
-	uint8_t startX = REG[Vx] % VIDEO_WIDTH;
-	uint8_t startY = REG[Vy] % VIDEO_HEIGHT;
-	for (uint8_t row = 0; row < numRows; ++row)
+	const unsigned int words = getRowWords();
+	const unsigned int startX = x % getVideoWidth();
+	const unsigned int startY = y % getVideoHeight();
+	// Dxy0 is a 16x16 sprite, or a zero-row draw in plain CHIP-8 lo-res
+	const bool big = n == 0 && (hires || Quirks::LORES_BIG_SPRITES);
+	const unsigned int numRows = big ? 16 : n;
+	const unsigned int spriteWidth = big ? 16 : 8;
+	// The sprite lands in word firstWord shifted right by shift, the
+	// pixels shifted out continue in the next word (wrapping to the
+	// left edge, which is the same word in lo-res)
+	const unsigned int firstWord = startX / 64;
+	const unsigned int secondWord = (firstWord + 1) % words;
+	const unsigned int shift = startX % 64;
+	// Clipping: nothing continues past the last word of the row
+	const bool clipRight = Clip && firstWord + 1 == words;
+
+	uint64_t collision = 0;
+	for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
 	{
-		uint8_t spriteByte = memory[R_I + row];
-		for (uint8_t col = 0; col < 8; ++col)
+		if (!(planeMask & (1u << plane)))
+		{
+			continue;
+		}
+		for (unsigned int row = 0; row < numRows; ++row)
 		{
-			uint8_t spritePixel = spriteByte & (0b1000'0000 >> col);
-			uint8_t x = (startX + col) % VIDEO_WIDTH;
-			uint8_t y = (startY + row) % VIDEO_HEIGHT;
-			uint32_t *screenPixel = &videoMemory[y * VIDEO_WIDTH + x];
-			if (spritePixel)
+			uint64_t spriteBits = memory[address % MEMORY_SIZE];
+			if (spriteWidth == 16)
 			{
-				if (*screenPixel == 0xFFFFFFFF)
-				{
-					// Collision detected
-					REG[0xF] = 1;
-				}
-				// Always XOR the pixel
-				*screenPixel ^= 0xFFFFFFFF;
+				spriteBits = (spriteBits << 8) | memory[(address + 1) % MEMORY_SIZE];
+			}
+			address += spriteWidth / 8;
+			uint64_t sprite = spriteBits << (64 - spriteWidth);
+			uint64_t first = sprite >> shift;
+			uint64_t second = shift && !clipRight ? sprite << (64 - shift) : 0;
+
+			unsigned int screenY = startY + row;
+			if (Clip && screenY >= getVideoHeight())
+			{
+				continue;
+			}
+			screenY %= getVideoHeight();
+			uint64_t *screenRow = videoMemory[plane] + screenY * words;
+			// Collision: any sprite pixel that is already on
+			collision |= (screenRow[firstWord] & first) | (screenRow[secondWord] & second);
+			// Always XOR the pixels
+			screenRow[firstWord] ^= first;
+			screenRow[secondWord] ^= second;
+			if (sprite)
+			{
+				dirtyRows |= 1ull << screenY;
 			}
 		}
 	}
+	return collision != 0;
 }
 
+// The threaded interpreter and Chip8Lockstep draw without OP_Dxyn
+template bool Chip8::drawSprite<QuirksDefault>(uint8_t, uint8_t, uint16_t, uint8_t);
+template bool Chip8::drawSprite<QuirksChip8>(uint8_t, uint8_t, uint16_t, uint8_t);
+template bool Chip8::drawSprite<QuirksSchip>(uint8_t, uint8_t, uint16_t, uint8_t);
+template bool Chip8::drawSprite<QuirksXoChip>(uint8_t, uint8_t, uint16_t, uint8_t);
+
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 // @@@ Ex — Keypad skip
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 
-void Chip8::OP_Ex9E()
+void Chip8::OP_Ex9E(const Instruction &ins)
 {
 	// SKP Vx
 	// skip if key VX pressed
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t key = REG[Vx];
+	uint8_t Vx = ins.x;
+	uint8_t key = REG[Vx] % KEY_COUNT;
 	if (keypadMemory[key])
 	{
 		R_PC += 2;
 	}
 }
 
-void Chip8::OP_ExA1()
+void Chip8::OP_ExA1(const Instruction &ins)
 {
 	// SKNP Vx
 	// skip if key VX not pressed
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-	uint8_t key = REG[Vx];
+	uint8_t Vx = ins.x;
+	uint8_t key = REG[Vx] % KEY_COUNT;
 	if (!keypadMemory[key])
 	{
 		R_PC += 2;
 	}
 }
 
-void Chip8::OP_Fx0A()
+void Chip8::OP_Fx0A(const Instruction &ins)
 {
 	// LD Vx, K
 	// Wait for a key press, store the value of the key in Vx
 	// Block until a key is pressed, store the value of the key in Vx
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = ins.x;
 
 	bool keyFound = false;
 	for (uint8_t k = 0; k < 16; k++)
@@ -572,57 +1745,65 @@ void Chip8::OP_Fx0A()
 // @@@ Ex — TIMER
 // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
 
-void Chip8::OP_Fx07()
+void Chip8::OP_Fn01(const Instruction &ins)
+{
+	// PLANE n (XO-CHIP)
+	// Select the planes 00E0, 00Cn-00FC and Dxyn work on, bit p = plane p
+	planeMask = ins.x & ((1u << VIDEO_PLANES) - 1);
+}
+
+void Chip8::OP_Fx07(const Instruction &ins)
 {
 	// LD Vx, DT
 	// Set Vx = delay timer value
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = ins.x;
 	REG[Vx] = R_DELAY_TIMER;
 }
 
-void Chip8::OP_Fx15()
+void Chip8::OP_Fx15(const Instruction &ins)
 {
 	// LD DT, Vx
 	// delay timer = VX
 	// Set delay timer = Vx
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = ins.x;
 	R_DELAY_TIMER = REG[Vx];
 }
 
-void Chip8::OP_Fx18()
+void Chip8::OP_Fx18(const Instruction &ins)
 {
 	// LD ST, Vx
 	// sound timer = VX
 	// Set sound timer = Vx
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = ins.x;
 	R_BUZZER_TIMER = REG[Vx];
+	buzzerSet(R_BUZZER_TIMER, runLeft);
 }
 
-void Chip8::OP_Fx1E()
+void Chip8::OP_Fx1E(const Instruction &ins)
 {
 	// ADD I, Vx
 	// Set I = I + Vx
 	// Add the value of register Vx to register I
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = ins.x;
 	R_I += REG[Vx];
 }
 
-void Chip8::OP_Fx29()
+void Chip8::OP_Fx29(const Instruction &ins)
 {
 	// LD F, Vx
 	// Set I = location of FONT_SPRITE for digit Vx
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = ins.x;
 	uint8_t digit = REG[Vx];
 	R_I = FONTSET_START_ADDRESS + (BYTES_PER_CHAR * digit);
 }
 
-void Chip8::OP_Fx33()
+void Chip8::OP_Fx33(const Instruction &ins)
 {
 	// LD BCD, Vx
 	// Store BCD representation of Vx in memory locations I, I+1, and I+2
 	// This converts the value in Vx (0–255) into three decimal digits
 	// So the value is stored as decimal digits, not ASCII, not binary.
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = ins.x;
 	uint8_t value = REG[Vx];
 
 	// If Vx = 254 and I = 300
@@ -630,28 +1811,74 @@ void Chip8::OP_Fx33()
 	// memory[301] = 5 (5 x 10)
 	// memory[302] = 4 (4 x 1)
 
-	memory[R_I + 0] = value / 100;
-	memory[R_I + 1] = (value / 10) % 10;
-	memory[R_I + 2] = value % 10;
+	writeMemory(R_I + 0, value / 100);
+	writeMemory(R_I + 1, (value / 10) % 10);
+	writeMemory(R_I + 2, value % 10);
 }
 
-void Chip8::OP_Fx55()
+template <typename Quirks>
+void Chip8::OP_Fx55(const Instruction &ins)
 {
 	// Store REG V0 through Vx into memory starting at I
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	// COSMAC and XO-CHIP leave I after the last byte
+	uint8_t Vx = ins.x;
 	for (uint8_t w = 0; w <= Vx; ++w)
 	{
-		memory[R_I + w] = REG[w];
+		writeMemory(R_I + w, REG[w]);
+	}
+	if constexpr (Quirks::LOAD_STORE_INCREMENTS_I)
+	{
+		R_I += Vx + 1;
 	}
 }
 
-void Chip8::OP_Fx65()
+template <typename Quirks>
+void Chip8::OP_Fx65(const Instruction &ins)
 {
 	// 0xF265, 0xF365, ...
 	// Load REG V0 through Vx from memory starting at I
-	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
+	uint8_t Vx = ins.x;
+	for (uint8_t w = 0; w <= Vx; ++w)
+	{
+		REG[w] = memory[(R_I + w) % MEMORY_SIZE];
+	}
+	if constexpr (Quirks::LOAD_STORE_INCREMENTS_I)
+	{
+		R_I += Vx + 1;
+	}
+}
+
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+// @@@ Fx30, Fx75, Fx85 — SCHIP font and flags
+// @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+
+void Chip8::OP_Fx30(const Instruction &ins)
+{
+	// LD HF, Vx
+	// Set I = location of the 8x10 BIG_FONTSET sprite for digit Vx
+	uint8_t Vx = ins.x;
+	uint8_t digit = REG[Vx];
+	R_I = BIG_FONTSET_START_ADDRESS + (BYTES_PER_BIG_CHAR * digit);
+}
+
+void Chip8::OP_Fx75(const Instruction &ins)
+{
+	// LD R, Vx
+	// Store V0 through Vx in the RPL user flags
+	uint8_t Vx = ins.x;
+	for (uint8_t w = 0; w <= Vx; ++w)
+	{
+		rplFlags[w] = REG[w];
+	}
+}
+
+void Chip8::OP_Fx85(const Instruction &ins)
+{
+	// LD Vx, R
+	// Load V0 through Vx from the RPL user flags
+	uint8_t Vx = ins.x;
 	for (uint8_t w = 0; w <= Vx; ++w)
 	{
-		REG[w] = memory[R_I + w];
+		REG[w] = rplFlags[w];
 	}
 }
@@ -2,12 +2,27 @@
 
 #include <iostream>
 #include <fstream>
-#include <random>
 #include <cassert>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <string>
 
-// Video
+// Video, CHIP-8 (lo-res) and SCHIP/XO-CHIP hi-res display
 const unsigned int VIDEO_HEIGHT = 32;
 const unsigned int VIDEO_WIDTH = 64;
+const unsigned int HIRES_HEIGHT = 64;
+const unsigned int HIRES_WIDTH = 128;
+// XO-CHIP bitplanes, plane 0 is the only one CHIP-8 and SCHIP draw to
+const unsigned int VIDEO_PLANES = 2;
+// 64-bit words of one plane, enough for the hi-res display
+const unsigned int VIDEO_WORDS = HIRES_WIDTH * HIRES_HEIGHT / 64;
+// RGBA colors used when expanding the display
+const uint32_t PIXEL_ON = 0xFFFFFFFF;
+const uint32_t PIXEL_OFF = 0x00000000;
+// Color of each plane combination, bit p = plane p lit
+const uint32_t PLANE_COLORS[1u << VIDEO_PLANES] = {PIXEL_OFF, PIXEL_ON, 0xAAAAAAFF, 0x555555FF};
 // Keypad
 const unsigned int KEY_COUNT = 16;
 // Memory
@@ -18,10 +33,26 @@ const unsigned int REGISTER_COUNT = 16;
 const unsigned int STACK_LEVELS = 16;
 // ROM
 const unsigned int ROM_START_ADDRESS = 0x200;
+// Timers, delay and sound timers count down at 60 Hz
+const unsigned int TIMER_FREQUENCY = 60;
+// Instructions per second, 10 per timer tick
+const unsigned int DEFAULT_CPU_FREQUENCY = 600;
 // FONT
 const unsigned int BYTES_PER_CHAR = 5;
 const unsigned int FONTSET_SIZE = 16 * BYTES_PER_CHAR;
 const unsigned int FONTSET_START_ADDRESS = 0x50;
+// SCHIP large font (Fx30), 8x10 digits, XO-CHIP adds A-F
+const unsigned int BYTES_PER_BIG_CHAR = 10;
+const unsigned int BIG_FONTSET_SIZE = 16 * BYTES_PER_BIG_CHAR;
+const unsigned int BIG_FONTSET_START_ADDRESS = FONTSET_START_ADDRESS + FONTSET_SIZE;
+// SCHIP RPL user flags (Fx75/Fx85), XO-CHIP has 16
+const unsigned int RPL_FLAG_COUNT = 16;
+// Longest idle loop looked for, in instructions
+const unsigned int MAX_IDLE_LOOP = 8;
+// Instructions run between idle loop checks while the program is busy,
+// doubling after each failed check up to the maximum
+const unsigned int IDLE_CHECK_INTERVAL = 64;
+const unsigned int MAX_IDLE_CHECK_INTERVAL = 4096;
 
 // clang-format off
 const uint8_t FONTSET[FONTSET_SIZE] =
@@ -123,85 +154,467 @@ const uint8_t FONTSET[FONTSET_SIZE] =
 	0b1000'0000,
 	0b1000'0000
 };
+
+const uint8_t BIG_FONTSET[BIG_FONTSET_SIZE] =
+{
+	0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+	0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+	0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+	0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+	0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+	0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+	0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+	0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
 // clang-format on
 
-class Chip8
+class Chip8Jit;
+class Chip8Aot;
+class Chip8Lockstep;
+class Chip8Profile;
+class Chip8Trace;
+
+inline uint64_t rotateRight(uint64_t value, unsigned int shift)
 {
-public:
+	return (value >> (shift & 63u)) | (value << ((64u - shift) & 63u));
+}
+
+// FNV-1a, used to compare framebuffers and identify ROMs. Pass the hash
+// of the previous bytes to continue it over several buffers
+inline uint64_t hashBytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	auto bytes = static_cast<const uint8_t *>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Execution engines, selectable at runtime
+enum class Engine
+{
+	// routerTable interpreter, one step per instruction
+	Interpreter,
+	// x86-64 basic block recompiler (see Chip8Jit)
+	Jit,
+	// Computed goto interpreter (see Chip8Threaded.cpp)
+	Threaded,
+	// ROM recompiled ahead of time to C++ (see Chip8Aot)
+	Aot,
+};
+
+// "interpreter", "jit", "threaded", "aot"
+const char *engineName(Engine engine);
+// Returns false if name is not an engine
+bool engineFromName(const std::string &name, Engine &engine);
+
+// CHIP-8 variants, they disagree on a few opcodes (see Chip8Quirks.h)
+enum class QuirkProfile
+{
+	// This emulator's own behaviour: shifts and Bnnn use Vx/V0, Fx55/Fx65
+	// keep I, sprites wrap, 8xy1/8xy2/8xy3 keep VF
+	Default,
+	// COSMAC VIP
+	Chip8,
+	// SUPER-CHIP 1.1
+	Schip,
+	XoChip,
+};
+
+// "default", "chip8", "schip", "xochip"
+const char *quirkProfileName(QuirkProfile profile);
+// Returns false if name is not a profile
+bool quirkProfileFromName(const std::string &name, QuirkProfile &profile);
+// Profile for a ROM by its file extension: .sc8 SCHIP, .xo8 XO-CHIP,
+// anything else Default
+QuirkProfile quirkProfileForRom(const std::string &path);
+
+// Read-only bytes of a ROM image owned elsewhere (a file buffer, a
+// mapped RomCorpus), C++17 has no std::span. hash is hashBytes of the
+// bytes, taken once by whoever made the view
+struct RomView
+{
+	const uint8_t *data{};
+	size_t size{};
+	uint64_t hash{};
+};
+
+// The buzzer switching on or off, cycle counts from power on
+struct BuzzerEvent
+{
+	uint64_t cycle;
+	bool on;
+};
+
+// Everything that defines a running machine, in one trivially copyable
+// block, so a save state is a single memcpy (see Chip8::saveState).
+// Caches, the engine and the dirty rows are rebuilt from it on restore
+struct Chip8State
+{
+	uint8_t memory[MEMORY_SIZE]{};
+	// 1 bit per pixel per plane, rows of 64-bit words, MSB = x 0.
+	// A lo-res row is one word, a hi-res row two, so row y of the
+	// current mode starts at word y * getRowWords()
+	uint64_t videoMemory[VIDEO_PLANES][VIDEO_WORDS]{};
+	uint16_t stackMemory[STACK_LEVELS]{};
+	// V0-VF, V0 = register[0]
+	uint8_t REG[REGISTER_COUNT]{};
 	uint8_t keypadMemory[KEY_COUNT]{};
-	uint32_t videoMemory[VIDEO_WIDTH * VIDEO_HEIGHT]{};
+	// Index register
+	uint16_t R_I{};
+	// Program counter register
+	uint16_t R_PC{};
+	// Stack pointer register
+	uint8_t R_SP{};
+	// Timer/sound registers
+	uint8_t R_DELAY_TIMER{};
 	uint8_t R_BUZZER_TIMER{};
+	// 00FF/00FE, SCHIP 128x64 mode
+	bool hires{};
+	// Fn01, planes drawn, scrolled and cleared, bit p = plane p
+	uint8_t planeMask = 1;
+	// Fx75/Fx85
+	uint8_t rplFlags[RPL_FLAG_COUNT]{};
+
+	// Timer scheduler
+	unsigned int cpuFrequency = DEFAULT_CPU_FREQUENCY;
+	unsigned int cyclesUntilTimer{};
+	uint64_t cycleCount{};
+	// Cycle and timer tick count at the last frequency change
+	uint64_t timerBaseCycle{};
+	uint64_t timerTicks{};
+	uint64_t frameCount{};
+
+	// Cxkk generator (PCG32), see Chip8::setSeed
+	uint64_t rngState{};
+};
+
+class Chip8 : private Chip8State
+{
+	friend class Chip8Jit;
+	friend class Chip8Aot;
+	friend class Chip8Lockstep;
+
+public:
+	using Chip8State::keypadMemory;
+	using Chip8State::videoMemory;
+	using Chip8State::R_BUZZER_TIMER;
 	Chip8();
+	~Chip8();
 	void loadROM(char const *filename);
+	// Copy a ROM image to ROM_START_ADDRESS with one memcpy,
+	// returns false (loading nothing) if it does not fit
+	bool loadROM(const uint8_t *data, size_t size);
+	// Same, without hashing the image again
+	bool loadROM(RomView rom);
+	// hashBytes of the last loaded ROM image
+	uint64_t getRomHash() const;
+	// Execute one instruction, timers tick when their event is due
 	void tick();
+	// Execute cycles instructions with the selected engine,
+	// same result as calling tick() cycles times
+	void run(unsigned int cycles);
+	// Run up to and including the next 60 Hz timer event,
+	// returns the number of instructions executed
+	unsigned int runUntilNextTimerEvent();
+	// One 60 Hz frame of emulated time
+	void runFrame();
+	// Restart the Cxkk generator, the same ROM, seed and inputs give
+	// the same run. Chip8 starts with seed 0
+	void setSeed(uint64_t seed);
+	// Emulated instructions per second, timers stay at 60 Hz
+	void setCpuFrequency(unsigned int hz);
+	unsigned int getCpuFrequency() const;
+	// Record buzzer edges for takeBuzzerEvents (off by default), at the
+	// cycle after the Fx18 that switches the buzzer or at the timer tick
+	// that runs it out. Lockstep lanes record none
+	void setBuzzerEvents(bool enabled);
+	// Append the edges recorded since the last call, oldest first
+	void takeBuzzerEvents(std::vector<BuzzerEvent> &events);
+	// True if the machine is in an idle loop: a few instructions that only
+	// read registers, the delay timer and the keypad and, from their second
+	// pass on, end where they started, like Fx0A waiting for a key or
+	// Fx07/3xkk/1nnn polling the delay timer (whose first pass after a tick
+	// loads the new timer value). Until the next timer event or keypad
+	// change it does nothing else
+	bool isIdle() const;
+	// Skip the passes of idle loops up to the next timer event instead of
+	// running them (the default), the results are the same either way
+	void setIdleSkip(bool enabled);
+	// Instructions skipped as idle loop passes since power on, they count
+	// as executed in getCycleCount
+	uint64_t getIdleCycleCount() const;
+	// Instructions executed since power on
+	uint64_t getCycleCount() const;
+	// 60 Hz timer events since power on
+	uint64_t getFrameCount() const;
+	unsigned int getCyclesUntilTimer() const;
+	uint8_t getRegister(uint8_t index) const;
+	uint16_t getIndexRegister() const;
+	uint16_t getProgramCounter() const;
+	// Keypad as a mask, bit k = key k
+	void setKeys(uint16_t keys);
+	uint16_t getKeys() const;
+	// Decode every instruction tick() and the interpreter run from memory
+	// instead of from decodeCache (slower, the reference of chip8-verify).
+	// On by default
+	void setDecodeCache(bool enabled);
+	// Returns false (and keeps the current engine) if unavailable, as is
+	// every engine but the interpreter in CHIP8_PROFILE/CHIP8_TRACE builds
+	bool setEngine(Engine engine);
+	Engine getEngine() const;
+	// Switch every engine to the handlers built for profile,
+	// dropping decoded and translated code. Default at power on
+	void setQuirkProfile(QuirkProfile profile);
+	QuirkProfile getQuirkProfile() const;
+	// Display mode, lo-res (64x32) at power on
+	bool isHires() const;
+	unsigned int getVideoWidth() const;
+	unsigned int getVideoHeight() const;
+	// 64-bit words per display row in videoMemory
+	unsigned int getRowWords() const;
+	// Pixel of the current mode lit in any plane
+	bool getPixel(unsigned int x, unsigned int y) const;
+	// Write the display as RGBA (PLANE_COLORS) at HIRES_WIDTH x HIRES_HEIGHT,
+	// lo-res pixels doubled, stride in pixels
+	void expandVideo(uint32_t *pixels, unsigned int stride) const;
+	// Same for rowCount display rows starting at firstRow, pixels points at firstRow
+	void expandVideoRows(uint32_t *pixels, unsigned int stride, unsigned int firstRow, unsigned int rowCount) const;
+	// Same for planes copied out of videoMemory
+	static void expandRows(const uint64_t (*planes)[VIDEO_WORDS], bool hires, unsigned int firstRow, unsigned int rowCount, uint32_t *pixels, unsigned int stride);
+	// Display rows of the current mode changed since the last call,
+	// bit y = row y. A mode switch marks every row
+	uint64_t takeDirtyRows();
+	// FNV-1a hash of the video memory, used to compare runs
+	uint64_t videoHash() const;
+	// FNV-1a hash of every Chip8State field (not the padding), equal
+	// for machines that behave the same from here on
+	uint64_t stateHash() const;
+	// Copy the whole machine state, restoring it continues the run
+	// exactly where it was saved
+	void saveState(Chip8State &state) const;
+	void loadState(const Chip8State &state);
+	// Save state file, returns false on I/O errors or a file written
+	// by a build with another Chip8State layout
+	bool saveState(char const *filepath) const;
+	bool loadState(char const *filepath);
+	// Execution counts since power on, nullptr unless built with
+	// CHIP8_PROFILE (see Chip8Profile)
+	const Chip8Profile *getProfile() const;
+	// Ring of the last executed instructions, nullptr unless built with
+	// CHIP8_TRACE (see Chip8Trace)
+	Chip8Trace *getTrace();
 
 private:
+	// Decoded instruction: resolved handler and operands
+	// extracted once, cached per address in decodeCache
+	struct Instruction;
+	using OpFunc = void (Chip8::*)(const Instruction &);
+	struct Instruction
+	{
+		OpFunc handler{};
+		uint16_t opcode{};
+		uint16_t nnn{};
+		uint8_t x{};
+		uint8_t y{};
+		uint8_t kk{};
+		uint8_t n{};
+	};
+
+	// Next byte of the per instance generator in rngState
 	uint8_t getRandomByte();
-	void DO_NOTHING();
-
-	// Opcode implementations, 34 total
-	void OP_00E0();
-	void OP_00EE();
-	void OP_1nnn();
-	void OP_2nnn();
-	void OP_3xkk();
-	void OP_4xkk();
-	void OP_5xy0();
-	void OP_6xkk();
-	void OP_7xkk();
-	void OP_8xy0();
-	void OP_8xy1();
-	void OP_8xy2();
-	void OP_8xy3();
-	void OP_8xy4();
-	void OP_8xy5();
-	void OP_8xy6();
-	void OP_8xy7();
-	void OP_8xyE();
-	void OP_9xy0();
-	void OP_Annn();
-	void OP_Bnnn();
-	void OP_Cxkk();
-	void OP_Dxyn();
-	void OP_Ex9E();
-	void OP_ExA1();
-	void OP_Fx07();
-	void OP_Fx0A();
-	void OP_Fx15();
-	void OP_Fx18();
-	void OP_Fx1E();
-	void OP_Fx29();
-	void OP_Fx33();
-	void OP_Fx55();
-	void OP_Fx65();
-
-	// Functions to handle nested routing
-	void SubHandlerFn0();
-	void SubHandlerFn8();
-	void SubHandlerFnE();
-	void SubHandlerFnF();
+	// Fetch, decode, execute one instruction, no timers
+	void step();
+#ifdef CHIP8_TRACE
+	// step() and record the instruction as run at cycle
+	void traceStep(uint64_t cycle);
+#endif
+	void decode(uint16_t address);
+	// Fill routerTable and the sub-tables with the handlers of a quirk policy
+	template <typename Quirks>
+	void buildTables();
+	// Run cycles instructions with the selected engine, no timers,
+	// skipping idle loop passes
+	void execute(unsigned int cycles);
+	void runEngine(unsigned int cycles);
+	// Count the whole idle loop passes in the next cycles instructions as
+	// executed, returns the cycles still to run (all of them if PC is not
+	// in an idle loop or no check is due)
+	unsigned int skipIdleLoop(unsigned int cycles);
+	// An idle loop at PC: the first pass may change V0-VF and I, every
+	// pass after it ends with the registers it started with
+	struct IdleLoop
+	{
+		unsigned int firstLength;
+		unsigned int length;
+		// V0-VF and I after the first pass
+		uint8_t V[REGISTER_COUNT];
+		uint16_t i;
+	};
+	// Returns false if PC is not in an idle loop
+	bool findIdleLoop(IdleLoop &loop) const;
+	// Simulate instructions from PC on V and i until PC comes back,
+	// returns their count, 0 if an instruction writes anything but V0-VF,
+	// I and PC or PC is not back within MAX_IDLE_LOOP instructions
+	unsigned int simulateIdlePass(uint8_t *V, uint16_t &i) const;
+	// True if some path of the opcodes simulateIdlePass accepts, taking
+	// skips and Fx0A both ways, leads from address back to start within
+	// MAX_IDLE_LOOP - depth instructions
+	bool canReturn(uint16_t start, uint16_t address, unsigned int depth) const;
+	void runThreaded(unsigned int cycles);
+	template <typename Quirks>
+	void runThreadedWith(unsigned int cycles);
+	// execute and advanceClock, cycles must not pass the next timer event
+	void runSlice(unsigned int cycles);
+	// Fx18 set the sound timer to value with left instructions of the
+	// engine's run still to go after it: record the edge if it switches
+	// the buzzer
+	void buzzerSet(uint8_t value, unsigned int left);
+	// Count executed cycles and fire the timers when due
+	void advanceClock(unsigned int cycles);
+	void scheduleTimer();
+	// Store a byte, wrapping at MEMORY_SIZE, and invalidate code reading it
+	void writeMemory(unsigned int address, uint8_t value);
+	// Drop cached decodes and translations that read any byte in [address, address + length)
+	void invalidateCode(uint16_t address, uint16_t length);
+	// 00E0, clears the selected planes, marks the rows that were lit as dirty
+	void clearVideo();
+	// 00Cn/00Dn, move the selected planes rows down/up, whole rows at once
+	void scrollDown(unsigned int rows);
+	void scrollUp(unsigned int rows);
+	// 00FB/00FC, move the selected planes 4 pixels right/left, a word at a time
+	void scrollRight();
+	void scrollLeft();
+	// 00FE/00FF, switch mode and clear every plane
+	void setHires(bool enabled);
+	// Dxyn body: XOR a sprite from address into the selected planes at
+	// (x, y) wrapped to the display, n rows of 8 pixels. n = 0 draws 16
+	// rows of 16 in hi-res, and in lo-res with Quirks::LORES_BIG_SPRITES,
+	// otherwise nothing. Each plane takes the next sprite, returns true on
+	// collision. Quirks::CLIP_SPRITES drops the pixels past the right and
+	// bottom edges instead
+	template <typename Quirks>
+	bool drawSprite(uint8_t x, uint8_t y, uint16_t address, uint8_t n);
+	void DO_NOTHING(const Instruction &);
+
+	// Opcode implementations, 34 CHIP-8 and 11 SCHIP/XO-CHIP.
+	// The templates are instantiated per quirk policy (see buildTables)
+	void OP_00Cn(const Instruction &ins);
+	void OP_00Dn(const Instruction &ins);
+	void OP_00E0(const Instruction &ins);
+	void OP_00EE(const Instruction &ins);
+	void OP_00FB(const Instruction &ins);
+	void OP_00FC(const Instruction &ins);
+	void OP_00FD(const Instruction &ins);
+	void OP_00FE(const Instruction &ins);
+	void OP_00FF(const Instruction &ins);
+	void OP_1nnn(const Instruction &ins);
+	void OP_2nnn(const Instruction &ins);
+	void OP_3xkk(const Instruction &ins);
+	void OP_4xkk(const Instruction &ins);
+	void OP_5xy0(const Instruction &ins);
+	void OP_6xkk(const Instruction &ins);
+	void OP_7xkk(const Instruction &ins);
+	void OP_8xy0(const Instruction &ins);
+	template <typename Quirks>
+	void OP_8xy1(const Instruction &ins);
+	template <typename Quirks>
+	void OP_8xy2(const Instruction &ins);
+	template <typename Quirks>
+	void OP_8xy3(const Instruction &ins);
+	void OP_8xy4(const Instruction &ins);
+	void OP_8xy5(const Instruction &ins);
+	template <typename Quirks>
+	void OP_8xy6(const Instruction &ins);
+	void OP_8xy7(const Instruction &ins);
+	template <typename Quirks>
+	void OP_8xyE(const Instruction &ins);
+	void OP_9xy0(const Instruction &ins);
+	void OP_Annn(const Instruction &ins);
+	template <typename Quirks>
+	void OP_Bnnn(const Instruction &ins);
+	void OP_Cxkk(const Instruction &ins);
+	template <typename Quirks>
+	void OP_Dxyn(const Instruction &ins);
+	void OP_Ex9E(const Instruction &ins);
+	void OP_ExA1(const Instruction &ins);
+	void OP_Fn01(const Instruction &ins);
+	void OP_Fx07(const Instruction &ins);
+	void OP_Fx0A(const Instruction &ins);
+	void OP_Fx15(const Instruction &ins);
+	void OP_Fx18(const Instruction &ins);
+	void OP_Fx1E(const Instruction &ins);
+	void OP_Fx29(const Instruction &ins);
+	void OP_Fx33(const Instruction &ins);
+	template <typename Quirks>
+	void OP_Fx55(const Instruction &ins);
+	template <typename Quirks>
+	void OP_Fx65(const Instruction &ins);
+	void OP_Fx30(const Instruction &ins);
+	void OP_Fx75(const Instruction &ins);
+	void OP_Fx85(const Instruction &ins);
 
 	// Table to hold member function pointers
-	using OpFunc = void (Chip8::*)();
 	OpFunc routerTable[16]; // 0-15 or 0-xF
-	OpFunc subTable0[16];	// 0-15 or 0-xF
+	OpFunc subTable0[256];	// 0-255 or 1 byte
 	OpFunc subTable8[16];	// 0-15 or 0-xF
 	OpFunc subTableE[16];	// 0-15 or 0-xF
 	OpFunc subTableF[256];	// 0-255 or 1 byte
 
-	// Current opcode
-	uint16_t opcode{};
+	// Decoded instructions indexed by address
+	// handler == nullptr means not decoded yet
+	Instruction decodeCache[MEMORY_SIZE]{};
+	// Whether an idle loop can start at an address whatever the registers
+	// (canReturn), worked out once and forgotten when any code changes
+	enum class IdleCode : uint8_t
+	{
+		Unknown,
+		Loop,
+		Busy
+	};
+	IdleCode idleCode[MEMORY_SIZE]{};
+	bool idleCodeKnown = false;
 
-	uint8_t memory[MEMORY_SIZE]{};
-	uint16_t stackMemory[STACK_LEVELS]{};
-	// V0-VF, V0 = register[0]
-	uint8_t REG[REGISTER_COUNT]{};
-	// Index register
-	uint16_t R_I{};
-	// Stack pointer register
-	uint8_t R_SP{};
-	// Program counter register
-	uint16_t R_PC{};
-	// Timer/sound registers
-	uint8_t R_DELAY_TIMER{};
+	bool decodeCaching = true;
+	Engine engine = Engine::Interpreter;
+	std::unique_ptr<Chip8Jit> jit;
+	std::unique_ptr<Chip8Aot> aot;
+	QuirkProfile quirkProfile = QuirkProfile::Default;
+
+	// Display rows changed since takeDirtyRows(), all dirty at startup
+	uint64_t dirtyRows = ~0ull;
+
+	uint64_t romHash{};
+
+#ifdef CHIP8_PROFILE
+	std::unique_ptr<Chip8Profile> profile;
+#endif
+#ifdef CHIP8_TRACE
+	std::unique_ptr<Chip8Trace> trace;
+#endif
+
+	bool idleSkip = true;
+	unsigned int idleCheckInterval = IDLE_CHECK_INTERVAL;
+	// Instructions to run before the next check
+	unsigned int idleCheckDelay{};
+	uint64_t idleCycles{};
+
+	bool buzzerEventsEnabled{};
+	bool buzzerOn{};
+	std::vector<BuzzerEvent> buzzerEvents;
+	// cycleCount after the last instruction of the engine's current run,
+	// and the instructions after the current one the interpreter loop
+	// still has to step (buzzerSet times edges from them)
+	uint64_t runEndCycle{};
+	unsigned int runLeft{};
 };
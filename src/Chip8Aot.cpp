@@ -0,0 +1,135 @@
+#include "Chip8Aot.h"
+
+namespace
+{
+	// Function local so programs can register from any static initializer
+	std::vector<const AotProgram *> &programs()
+	{
+		static std::vector<const AotProgram *> registered;
+		return registered;
+	}
+}
+
+Chip8Aot::Chip8Aot(Chip8 &chip8)
+	: chip8(chip8)
+{
+}
+
+bool Chip8Aot::registerProgram(const AotProgram &program)
+{
+	programs().push_back(&program);
+	return true;
+}
+
+bool Chip8Aot::hasProgram(uint64_t romHash)
+{
+	return std::any_of(programs().begin(), programs().end(), [romHash](const AotProgram *program)
+					   { return program->romHash == romHash; });
+}
+
+void Chip8Aot::attach()
+{
+	attached = true;
+	attachedHash = chip8.romHash;
+	attachedProfile = chip8.quirkProfile;
+	program = nullptr;
+	for (const AotProgram *candidate : programs())
+	{
+		if (candidate->romHash == attachedHash && candidate->quirkProfile == attachedProfile)
+		{
+			program = candidate;
+		}
+	}
+	std::fill(std::begin(entries), std::end(entries), Entry{});
+	maxBlockBytes = 0;
+	if (!program)
+	{
+		return;
+	}
+	for (size_t b = 0; b < program->blockCount; ++b)
+	{
+		maxBlockBytes = std::max(maxBlockBytes, program->blocks[b].length * 2u);
+		check(program->blocks[b]);
+	}
+}
+
+void Chip8Aot::check(const AotBlock &block)
+{
+	unsigned int bytes = block.length * 2u;
+	bool match = block.address >= ROM_START_ADDRESS && block.address - ROM_START_ADDRESS + bytes <= program->romSize &&
+				 std::memcmp(chip8.memory + block.address, program->rom + (block.address - ROM_START_ADDRESS), bytes) == 0;
+	for (uint16_t i = 0; i < block.length; ++i)
+	{
+		Entry &entry = entries[block.address + i * 2u];
+		// Another block may own this address, only touch our own entries
+		if (match && !entry.code)
+		{
+			entry = {block.code, i, static_cast<uint16_t>(block.length - i)};
+		}
+		else if (!match && entry.code == block.code && entry.index == i)
+		{
+			entry = {};
+		}
+	}
+}
+
+void Chip8Aot::invalidate(uint16_t address, uint16_t length)
+{
+	if (!program)
+	{
+		return;
+	}
+	// A block starting at start covers the bytes [start, start + 2 * length)
+	unsigned int last = std::min<unsigned int>(address + length, MEMORY_SIZE);
+	unsigned int first = address > maxBlockBytes ? address - maxBlockBytes : 0;
+	const AotBlock *begin = program->blocks;
+	const AotBlock *end = program->blocks + program->blockCount;
+	const AotBlock *block = std::lower_bound(begin, end, first, [](const AotBlock &b, unsigned int a)
+											 { return b.address < a; });
+	for (; block != end && block->address < last; ++block)
+	{
+		if (block->address + block->length * 2u > address)
+		{
+			check(*block);
+		}
+	}
+}
+
+void Chip8Aot::run(unsigned int cycles)
+{
+	if (!attached || chip8.romHash != attachedHash || chip8.quirkProfile != attachedProfile)
+	{
+		attach();
+	}
+	Chip8State &state = chip8;
+	while (cycles > 0)
+	{
+		const uint16_t address = chip8.R_PC;
+		const Entry *entry = address < MEMORY_SIZE ? &entries[address] : nullptr;
+		if (entry && entry->code)
+		{
+			// Stop the block early rather than overrun the budget, so the
+			// number of executed instructions stays exact
+			unsigned int count = std::min<unsigned int>(cycles, entry->remaining);
+			cycles -= count;
+			leftAfterBlock = cycles;
+			entry->code(chip8, state, entry->index, count);
+		}
+		else
+		{
+			chip8.runLeft = --cycles;
+			chip8.step();
+		}
+	}
+}
+
+void Chip8Aot::buzzerSet(Chip8 &chip8, unsigned int count)
+{
+	chip8.buzzerSet(chip8.R_BUZZER_TIMER, chip8.aot->leftAfterBlock + count - 1);
+}
+
+void Chip8Aot::stepAt(Chip8 &chip8, uint16_t address)
+{
+	chip8.R_PC = address;
+	chip8.step();
+}
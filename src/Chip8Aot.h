@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "Chip8.h"
+
+// Runs ROMs recompiled ahead of time to C++ by chip8-recompile (see
+// recompile.cpp, make aot). The generated translation unit holds one
+// function per basic block of the code reachable from ROM_START_ADDRESS
+// and registers itself with registerProgram() before main.
+// A block function runs count instructions of its block starting with
+// instruction entry, directly on the Chip8State registers; opcodes it does
+// not translate call stepAt(). PCs that no block covers (Bnnn targets,
+// code the static walk did not reach) run on the interpreter, and so do
+// blocks whose bytes no longer match the ROM (self-modifying code) until
+// they match again. Results are bit-identical to the interpreter.
+using AotBlockFn = void (*)(Chip8 &chip8, Chip8State &s, unsigned int entry, unsigned int count);
+
+struct AotBlock
+{
+	AotBlockFn code;
+	uint16_t address;
+	// Instructions, 2 bytes each from address on
+	uint16_t length;
+};
+
+struct AotProgram
+{
+	// Chip8::loadROM's hash of the ROM bytes
+	uint64_t romHash;
+	// The profile the blocks were translated for
+	QuirkProfile quirkProfile;
+	const uint8_t *rom;
+	size_t romSize;
+	// Sorted by address
+	const AotBlock *blocks;
+	size_t blockCount;
+};
+
+class Chip8Aot
+{
+public:
+	explicit Chip8Aot(Chip8 &chip8);
+
+	// Make program available to every Chip8, called by the generated code
+	static bool registerProgram(const AotProgram &program);
+	// True if a program for the ROM with this hash is linked in
+	static bool hasProgram(uint64_t romHash);
+
+	// Execute exactly cycles instructions, timers are run by Chip8
+	void run(unsigned int cycles);
+	// Recheck the blocks that read any byte in [address, address + length)
+	void invalidate(uint16_t address, uint16_t length);
+
+	// Execute the instruction at address on the interpreter
+	static void stepAt(Chip8 &chip8, uint16_t address);
+	// After an Fx18 with count instructions of the block call left,
+	// counting the Fx18
+	static void buzzerSet(Chip8 &chip8, unsigned int count);
+
+private:
+	// Where a PC enters a block
+	struct Entry
+	{
+		AotBlockFn code{};
+		uint16_t index{};
+		// Instructions from here to the end of the block
+		uint16_t remaining{};
+	};
+
+	// Pick the program of the loaded ROM and quirk profile
+	void attach();
+	// Enable the entries of block if its bytes match the ROM
+	void check(const AotBlock &block);
+
+	Chip8 &chip8;
+	const AotProgram *program{};
+	uint64_t attachedHash{};
+	QuirkProfile attachedProfile{};
+	bool attached{};
+	// Bytes of the longest block, bounds the blocks a write can touch
+	unsigned int maxBlockBytes{};
+	// Cycles of the run left after the current block call
+	unsigned int leftAfterBlock{};
+	Entry entries[MEMORY_SIZE]{};
+};
@@ -0,0 +1,576 @@
+#include "Chip8Jit.h"
+#include "Chip8Quirks.h"
+
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(_WIN32)
+#define CHIP8_JIT_X64 1
+#include <sys/mman.h>
+#else
+#define CHIP8_JIT_X64 0
+#endif
+
+// x86-64 register numbers used by the emitters
+// rbx holds the Chip8 pointer for the whole block
+const uint8_t EAX = 0;
+const uint8_t ECX = 1;
+const uint8_t EDX = 2;
+// Jcc rel32 second bytes
+const uint8_t JE = 0x84;
+const uint8_t JNE = 0x85;
+// Bytes of the block prologue, chained jumps enter right after it
+const size_t PROLOGUE_SIZE = 13;
+
+bool Chip8Jit::isSupported()
+{
+	return CHIP8_JIT_X64;
+}
+
+Chip8Jit::Chip8Jit(Chip8 &chip8) : chip8(chip8)
+{
+	auto base = reinterpret_cast<uint8_t *>(&chip8);
+	offsetREG = static_cast<int32_t>(reinterpret_cast<uint8_t *>(chip8.REG) - base);
+	offsetI = static_cast<int32_t>(reinterpret_cast<uint8_t *>(&chip8.R_I) - base);
+	offsetPC = static_cast<int32_t>(reinterpret_cast<uint8_t *>(&chip8.R_PC) - base);
+	offsetDelayTimer = static_cast<int32_t>(&chip8.R_DELAY_TIMER - base);
+	offsetRunLeft = static_cast<int32_t>(reinterpret_cast<uint8_t *>(&chip8.runLeft) - base);
+
+#if CHIP8_JIT_X64
+	// Read/write while code is emitted or patched, read/execute otherwise
+	void *buffer = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffer == MAP_FAILED)
+	{
+		std::cerr << "JIT: failed to map code buffer, using interpreter\n";
+		buffer = nullptr;
+	}
+	codeBuffer = static_cast<uint8_t *>(buffer);
+	writable = true;
+#endif
+}
+
+Chip8Jit::~Chip8Jit()
+{
+#if CHIP8_JIT_X64
+	if (codeBuffer)
+	{
+		munmap(codeBuffer, CODE_BUFFER_SIZE);
+	}
+#endif
+}
+
+void Chip8Jit::run(unsigned int cycles)
+{
+	while (cycles > 0)
+	{
+		uint16_t address = chip8.R_PC;
+		Block *block = nullptr;
+		if (codeBuffer && address < MEMORY_SIZE - 1)
+		{
+			block = &blocks[address];
+			if (!block->code)
+			{
+				block = compile(address);
+			}
+		}
+
+		// Only enter a block that fits in the remaining budget,
+		// so the number of executed instructions stays exact
+		if (block && block->length <= cycles)
+		{
+			cycles = block->code(&chip8, cycles);
+		}
+		else
+		{
+			chip8.runLeft = --cycles;
+			chip8.step();
+		}
+	}
+}
+
+void Chip8Jit::invalidate(uint16_t address, uint16_t length)
+{
+	// A block starting at start covers the bytes [start, end)
+	unsigned int last = std::min<unsigned int>(address + length, MEMORY_SIZE);
+	uint64_t pages = 0;
+	for (unsigned int page = address / CODE_PAGE_SIZE; page <= (last - 1) / CODE_PAGE_SIZE; ++page)
+	{
+		pages |= 1ull << page;
+	}
+	if (!(codePages & pages))
+	{
+		return;
+	}
+
+	unsigned int first = address > MAX_BLOCK_LENGTH * 2 ? address - MAX_BLOCK_LENGTH * 2 : 0;
+	for (unsigned int start = first; start < last; ++start)
+	{
+		Block &block = blocks[start];
+		if (block.code && block.end > address)
+		{
+			block.code = nullptr;
+			block.body = nullptr;
+			// Chained exits go back to run(), which compiles the block again
+			if (!block.links.empty() && protect(true))
+			{
+				for (uint32_t link : block.links)
+				{
+					patchLink(link, nullptr);
+				}
+			}
+		}
+	}
+	protect(false);
+}
+
+void Chip8Jit::flush()
+{
+	for (Block &block : blocks)
+	{
+		block.code = nullptr;
+		block.body = nullptr;
+		block.links.clear();
+	}
+	codePages = 0;
+	codeUsed = 0;
+}
+
+bool Chip8Jit::protect(bool enable)
+{
+#if CHIP8_JIT_X64
+	if (codeBuffer && writable != enable)
+	{
+		if (mprotect(codeBuffer, CODE_BUFFER_SIZE, enable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) != 0)
+		{
+			std::cerr << "JIT: failed to change code buffer protection\n";
+			return false;
+		}
+		writable = enable;
+	}
+#endif
+	return true;
+}
+
+void Chip8Jit::patchLink(uint32_t offset, const uint8_t *target)
+{
+	// jmp rel32 at offset - 1, rel32 = 0 falls through to the return
+	int32_t rel = target ? static_cast<int32_t>(target - (codeBuffer + offset + 4)) : 0;
+	std::memcpy(codeBuffer + offset, &rel, sizeof(rel));
+}
+
+void Chip8Jit::stepAt(Chip8 *chip8, uint32_t address)
+{
+	chip8->R_PC = static_cast<uint16_t>(address);
+	chip8->step();
+}
+
+Chip8Jit::Block *Chip8Jit::compile(uint16_t address)
+{
+	// Translations use the quirks of the profile current when they are
+	// made, Chip8::setQuirkProfile drops them all
+	return withQuirks(chip8.quirkProfile, [&](auto quirks)
+					  { return compileWith<decltype(quirks)>(address); });
+}
+
+template <typename Quirks>
+Chip8Jit::Block *Chip8Jit::compileWith(uint16_t address)
+{
+	scratch.clear();
+	scratchExits.clear();
+
+	// Prologue: push rbx; push r12; sub rsp, 8 (keeps calls 16-byte
+	// aligned); mov rbx, rdi; mov r12d, esi. r12d holds the cycles left
+	emit({0x53, 0x41, 0x54, 0x48, 0x83, 0xEC, 0x08, 0x48, 0x89, 0xFB, 0x41, 0x89, 0xF4});
+	// Body, entered by chained jumps with PC == address: return unless
+	// the whole block fits in the cycles left, then take it off them.
+	// cmp r12d, length; jae over the return; sub r12d, length
+	emit({0x41, 0x81, 0xFC});
+	const size_t checkLength = scratch.size();
+	emit32(0);
+	emit({0x73, 0x0B});
+	emitReturn();
+	emit({0x41, 0x81, 0xEC});
+	const size_t takeLength = scratch.size();
+	emit32(0);
+
+	uint16_t pc = address;
+	uint16_t length = 0;
+	bool exited = false;
+	while (length < MAX_BLOCK_LENGTH && pc < MEMORY_SIZE - 1)
+	{
+		if (!chip8.decodeCache[pc].handler)
+		{
+			chip8.decode(pc);
+		}
+		const Chip8::Instruction &ins = chip8.decodeCache[pc];
+		++length;
+
+		if (emitNative<Quirks>(ins, pc))
+		{
+			pc += 2;
+			// Native jumps and skips end the block with their exits
+			const uint8_t nibble3 = ins.opcode >> 12u;
+			if (nibble3 == 0x1 || nibble3 == 0x3 || nibble3 == 0x4 || nibble3 == 0x5 || nibble3 == 0x9)
+			{
+				exited = true;
+				break;
+			}
+			continue;
+		}
+
+		// Everything else runs through the interpreter. Fx18 times the
+		// buzzer edge from the cycles left after it, which are r12d as it
+		// ends its block: mov dword [runLeft], r12d
+		const uint8_t nibble3 = ins.opcode >> 12u;
+		const bool setsBuzzer = nibble3 == 0xF && ins.kk == 0x18;
+		if (setsBuzzer)
+		{
+			emit({0x44});
+			emitModRM(0x89, 4, offsetRunLeft);
+		}
+		emitStep(pc);
+		pc += 2;
+
+		// Stop after instructions that can change PC, write memory or set
+		// the sound timer. Those last go on to the next instruction, the
+		// rest return with the PC the interpreter left
+		const bool writesMemory = nibble3 == 0xF && (ins.kk == 0x33 || ins.kk == 0x55);
+		bool endsBlock =
+			(nibble3 == 0x0 && ins.opcode != 0x00E0) ||
+			nibble3 == 0x1 || nibble3 == 0x2 || nibble3 == 0x3 ||
+			nibble3 == 0x4 || nibble3 == 0x5 || nibble3 == 0x9 ||
+			nibble3 == 0xB || nibble3 == 0xE ||
+			(nibble3 == 0xF && ins.kk == 0x0A);
+		if (writesMemory || setsBuzzer)
+		{
+			emitExit(pc);
+			exited = true;
+			break;
+		}
+		if (endsBlock)
+		{
+			emitReturn();
+			exited = true;
+			break;
+		}
+	}
+
+	if (!exited)
+	{
+		emitExit(pc);
+	}
+	std::memcpy(&scratch[checkLength], &length, sizeof(uint16_t));
+	std::memcpy(&scratch[takeLength], &length, sizeof(uint16_t));
+	return install(address, length, pc);
+}
+
+Chip8Jit::Block *Chip8Jit::install(uint16_t address, uint16_t length, uint16_t end)
+{
+	if (!protect(true))
+	{
+		return nullptr;
+	}
+	if (codeUsed + scratch.size() > CODE_BUFFER_SIZE)
+	{
+		flush();
+	}
+	uint8_t *code = codeBuffer + codeUsed;
+	std::copy(scratch.begin(), scratch.end(), code);
+
+	for (unsigned int page = address / CODE_PAGE_SIZE; page <= (end - 1u) / CODE_PAGE_SIZE; ++page)
+	{
+		codePages |= 1ull << page;
+	}
+
+	Block &block = blocks[address];
+	block.code = reinterpret_cast<BlockFn>(code);
+	block.body = code + PROLOGUE_SIZE;
+	block.length = length;
+	block.end = end;
+
+	// Chain the exits to blocks already compiled, the others are linked
+	// when their block is
+	for (const auto &exit : scratchExits)
+	{
+		const uint32_t link = static_cast<uint32_t>(codeUsed + exit.first);
+		const uint16_t target = exit.second;
+		if (target < MEMORY_SIZE - 1)
+		{
+			blocks[target].links.push_back(link);
+			patchLink(link, blocks[target].body);
+		}
+	}
+	codeUsed += scratch.size();
+	// Exits compiled before this block and waiting for it
+	for (uint32_t link : block.links)
+	{
+		patchLink(link, block.body);
+	}
+	if (!protect(false))
+	{
+		block.code = nullptr;
+		block.body = nullptr;
+		return nullptr;
+	}
+	return &block;
+}
+
+template <typename Quirks>
+bool Chip8Jit::emitNative(const Chip8::Instruction &ins, uint16_t address)
+{
+	// Register operands
+	const int32_t Vx = offsetREG + ins.x;
+	const int32_t Vy = offsetREG + ins.y;
+	const int32_t VF = offsetREG + 0xF;
+	// 8xy6/8xyE source register
+	const int32_t shiftSource = Quirks::SHIFT_USES_VY ? Vy : Vx;
+
+	switch (ins.opcode >> 12u)
+	{
+	case 0x1:
+		emitExit(ins.nnn);
+		return true;
+	case 0x3:
+		// cmp byte [Vx], kk
+		emitModRM(0x80, 7, Vx);
+		emit({ins.kk});
+		emitSkip(JE, address);
+		return true;
+	case 0x4:
+		emitModRM(0x80, 7, Vx);
+		emit({ins.kk});
+		emitSkip(JNE, address);
+		return true;
+	case 0x5:
+		// cmp al, byte [Vy]
+		emitLoad(EAX, Vx);
+		emitModRM(0x3A, EAX, Vy);
+		emitSkip(JE, address);
+		return true;
+	case 0x9:
+		if (ins.n != 0)
+		{
+			return false;
+		}
+		emitLoad(EAX, Vx);
+		emitModRM(0x3A, EAX, Vy);
+		emitSkip(JNE, address);
+		return true;
+	case 0x6:
+		// mov byte [Vx], kk
+		emitStoreImm8(Vx, ins.kk);
+		return true;
+	case 0x7:
+		// add byte [Vx], kk
+		emitModRM(0x80, 0, Vx);
+		emit({ins.kk});
+		return true;
+	case 0x8:
+		switch (ins.n)
+		{
+		case 0x0:
+			emitLoad(EAX, Vy);
+			emitStore(EAX, Vx);
+			return true;
+		case 0x1:
+			// or byte [Vx], al
+			emitLoad(EAX, Vy);
+			emitModRM(0x08, EAX, Vx);
+			if constexpr (Quirks::LOGIC_RESETS_VF)
+			{
+				emitStoreImm8(VF, 0);
+			}
+			return true;
+		case 0x2:
+			// and byte [Vx], al
+			emitLoad(EAX, Vy);
+			emitModRM(0x20, EAX, Vx);
+			if constexpr (Quirks::LOGIC_RESETS_VF)
+			{
+				emitStoreImm8(VF, 0);
+			}
+			return true;
+		case 0x3:
+			// xor byte [Vx], al
+			emitLoad(EAX, Vy);
+			emitModRM(0x30, EAX, Vx);
+			if constexpr (Quirks::LOGIC_RESETS_VF)
+			{
+				emitStoreImm8(VF, 0);
+			}
+			return true;
+		case 0x4:
+			// VF = carry, then Vx = sum (same store order as OP_8xy4)
+			emitLoad(EAX, Vx);
+			emitLoad(ECX, Vy);
+			emit({0x01, 0xC8});				  // add eax, ecx
+			emit({0x3D, 0xFF, 0x00, 0x00, 0x00}); // cmp eax, 255
+			emit({0x0F, 0x97, 0xC2});			  // seta dl
+			emitStore(EDX, VF);
+			emitStore(EAX, Vx);
+			return true;
+		case 0x5:
+			// VF = Vx > Vy, then Vx -= Vy reading the registers again
+			emitLoad(EAX, Vx);
+			emitLoad(ECX, Vy);
+			emit({0x38, 0xC8});		  // cmp al, cl
+			emit({0x0F, 0x97, 0xC2}); // seta dl
+			emitStore(EDX, VF);
+			emitLoad(EAX, Vx);
+			emitLoad(ECX, Vy);
+			emit({0x28, 0xC8}); // sub al, cl
+			emitStore(EAX, Vx);
+			return true;
+		case 0x6:
+			// VF = source & 1, then Vx = source >> 1
+			emitLoad(EAX, shiftSource);
+			emit({0x24, 0x01}); // and al, 1
+			emitStore(EAX, VF);
+			emitLoad(EAX, shiftSource);
+			emit({0xD0, 0xE8}); // shr al, 1
+			emitStore(EAX, Vx);
+			return true;
+		case 0x7:
+			// VF = Vy >= Vx, then Vx = Vy - Vx
+			emitLoad(EAX, Vx);
+			emitLoad(ECX, Vy);
+			emit({0x38, 0xC1});		  // cmp cl, al
+			emit({0x0F, 0x93, 0xC2}); // setae dl
+			emitStore(EDX, VF);
+			emitLoad(EAX, Vx);
+			emitLoad(ECX, Vy);
+			emit({0x28, 0xC1}); // sub cl, al
+			emitStore(ECX, Vx);
+			return true;
+		case 0xE:
+			// VF = source >> 7, then Vx = source << 1
+			emitLoad(EAX, shiftSource);
+			emit({0xC0, 0xE8, 0x07}); // shr al, 7
+			emitStore(EAX, VF);
+			emitLoad(EAX, shiftSource);
+			emit({0xD0, 0xE0}); // shl al, 1
+			emitStore(EAX, Vx);
+			return true;
+		}
+		return false;
+	case 0xA:
+		emitStoreImm16(offsetI, ins.nnn);
+		return true;
+	case 0xF:
+		switch (ins.kk)
+		{
+		case 0x07:
+			emitLoad(EAX, offsetDelayTimer);
+			emitStore(EAX, Vx);
+			return true;
+		case 0x15:
+			emitLoad(EAX, Vx);
+			emitStore(EAX, offsetDelayTimer);
+			return true;
+		case 0x1E:
+			// add word [I], ax
+			emitLoad(EAX, Vx);
+			emit({0x66});
+			emitModRM(0x01, EAX, offsetI);
+			return true;
+		case 0x29:
+			// lea eax, [rax + rax * 4 + FONTSET_START_ADDRESS]; mov word [I], ax
+			emitLoad(EAX, Vx);
+			emit({0x8D, 0x84, 0x80});
+			emit32(FONTSET_START_ADDRESS);
+			emit({0x66});
+			emitModRM(0x89, EAX, offsetI);
+			return true;
+		}
+		return false;
+	}
+	return false;
+}
+
+void Chip8Jit::emit(std::initializer_list<uint8_t> bytes)
+{
+	scratch.insert(scratch.end(), bytes);
+}
+
+void Chip8Jit::emit32(uint32_t value)
+{
+	emit({static_cast<uint8_t>(value),
+		  static_cast<uint8_t>(value >> 8),
+		  static_cast<uint8_t>(value >> 16),
+		  static_cast<uint8_t>(value >> 24)});
+}
+
+void Chip8Jit::emitModRM(uint8_t opcode, uint8_t reg, int32_t disp)
+{
+	// opcode, ModRM (mod = 10, rm = rbx), disp32
+	emit({opcode, static_cast<uint8_t>(0x80 | (reg << 3) | 0x3)});
+	emit32(static_cast<uint32_t>(disp));
+}
+
+void Chip8Jit::emitLoad(uint8_t reg, int32_t disp)
+{
+	// movzx reg32, byte [rbx + disp]
+	emit({0x0F});
+	emitModRM(0xB6, reg, disp);
+}
+
+void Chip8Jit::emitStore(uint8_t reg, int32_t disp)
+{
+	// mov byte [rbx + disp], reg8
+	emitModRM(0x88, reg, disp);
+}
+
+void Chip8Jit::emitStoreImm8(int32_t disp, uint8_t value)
+{
+	// mov byte [rbx + disp], imm8
+	emitModRM(0xC6, 0, disp);
+	emit({value});
+}
+
+void Chip8Jit::emitStoreImm16(int32_t disp, uint16_t value)
+{
+	// mov word [rbx + disp], imm16
+	emit({0x66});
+	emitModRM(0xC7, 0, disp);
+	emit({static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8)});
+}
+
+void Chip8Jit::emitSkip(uint8_t jcc, uint16_t address)
+{
+	// Using the flags already set: jcc taken; exit to address + 2;
+	// taken: exit to address + 4
+	emit({0x0F, jcc});
+	const size_t rel = scratch.size();
+	emit32(0);
+	emitExit(address + 2u);
+	const int32_t distance = static_cast<int32_t>(scratch.size() - (rel + 4));
+	std::memcpy(&scratch[rel], &distance, sizeof(distance));
+	emitExit(address + 4u);
+}
+
+void Chip8Jit::emitExit(uint16_t target)
+{
+	// mov word [PC], target; jmp rel32 (0 until linked); return
+	emitStoreImm16(offsetPC, target);
+	emit({0xE9});
+	scratchExits.emplace_back(static_cast<uint32_t>(scratch.size()), target);
+	emit32(0);
+	emitReturn();
+}
+
+void Chip8Jit::emitReturn()
+{
+	// mov eax, r12d; add rsp, 8; pop r12; pop rbx; ret
+	emit({0x44, 0x89, 0xE0, 0x48, 0x83, 0xC4, 0x08, 0x41, 0x5C, 0x5B, 0xC3});
+}
+
+void Chip8Jit::emitStep(uint16_t address)
+{
+	// stepAt(chip8, address)
+	// mov rdi, rbx; mov esi, address; mov rax, stepAt; call rax
+	emit({0x48, 0x89, 0xDF});
+	emit({0xBE});
+	emit32(address);
+	uint64_t target = reinterpret_cast<uint64_t>(&Chip8Jit::stepAt);
+	emit({0x48, 0xB8});
+	emit32(static_cast<uint32_t>(target));
+	emit32(static_cast<uint32_t>(target >> 32));
+	emit({0xFF, 0xD0});
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include "Chip8.h"
+
+// Basic block recompiler for x86-64.
+// Straight-line runs of CHIP-8 instructions are translated to native code
+// that works directly on the Chip8 registers. Register/ALU opcodes, jumps
+// and register skips are emitted inline; everything else (draw, random,
+// keypad, calls, memory access) calls back into Chip8::step(), so the
+// results are bit-identical to the interpreter. Inline code follows the
+// Chip8's quirk profile.
+// A block ends at the first instruction that can change PC
+// (00EE, 1nnn, 2nnn, Bnnn, skips, Fx0A), write memory (Fx33, Fx55) or
+// set the sound timer (Fx18, which times buzzer edges from the cycles left).
+// Exits to a known address (jumps, both ways of a native skip, the next
+// instruction) are patched to jump straight into the block there once it
+// is compiled, so hot loops run without going back to run() until the
+// cycles run out. The code buffer is never writable and executable at once.
+class Chip8Jit
+{
+public:
+	explicit Chip8Jit(Chip8 &chip8);
+	~Chip8Jit();
+	Chip8Jit(const Chip8Jit &) = delete;
+	Chip8Jit &operator=(const Chip8Jit &) = delete;
+
+	// True if this build/host can run generated code
+	static bool isSupported();
+	// Execute exactly cycles instructions, timers are run by Chip8
+	void run(unsigned int cycles);
+	// Drop translations that read any byte in [address, address + length)
+	void invalidate(uint16_t address, uint16_t length);
+
+private:
+	// Runs the block and the blocks chained after it while cycles last,
+	// returns the cycles left
+	using BlockFn = unsigned int (*)(Chip8 *, unsigned int cycles);
+	struct Block
+	{
+		BlockFn code{};
+		// Entry for chained jumps, past the prologue
+		uint8_t *body{};
+		// Instructions in the block
+		uint16_t length{};
+		// First address after the block
+		uint16_t end{};
+		// Code buffer offsets of the jumps of exits to this address, aimed
+		// at body while the block has code and at their own return if not
+		std::vector<uint32_t> links;
+	};
+
+	// Max instructions per block
+	static const unsigned int MAX_BLOCK_LENGTH = 32;
+	// Code pages used to skip invalidation of data-only writes
+	static const unsigned int CODE_PAGE_SIZE = MEMORY_SIZE / 64;
+	static const size_t CODE_BUFFER_SIZE = 1 << 20;
+
+	Block *compile(uint16_t address);
+	template <typename Quirks>
+	Block *compileWith(uint16_t address);
+	// Copy scratch to the code buffer as the block at address and link
+	// its exits, nullptr if the buffer cannot be made executable
+	Block *install(uint16_t address, uint16_t length, uint16_t end);
+	// Aim the jump at offset at target, or at the return after it
+	void patchLink(uint32_t offset, const uint8_t *target);
+	// Switch the code buffer between read/write and read/execute
+	bool protect(bool enable);
+	void flush();
+	static void stepAt(Chip8 *chip8, uint32_t address);
+
+	// x86-64 emitters, all memory operands are [rbx + disp32]
+	void emit(std::initializer_list<uint8_t> bytes);
+	void emit32(uint32_t value);
+	void emitModRM(uint8_t opcode, uint8_t reg, int32_t disp);
+	void emitLoad(uint8_t reg, int32_t disp);
+	void emitStore(uint8_t reg, int32_t disp);
+	void emitStoreImm8(int32_t disp, uint8_t value);
+	void emitStoreImm16(int32_t disp, uint16_t value);
+	void emitSkip(uint8_t jcc, uint16_t address);
+	void emitStep(uint16_t address);
+	// Set PC to target and jump to the block there (once linked) or return
+	void emitExit(uint16_t target);
+	// Return the cycles left to run()
+	void emitReturn();
+	// Emit ins at address inline, false if it needs the interpreter
+	template <typename Quirks>
+	bool emitNative(const Chip8::Instruction &ins, uint16_t address);
+
+	Chip8 &chip8;
+	Block blocks[MEMORY_SIZE]{};
+	uint64_t codePages{};
+	std::vector<uint8_t> scratch;
+	// Exits of the block in scratch: offset of the jump, target address
+	std::vector<std::pair<uint32_t, uint16_t>> scratchExits;
+	uint8_t *codeBuffer{};
+	size_t codeUsed{};
+	bool writable{};
+
+	// Offsets of the Chip8 registers from the object address
+	int32_t offsetREG{};
+	int32_t offsetI{};
+	int32_t offsetPC{};
+	int32_t offsetDelayTimer{};
+	int32_t offsetRunLeft{};
+};
@@ -0,0 +1,791 @@
+#include "Chip8Lockstep.h"
+#include "Chip8Opcodes.h"
+#include "Chip8Quirks.h"
+
+// Vector path: GCC/Clang vector extensions at the native register width
+// (SSE2 is part of x86-64, AVX2 if the build enables it), intrinsics for
+// the width conversions the extensions do element by element
+#if defined(__GNUC__) && defined(__SSE2__)
+#define LOCKSTEP_SIMD
+#include <immintrin.h>
+
+namespace
+{
+#if defined(__AVX2__)
+	const unsigned int VECTOR_BYTES = 32;
+	typedef __m256i Native;
+#else
+	const unsigned int VECTOR_BYTES = 16;
+	typedef __m128i Native;
+#endif
+	// VECTOR_BYTES 8-bit lanes or VECTOR_BYTES / 2 16-bit lanes.
+	// may_alias so the register arrays can be accessed both per lane
+	// and as vectors
+	typedef uint8_t Bytes __attribute__((vector_size(VECTOR_BYTES), may_alias));
+	typedef int8_t ByteMask __attribute__((vector_size(VECTOR_BYTES), may_alias));
+	typedef uint16_t Words __attribute__((vector_size(VECTOR_BYTES), may_alias));
+	typedef int16_t WordMask __attribute__((vector_size(VECTOR_BYTES), may_alias));
+
+	// Vectors per [LANES] array of 8-bit and 16-bit registers
+	const unsigned int BYTE_VECTORS = Chip8Lockstep::LANES / VECTOR_BYTES;
+	const unsigned int WORD_VECTORS = 2 * BYTE_VECTORS;
+
+	// Bit l is set if lane l of mask is set
+	uint32_t laneBits(Bytes mask)
+	{
+#if defined(__AVX2__)
+		return static_cast<uint32_t>(_mm256_movemask_epi8((Native)mask));
+#else
+		return static_cast<uint32_t>(_mm_movemask_epi8((Native)mask));
+#endif
+	}
+
+	// Two 16-bit lane masks to one 8-bit lane mask
+	Bytes narrowMask(Words low, Words high)
+	{
+#if defined(__AVX2__)
+		// packs works per 128-bit half, put the quarters back in order
+		return (Bytes)_mm256_permute4x64_epi64(_mm256_packs_epi16((Native)low, (Native)high), 0xD8);
+#else
+		return (Bytes)_mm_packs_epi16((Native)low, (Native)high);
+#endif
+	}
+
+	// 8-bit lanes to two vectors of 16-bit lanes, sign extended for masks
+	void widenMask(Bytes mask, Words &low, Words &high)
+	{
+#if defined(__AVX2__)
+		low = (Words)_mm256_cvtepi8_epi16(_mm256_castsi256_si128((Native)mask));
+		high = (Words)_mm256_cvtepi8_epi16(_mm256_extracti128_si256((Native)mask, 1));
+#else
+		// A mask byte next to itself is the 16-bit mask
+		low = (Words)_mm_unpacklo_epi8((Native)mask, (Native)mask);
+		high = (Words)_mm_unpackhi_epi8((Native)mask, (Native)mask);
+#endif
+	}
+
+	// Zero extended for values
+	void widen(Bytes value, Words &low, Words &high)
+	{
+#if defined(__AVX2__)
+		low = (Words)_mm256_cvtepu8_epi16(_mm256_castsi256_si128((Native)value));
+		high = (Words)_mm256_cvtepu8_epi16(_mm256_extracti128_si256((Native)value, 1));
+#else
+		low = (Words)_mm_unpacklo_epi8((Native)value, _mm_setzero_si128());
+		high = (Words)_mm_unpackhi_epi8((Native)value, _mm_setzero_si128());
+#endif
+	}
+}
+
+// View a [LANES] register array as vectors
+#define BYTES(array) reinterpret_cast<Bytes *>(array)
+#define WORDS(array) reinterpret_cast<Words *>(array)
+// Lanes in mask take a, the others keep b
+#define SELECT(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+// Loop over the vectors of 8-bit or 16-bit registers
+#define FOR_BYTE_VECTORS(v) for (unsigned int v = 0; v < BYTE_VECTORS; ++v)
+#define FOR_WORD_VECTORS(v) for (unsigned int v = 0; v < WORD_VECTORS; ++v)
+// Loop over the lanes of the current group
+#define FOR_EACH_LANE(lane)                                                   \
+	for (uint32_t laneSet = groupBits; laneSet != 0; laneSet &= laneSet - 1) \
+		for (unsigned int lane = __builtin_ctz(laneSet), once = 1; once; once = 0)
+#endif
+
+Chip8Lockstep::Chip8Lockstep()
+{
+	scheduleTimer();
+}
+
+Chip8Lockstep::LaneInstruction Chip8Lockstep::decode(uint16_t opcode)
+{
+	LaneInstruction ins;
+	ins.kind = classifyOpcode(opcode);
+	ins.x = (opcode & 0x0F00u) >> 8u;
+	ins.y = (opcode & 0x00F0u) >> 4u;
+	ins.n = opcode & 0x000Fu;
+	ins.kk = opcode & 0x00FFu;
+	ins.nnn = opcode & 0x0FFFu;
+	return ins;
+}
+
+bool Chip8Lockstep::loadROM(const uint8_t *data, size_t size, unsigned int count)
+{
+	if (size > MEMORY_SIZE - ROM_START_ADDRESS)
+	{
+		return false;
+	}
+	laneCount = std::min(count, LANES);
+	const RomView rom{data, size, hashBytes(data, size)};
+	for (unsigned int l = 0; l < LANES; ++l)
+	{
+		lanes[l].reset();
+		if (l < laneCount)
+		{
+			lanes[l] = std::make_unique<Chip8>();
+			lanes[l]->loadROM(rom);
+			lanes[l]->setEngine(Engine::Threaded);
+			lanes[l]->setQuirkProfile(quirkProfile);
+		}
+	}
+
+	// Same memory image as a freshly loaded Chip8
+	memset(code, 0, sizeof(code));
+	std::copy(FONTSET, FONTSET + FONTSET_SIZE, code + FONTSET_START_ADDRESS);
+	std::copy(BIG_FONTSET, BIG_FONTSET + BIG_FONTSET_SIZE, code + BIG_FONTSET_START_ADDRESS);
+	std::copy(data, data + size, code + ROM_START_ADDRESS);
+	for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+	{
+		decoded[address] = decode((code[address] << 8) | code[(address + 1) % MEMORY_SIZE]);
+	}
+	memset(written, 0, sizeof(written));
+	scalarSlices = 0;
+
+	memset(REG, 0, sizeof(REG));
+	memset(stackMemory, 0, sizeof(stackMemory));
+	memset(R_I, 0, sizeof(R_I));
+	memset(R_SP, 0, sizeof(R_SP));
+	memset(R_DELAY_TIMER, 0, sizeof(R_DELAY_TIMER));
+	memset(R_BUZZER_TIMER, 0, sizeof(R_BUZZER_TIMER));
+	std::fill(R_PC, R_PC + LANES, ROM_START_ADDRESS);
+
+	cycleCount = 0;
+	timerBaseCycle = 0;
+	timerTicks = 0;
+	frameCount = 0;
+	scheduleTimer();
+	return true;
+}
+
+void Chip8Lockstep::run(unsigned int cycles)
+{
+	// Same slicing as Chip8::run
+	while (cycles > 0)
+	{
+		unsigned int slice = std::min(cycles, cyclesUntilTimer);
+		if (scalarSlices > 0)
+		{
+			// Each lane's Chip8 keeps its own clock in step with ours
+			for (unsigned int l = 0; l < laneCount; ++l)
+			{
+				lanes[l]->run(slice);
+			}
+			advanceClock(slice);
+			if (--scalarSlices == 0)
+			{
+				for (unsigned int l = 0; l < laneCount; ++l)
+				{
+					loadLane(l);
+				}
+				refreshWritten();
+			}
+		}
+		else
+		{
+			groupSteps = 0;
+			execute(slice);
+			advanceClock(slice);
+			if (groupSteps > uint64_t(slice) * DIVERGED_GROUPS)
+			{
+				sync();
+				scalarSlices = SCALAR_SLICES;
+			}
+		}
+		cycles -= slice;
+	}
+}
+
+void Chip8Lockstep::setCpuFrequency(unsigned int hz)
+{
+	cpuFrequency = std::max(hz, TIMER_FREQUENCY);
+	timerBaseCycle = cycleCount;
+	timerTicks = 0;
+	scheduleTimer();
+}
+
+void Chip8Lockstep::setQuirkProfile(QuirkProfile profile)
+{
+	quirkProfile = profile;
+}
+
+unsigned int Chip8Lockstep::getCyclesUntilTimer() const
+{
+	return cyclesUntilTimer;
+}
+
+uint64_t Chip8Lockstep::getFrameCount() const
+{
+	return frameCount;
+}
+
+unsigned int Chip8Lockstep::getLaneCount() const
+{
+	return laneCount;
+}
+
+Chip8 &Chip8Lockstep::lane(unsigned int index)
+{
+	return *lanes[index];
+}
+
+void Chip8Lockstep::sync()
+{
+	if (scalarSlices > 0)
+	{
+		// The lanes are already up to date
+		return;
+	}
+	for (unsigned int l = 0; l < laneCount; ++l)
+	{
+		storeLane(l);
+	}
+}
+
+void Chip8Lockstep::storeLane(unsigned int index)
+{
+	Chip8 &chip8 = *lanes[index];
+	for (unsigned int r = 0; r < REGISTER_COUNT; ++r)
+	{
+		chip8.REG[r] = REG[r][index];
+	}
+	for (unsigned int s = 0; s < STACK_LEVELS; ++s)
+	{
+		chip8.stackMemory[s] = stackMemory[s][index];
+	}
+	chip8.R_I = R_I[index];
+	chip8.R_PC = R_PC[index];
+	chip8.R_SP = R_SP[index];
+	chip8.R_DELAY_TIMER = R_DELAY_TIMER[index];
+	chip8.R_BUZZER_TIMER = R_BUZZER_TIMER[index];
+	chip8.cpuFrequency = cpuFrequency;
+	chip8.cycleCount = cycleCount;
+	chip8.timerBaseCycle = timerBaseCycle;
+	chip8.timerTicks = timerTicks;
+	chip8.cyclesUntilTimer = cyclesUntilTimer;
+	chip8.frameCount = frameCount;
+}
+
+void Chip8Lockstep::loadLane(unsigned int index)
+{
+	const Chip8 &chip8 = *lanes[index];
+	for (unsigned int r = 0; r < REGISTER_COUNT; ++r)
+	{
+		REG[r][index] = chip8.REG[r];
+	}
+	for (unsigned int s = 0; s < STACK_LEVELS; ++s)
+	{
+		stackMemory[s][index] = chip8.stackMemory[s];
+	}
+	R_I[index] = chip8.R_I;
+	R_PC[index] = chip8.R_PC;
+	R_SP[index] = chip8.R_SP;
+	R_DELAY_TIMER[index] = chip8.R_DELAY_TIMER;
+	R_BUZZER_TIMER[index] = chip8.R_BUZZER_TIMER;
+}
+
+void Chip8Lockstep::markWritten(unsigned int address)
+{
+	address %= MEMORY_SIZE;
+	written[address / 64] |= 1ull << (address % 64);
+}
+
+bool Chip8Lockstep::isWritten(unsigned int address) const
+{
+	address %= MEMORY_SIZE;
+	return (written[address / 64] >> (address % 64)) & 1u;
+}
+
+void Chip8Lockstep::refreshWritten()
+{
+	memset(written, 0, sizeof(written));
+	for (unsigned int l = 0; l < laneCount; ++l)
+	{
+		const uint8_t *memory = lanes[l]->memory;
+		for (unsigned int block = 0; block < MEMORY_SIZE; block += 64)
+		{
+			if (memcmp(memory + block, code + block, 64) == 0)
+			{
+				continue;
+			}
+			for (unsigned int address = block; address < block + 64; ++address)
+			{
+				if (memory[address] != code[address])
+				{
+					markWritten(address);
+				}
+			}
+		}
+	}
+}
+
+void Chip8Lockstep::advanceClock(unsigned int cycles)
+{
+	cycleCount += cycles;
+	cyclesUntilTimer -= cycles;
+	if (cyclesUntilTimer == 0)
+	{
+		for (unsigned int l = 0; l < LANES; ++l)
+		{
+			R_DELAY_TIMER[l] -= R_DELAY_TIMER[l] > 0;
+			R_BUZZER_TIMER[l] -= R_BUZZER_TIMER[l] > 0;
+		}
+		++timerTicks;
+		++frameCount;
+		scheduleTimer();
+	}
+}
+
+void Chip8Lockstep::scheduleTimer()
+{
+	uint64_t next = timerBaseCycle + ((timerTicks + 1) * cpuFrequency + TIMER_FREQUENCY - 1) / TIMER_FREQUENCY;
+	cyclesUntilTimer = static_cast<unsigned int>(next - cycleCount);
+}
+
+void Chip8Lockstep::execute(unsigned int cycles)
+{
+#if defined(LOCKSTEP_SIMD)
+	withQuirks(quirkProfile, [&](auto quirks)
+			   { executeGroups<decltype(quirks)>(cycles); });
+#else
+	for (unsigned int l = 0; l < laneCount; ++l)
+	{
+		storeLane(l);
+		lanes[l]->execute(cycles);
+		loadLane(l);
+	}
+#endif
+}
+
+#if defined(LOCKSTEP_SIMD)
+template <typename Quirks>
+void Chip8Lockstep::executeGroups(unsigned int cycles)
+{
+	Words laneIndex[WORD_VECTORS];
+	Words active[WORD_VECTORS];
+	FOR_WORD_VECTORS(v)
+	{
+		for (unsigned int l = 0; l < VECTOR_BYTES / 2; ++l)
+		{
+			laneIndex[v][l] = v * VECTOR_BYTES / 2 + l;
+		}
+		active[v] = (Words)(laneIndex[v] < static_cast<uint16_t>(laneCount));
+	}
+	const uint32_t activeBits = laneCount < 32 ? (1u << laneCount) - 1 : ~0u;
+	Words *pc = WORDS(R_PC);
+	Words *index = WORDS(R_I);
+	Bytes *delayTimer = BYTES(R_DELAY_TIMER);
+	Bytes *buzzerTimer = BYTES(R_BUZZER_TIMER);
+
+	for (; cycles > 0; --cycles)
+	{
+		// Every active lane runs exactly one instruction per cycle
+		Words remaining[WORD_VECTORS];
+		FOR_WORD_VECTORS(v)
+		{
+			remaining[v] = active[v];
+		}
+		uint32_t remainingBits = activeBits;
+		while (remainingBits != 0)
+		{
+			// The group is every remaining lane at the PC of the first one
+			const unsigned int leader = __builtin_ctz(remainingBits);
+			const uint16_t address = R_PC[leader] % MEMORY_SIZE;
+			Words group16[WORD_VECTORS];
+			LaneInstruction ins;
+			if (isWritten(address) || isWritten(address + 1))
+			{
+				// Lanes may disagree on this code, run the leader alone
+				const uint8_t *memory = lanes[leader]->memory;
+				FOR_WORD_VECTORS(v)
+				{
+					group16[v] = (Words)(laneIndex[v] == static_cast<uint16_t>(leader));
+				}
+				ins = decode((memory[address] << 8) | memory[(address + 1) % MEMORY_SIZE]);
+			}
+			else
+			{
+				FOR_WORD_VECTORS(v)
+				{
+					group16[v] = (Words)(pc[v] == R_PC[leader]) & remaining[v];
+				}
+				ins = decoded[address];
+			}
+			Bytes group[BYTE_VECTORS];
+			uint32_t groupBits = 0;
+			FOR_BYTE_VECTORS(v)
+			{
+				group[v] = narrowMask(group16[2 * v], group16[2 * v + 1]);
+				groupBits |= laneBits(group[v]) << (v * VECTOR_BYTES);
+			}
+			remainingBits &= ~groupBits;
+			++groupSteps;
+			FOR_WORD_VECTORS(v)
+			{
+				remaining[v] &= ~group16[v];
+				// Increment the PC by 2 bytes
+				pc[v] += group16[v] & 2;
+			}
+
+			Bytes *vx = BYTES(REG[ins.x]);
+			Bytes *vy = BYTES(REG[ins.y]);
+			Bytes *vf = BYTES(REG[0xF]);
+			Bytes *shiftSource = Quirks::SHIFT_USES_VY ? vy : vx;
+			// 16-bit lanes for skips and I/PC arithmetic
+			Words low;
+			Words high;
+
+			// Same semantics as the Chip8::OP_ handlers, including the
+			// order VF and Vx are written in when x or y is F
+			switch (ins.kind)
+			{
+			case K_00Cn:
+				FOR_EACH_LANE(l)
+				{
+					lanes[l]->scrollDown(ins.n);
+				}
+				break;
+			case K_00Dn:
+				FOR_EACH_LANE(l)
+				{
+					lanes[l]->scrollUp(ins.n);
+				}
+				break;
+			case K_00E0:
+				FOR_EACH_LANE(l)
+				{
+					lanes[l]->clearVideo();
+				}
+				break;
+			case K_00FB:
+				FOR_EACH_LANE(l)
+				{
+					lanes[l]->scrollRight();
+				}
+				break;
+			case K_00FC:
+				FOR_EACH_LANE(l)
+				{
+					lanes[l]->scrollLeft();
+				}
+				break;
+			case K_00FD:
+				FOR_WORD_VECTORS(v)
+				{
+					pc[v] -= group16[v] & 2;
+				}
+				break;
+			case K_00FE:
+			case K_00FF:
+				FOR_EACH_LANE(l)
+				{
+					lanes[l]->setHires(ins.kind == K_00FF);
+				}
+				break;
+			case K_00EE:
+				FOR_EACH_LANE(l)
+				{
+					--R_SP[l];
+					R_PC[l] = stackMemory[R_SP[l] % STACK_LEVELS][l];
+				}
+				break;
+			case K_1nnn:
+				FOR_WORD_VECTORS(v)
+				{
+					pc[v] = SELECT(group16[v], ins.nnn, pc[v]);
+				}
+				break;
+			case K_2nnn:
+				FOR_EACH_LANE(l)
+				{
+					stackMemory[R_SP[l] % STACK_LEVELS][l] = R_PC[l];
+					++R_SP[l];
+				}
+				FOR_WORD_VECTORS(v)
+				{
+					pc[v] = SELECT(group16[v], ins.nnn, pc[v]);
+				}
+				break;
+			case K_3xkk:
+			case K_4xkk:
+			case K_5xy0:
+			case K_9xy0:
+				FOR_BYTE_VECTORS(v)
+				{
+					Bytes equal = (Bytes)(ins.kind == K_5xy0 || ins.kind == K_9xy0 ? vx[v] == vy[v] : vx[v] == ins.kk);
+					Bytes skip = ins.kind == K_3xkk || ins.kind == K_5xy0 ? equal : ~equal;
+					widenMask(group[v] & skip, low, high);
+					pc[2 * v] += low & 2;
+					pc[2 * v + 1] += high & 2;
+				}
+				break;
+			case K_6xkk:
+				FOR_BYTE_VECTORS(v)
+				{
+					vx[v] = SELECT(group[v], ins.kk, vx[v]);
+				}
+				break;
+			case K_7xkk:
+				FOR_BYTE_VECTORS(v)
+				{
+					vx[v] = SELECT(group[v], vx[v] + ins.kk, vx[v]);
+				}
+				break;
+			case K_8xy0:
+				FOR_BYTE_VECTORS(v)
+				{
+					vx[v] = SELECT(group[v], vy[v], vx[v]);
+				}
+				break;
+			case K_8xy1:
+				FOR_BYTE_VECTORS(v)
+				{
+					vx[v] = SELECT(group[v], vx[v] | vy[v], vx[v]);
+					if constexpr (Quirks::LOGIC_RESETS_VF)
+					{
+						vf[v] = SELECT(group[v], 0, vf[v]);
+					}
+				}
+				break;
+			case K_8xy2:
+				FOR_BYTE_VECTORS(v)
+				{
+					vx[v] = SELECT(group[v], vx[v] & vy[v], vx[v]);
+					if constexpr (Quirks::LOGIC_RESETS_VF)
+					{
+						vf[v] = SELECT(group[v], 0, vf[v]);
+					}
+				}
+				break;
+			case K_8xy3:
+				FOR_BYTE_VECTORS(v)
+				{
+					vx[v] = SELECT(group[v], vx[v] ^ vy[v], vx[v]);
+					if constexpr (Quirks::LOGIC_RESETS_VF)
+					{
+						vf[v] = SELECT(group[v], 0, vf[v]);
+					}
+				}
+				break;
+			case K_8xy4:
+				FOR_BYTE_VECTORS(v)
+				{
+					Bytes sum = vx[v] + vy[v];
+					// Unsigned overflow: the sum wrapped below Vx
+					Bytes carry = (Bytes)(sum < vx[v]) & 1;
+					vf[v] = SELECT(group[v], carry, vf[v]);
+					vx[v] = SELECT(group[v], sum, vx[v]);
+				}
+				break;
+			case K_8xy5:
+				FOR_BYTE_VECTORS(v)
+				{
+					Bytes noBorrow = (Bytes)(vx[v] > vy[v]) & 1;
+					vf[v] = SELECT(group[v], noBorrow, vf[v]);
+					vx[v] = SELECT(group[v], vx[v] - vy[v], vx[v]);
+				}
+				break;
+			case K_8xy6:
+				FOR_BYTE_VECTORS(v)
+				{
+					Bytes lsb = shiftSource[v] & 1;
+					vf[v] = SELECT(group[v], lsb, vf[v]);
+					vx[v] = SELECT(group[v], shiftSource[v] >> 1, vx[v]);
+				}
+				break;
+			case K_8xy7:
+				FOR_BYTE_VECTORS(v)
+				{
+					Bytes noBorrow = (Bytes)(vy[v] >= vx[v]) & 1;
+					vf[v] = SELECT(group[v], noBorrow, vf[v]);
+					vx[v] = SELECT(group[v], vy[v] - vx[v], vx[v]);
+				}
+				break;
+			case K_8xyE:
+				FOR_BYTE_VECTORS(v)
+				{
+					Bytes msb = shiftSource[v] >> 7;
+					vf[v] = SELECT(group[v], msb, vf[v]);
+					vx[v] = SELECT(group[v], shiftSource[v] + shiftSource[v], vx[v]);
+				}
+				break;
+			case K_Annn:
+				FOR_WORD_VECTORS(v)
+				{
+					index[v] = SELECT(group16[v], ins.nnn, index[v]);
+				}
+				break;
+			case K_Bnnn:
+				FOR_BYTE_VECTORS(v)
+				{
+					widen(BYTES(REG[Quirks::JUMP_USES_VX ? ins.x : 0])[v], low, high);
+					pc[2 * v] = SELECT(group16[2 * v], low + ins.nnn, pc[2 * v]);
+					pc[2 * v + 1] = SELECT(group16[2 * v + 1], high + ins.nnn, pc[2 * v + 1]);
+				}
+				break;
+			case K_Cxkk:
+				FOR_EACH_LANE(l)
+				{
+					REG[ins.x][l] = lanes[l]->getRandomByte() & ins.kk;
+				}
+				break;
+			case K_Dxyn:
+				FOR_EACH_LANE(l)
+				{
+					// VF is cleared before Vx and Vy are read, like OP_Dxyn
+					REG[0xF][l] = 0;
+					REG[0xF][l] = lanes[l]->drawSprite<Quirks>(REG[ins.x][l], REG[ins.y][l], R_I[l], ins.n);
+				}
+				break;
+			case K_Ex9E:
+				FOR_EACH_LANE(l)
+				{
+					if (lanes[l]->keypadMemory[REG[ins.x][l] % KEY_COUNT])
+					{
+						R_PC[l] += 2;
+					}
+				}
+				break;
+			case K_ExA1:
+				FOR_EACH_LANE(l)
+				{
+					if (!lanes[l]->keypadMemory[REG[ins.x][l] % KEY_COUNT])
+					{
+						R_PC[l] += 2;
+					}
+				}
+				break;
+			case K_Fn01:
+				FOR_EACH_LANE(l)
+				{
+					lanes[l]->planeMask = ins.x & ((1u << VIDEO_PLANES) - 1);
+				}
+				break;
+			case K_Fx07:
+				FOR_BYTE_VECTORS(v)
+				{
+					vx[v] = SELECT(group[v], delayTimer[v], vx[v]);
+				}
+				break;
+			case K_Fx0A:
+				FOR_EACH_LANE(l)
+				{
+					bool keyFound = false;
+					for (uint8_t k = 0; k < 16; k++)
+					{
+						if (lanes[l]->keypadMemory[k])
+						{
+							REG[ins.x][l] = k;
+							keyFound = true;
+							break;
+						}
+					}
+					if (!keyFound)
+					{
+						R_PC[l] -= 2;
+					}
+				}
+				break;
+			case K_Fx15:
+				FOR_BYTE_VECTORS(v)
+				{
+					delayTimer[v] = SELECT(group[v], vx[v], delayTimer[v]);
+				}
+				break;
+			case K_Fx18:
+				FOR_BYTE_VECTORS(v)
+				{
+					buzzerTimer[v] = SELECT(group[v], vx[v], buzzerTimer[v]);
+				}
+				break;
+			case K_Fx1E:
+				FOR_BYTE_VECTORS(v)
+				{
+					widen(vx[v], low, high);
+					index[2 * v] = SELECT(group16[2 * v], index[2 * v] + low, index[2 * v]);
+					index[2 * v + 1] = SELECT(group16[2 * v + 1], index[2 * v + 1] + high, index[2 * v + 1]);
+				}
+				break;
+			case K_Fx29:
+				FOR_BYTE_VECTORS(v)
+				{
+					widen(vx[v], low, high);
+					low = low * static_cast<uint16_t>(BYTES_PER_CHAR) + static_cast<uint16_t>(FONTSET_START_ADDRESS);
+					high = high * static_cast<uint16_t>(BYTES_PER_CHAR) + static_cast<uint16_t>(FONTSET_START_ADDRESS);
+					index[2 * v] = SELECT(group16[2 * v], low, index[2 * v]);
+					index[2 * v + 1] = SELECT(group16[2 * v + 1], high, index[2 * v + 1]);
+				}
+				break;
+			case K_Fx30:
+				FOR_BYTE_VECTORS(v)
+				{
+					widen(vx[v], low, high);
+					low = low * static_cast<uint16_t>(BYTES_PER_BIG_CHAR) + static_cast<uint16_t>(BIG_FONTSET_START_ADDRESS);
+					high = high * static_cast<uint16_t>(BYTES_PER_BIG_CHAR) + static_cast<uint16_t>(BIG_FONTSET_START_ADDRESS);
+					index[2 * v] = SELECT(group16[2 * v], low, index[2 * v]);
+					index[2 * v + 1] = SELECT(group16[2 * v + 1], high, index[2 * v + 1]);
+				}
+				break;
+			case K_Fx33:
+				FOR_EACH_LANE(l)
+				{
+					uint8_t value = REG[ins.x][l];
+					lanes[l]->writeMemory(R_I[l] + 0, value / 100);
+					lanes[l]->writeMemory(R_I[l] + 1, (value / 10) % 10);
+					lanes[l]->writeMemory(R_I[l] + 2, value % 10);
+					for (unsigned int w = 0; w < 3; ++w)
+					{
+						markWritten(R_I[l] + w);
+					}
+				}
+				break;
+			case K_Fx55:
+				FOR_EACH_LANE(l)
+				{
+					for (uint8_t w = 0; w <= ins.x; ++w)
+					{
+						lanes[l]->writeMemory(R_I[l] + w, REG[w][l]);
+						markWritten(R_I[l] + w);
+					}
+					if constexpr (Quirks::LOAD_STORE_INCREMENTS_I)
+					{
+						R_I[l] += ins.x + 1;
+					}
+				}
+				break;
+			case K_Fx65:
+				FOR_EACH_LANE(l)
+				{
+					for (uint8_t w = 0; w <= ins.x; ++w)
+					{
+						REG[w][l] = lanes[l]->memory[(R_I[l] + w) % MEMORY_SIZE];
+					}
+					if constexpr (Quirks::LOAD_STORE_INCREMENTS_I)
+					{
+						R_I[l] += ins.x + 1;
+					}
+				}
+				break;
+			case K_Fx75:
+				FOR_EACH_LANE(l)
+				{
+					for (uint8_t w = 0; w <= ins.x; ++w)
+					{
+						lanes[l]->rplFlags[w] = REG[w][l];
+					}
+				}
+				break;
+			case K_Fx85:
+				FOR_EACH_LANE(l)
+				{
+					for (uint8_t w = 0; w <= ins.x; ++w)
+					{
+						REG[w][l] = lanes[l]->rplFlags[w];
+					}
+				}
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+#endif
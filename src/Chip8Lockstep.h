@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include "Chip8.h"
+
+// Runs up to LANES machines with the same ROM in lockstep, one instruction
+// per lane per cycle, for batches where most lanes follow the same path.
+// V0-VF, I, PC, SP, the stack and the timers are kept in struct-of-arrays
+// form, one element per lane. Lanes at the same PC form a group and the
+// group runs register, jump and skip opcodes as single vector operations
+// under a lane mask (GCC/Clang vector extensions: one AVX2 or two SSE2
+// registers per 32 lanes). Lanes at other PCs run as their own groups.
+// Draw, random, keypad and memory opcodes loop over the lanes of the group
+// and use each lane's Chip8 for memory, video, keypad and RNG.
+// Code bytes that any lane has written are fetched per lane.
+// When the lanes have diverged so far that the groups cost more than
+// running the lanes one by one, the lanes fall back to their own Chip8
+// for a while. Builds without GCC/Clang and SSE2 always do that.
+class Chip8Lockstep
+{
+public:
+	static constexpr unsigned int LANES = 32;
+
+	Chip8Lockstep();
+	Chip8Lockstep(const Chip8Lockstep &) = delete;
+	Chip8Lockstep &operator=(const Chip8Lockstep &) = delete;
+
+	// Quirk profile of the lanes, takes effect at the next loadROM
+	void setQuirkProfile(QuirkProfile profile);
+	// Reset lanes [0, laneCount) and load the ROM into each,
+	// returns false if the ROM does not fit
+	bool loadROM(const uint8_t *data, size_t size, unsigned int laneCount);
+	// Same as Chip8::run on every lane
+	void run(unsigned int cycles);
+	void setCpuFrequency(unsigned int hz);
+	unsigned int getCyclesUntilTimer() const;
+	uint64_t getFrameCount() const;
+	unsigned int getLaneCount() const;
+	// Keypad, memory and video of a lane. Its registers, timers and
+	// counters are only up to date after sync()
+	Chip8 &lane(unsigned int index);
+	void sync();
+
+private:
+	struct LaneInstruction
+	{
+		uint8_t kind{};
+		uint8_t x{};
+		uint8_t y{};
+		uint8_t n{};
+		uint8_t kk{};
+		uint16_t nnn{};
+	};
+
+	// Groups per cycle above which a slice counts as diverged
+	static constexpr unsigned int DIVERGED_GROUPS = LANES / 4;
+	// Timer slices to run on the lanes' Chip8 after a diverged slice
+	static constexpr unsigned int SCALAR_SLICES = TIMER_FREQUENCY;
+
+	static LaneInstruction decode(uint16_t opcode);
+	// Run cycles instructions on every lane, no timers
+	void execute(unsigned int cycles);
+	template <typename Quirks>
+	void executeGroups(unsigned int cycles);
+	void advanceClock(unsigned int cycles);
+	void scheduleTimer();
+	// Copy the registers of one lane to/from its Chip8
+	void storeLane(unsigned int index);
+	void loadLane(unsigned int index);
+	void markWritten(unsigned int address);
+	bool isWritten(unsigned int address) const;
+	// Rebuild written from the lane memories
+	void refreshWritten();
+
+	std::unique_ptr<Chip8> lanes[LANES];
+	unsigned int laneCount{};
+	QuirkProfile quirkProfile = QuirkProfile::Default;
+
+	// Memory image shared by all lanes and its decoded instructions,
+	// valid at every address no lane has written
+	uint8_t code[MEMORY_SIZE]{};
+	LaneInstruction decoded[MEMORY_SIZE]{};
+	uint64_t written[MEMORY_SIZE / 64]{};
+
+	// Groups executed by execute(), to detect divergence
+	uint64_t groupSteps{};
+	// Slices left to run on the lanes' Chip8, their registers are
+	// authoritative while this is not 0
+	unsigned int scalarSlices{};
+
+	// Struct-of-arrays registers, [register][lane]
+	alignas(64) uint8_t REG[REGISTER_COUNT][LANES]{};
+	alignas(64) uint16_t stackMemory[STACK_LEVELS][LANES]{};
+	alignas(64) uint16_t R_I[LANES]{};
+	alignas(64) uint16_t R_PC[LANES]{};
+	alignas(64) uint8_t R_SP[LANES]{};
+	alignas(64) uint8_t R_DELAY_TIMER[LANES]{};
+	alignas(64) uint8_t R_BUZZER_TIMER[LANES]{};
+
+	// Timer scheduler, shared by all lanes (see Chip8)
+	unsigned int cpuFrequency = DEFAULT_CPU_FREQUENCY;
+	uint64_t cycleCount{};
+	uint64_t timerBaseCycle{};
+	uint64_t timerTicks{};
+	unsigned int cyclesUntilTimer{};
+	uint64_t frameCount{};
+};
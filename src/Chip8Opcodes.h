@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstdint>
+
+// One value per distinct opcode handler, for engines that dispatch on a
+// flat index instead of the member function tables (threaded, lockstep)
+enum OpcodeKind : uint8_t
+{
+	K_NOP,
+	K_00Cn,
+	K_00Dn,
+	K_00E0,
+	K_00EE,
+	K_00FB,
+	K_00FC,
+	K_00FD,
+	K_00FE,
+	K_00FF,
+	K_1nnn,
+	K_2nnn,
+	K_3xkk,
+	K_4xkk,
+	K_5xy0,
+	K_6xkk,
+	K_7xkk,
+	K_8xy0,
+	K_8xy1,
+	K_8xy2,
+	K_8xy3,
+	K_8xy4,
+	K_8xy5,
+	K_8xy6,
+	K_8xy7,
+	K_8xyE,
+	K_9xy0,
+	K_Annn,
+	K_Bnnn,
+	K_Cxkk,
+	K_Dxyn,
+	K_Ex9E,
+	K_ExA1,
+	K_Fn01,
+	K_Fx07,
+	K_Fx0A,
+	K_Fx15,
+	K_Fx18,
+	K_Fx1E,
+	K_Fx29,
+	K_Fx30,
+	K_Fx33,
+	K_Fx55,
+	K_Fx65,
+	K_Fx75,
+	K_Fx85,
+	K_COUNT
+};
+
+// Handler names without the OP_ prefix, indexed by OpcodeKind
+const char *const OPCODE_NAMES[K_COUNT] = {
+	"NOP", "00Cn", "00Dn", "00E0", "00EE", "00FB", "00FC", "00FD", "00FE",
+	"00FF", "1nnn", "2nnn", "3xkk", "4xkk", "5xy0", "6xkk", "7xkk", "8xy0",
+	"8xy1", "8xy2", "8xy3", "8xy4", "8xy5", "8xy6", "8xy7", "8xyE", "9xy0",
+	"Annn", "Bnnn", "Cxkk", "Dxyn", "Ex9E", "ExA1", "Fn01", "Fx07", "Fx0A",
+	"Fx15", "Fx18", "Fx1E", "Fx29", "Fx30", "Fx33", "Fx55", "Fx65", "Fx75",
+	"Fx85"};
+
+// Same routing as the routerTable/sub-tables built in Chip8::Chip8()
+inline OpcodeKind classifyOpcode(uint16_t opcode)
+{
+	const uint8_t n = opcode & 0x000Fu;
+	const uint8_t kk = opcode & 0x00FFu;
+	switch (opcode >> 12u)
+	{
+	case 0x0:
+		switch (kk)
+		{
+		case 0xE0:
+			return K_00E0;
+		case 0xEE:
+			return K_00EE;
+		case 0xFB:
+			return K_00FB;
+		case 0xFC:
+			return K_00FC;
+		case 0xFD:
+			return K_00FD;
+		case 0xFE:
+			return K_00FE;
+		case 0xFF:
+			return K_00FF;
+		}
+		return (kk & 0xF0u) == 0xC0u ? K_00Cn : (kk & 0xF0u) == 0xD0u ? K_00Dn : K_NOP;
+	case 0x1:
+		return K_1nnn;
+	case 0x2:
+		return K_2nnn;
+	case 0x3:
+		return K_3xkk;
+	case 0x4:
+		return K_4xkk;
+	case 0x5:
+		return K_5xy0;
+	case 0x6:
+		return K_6xkk;
+	case 0x7:
+		return K_7xkk;
+	case 0x8:
+		switch (n)
+		{
+		case 0x0:
+			return K_8xy0;
+		case 0x1:
+			return K_8xy1;
+		case 0x2:
+			return K_8xy2;
+		case 0x3:
+			return K_8xy3;
+		case 0x4:
+			return K_8xy4;
+		case 0x5:
+			return K_8xy5;
+		case 0x6:
+			return K_8xy6;
+		case 0x7:
+			return K_8xy7;
+		case 0xE:
+			return K_8xyE;
+		}
+		return K_NOP;
+	case 0x9:
+		return K_9xy0;
+	case 0xA:
+		return K_Annn;
+	case 0xB:
+		return K_Bnnn;
+	case 0xC:
+		return K_Cxkk;
+	case 0xD:
+		return K_Dxyn;
+	case 0xE:
+		return n == 0x1 ? K_ExA1 : n == 0xE ? K_Ex9E : K_NOP;
+	default:
+		switch (kk)
+		{
+		case 0x01:
+			return K_Fn01;
+		case 0x07:
+			return K_Fx07;
+		case 0x0A:
+			return K_Fx0A;
+		case 0x15:
+			return K_Fx15;
+		case 0x18:
+			return K_Fx18;
+		case 0x1E:
+			return K_Fx1E;
+		case 0x29:
+			return K_Fx29;
+		case 0x30:
+			return K_Fx30;
+		case 0x33:
+			return K_Fx33;
+		case 0x55:
+			return K_Fx55;
+		case 0x65:
+			return K_Fx65;
+		case 0x75:
+			return K_Fx75;
+		case 0x85:
+			return K_Fx85;
+		}
+		return K_NOP;
+	}
+}
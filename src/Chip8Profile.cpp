@@ -0,0 +1,200 @@
+#include "Chip8Profile.h"
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+	// "0x2a4"
+	std::string hexAddress(unsigned int address)
+	{
+		std::ostringstream text;
+		text << "0x" << std::hex << std::setw(3) << std::setfill('0') << address;
+		return text.str();
+	}
+
+	double percent(uint64_t count, uint64_t total)
+	{
+		return total ? count * 100.0 / total : 0.0;
+	}
+}
+
+void Chip8Profile::clear()
+{
+	*this = Chip8Profile();
+}
+
+uint64_t Chip8Profile::getInstructionCount() const
+{
+	return instructions;
+}
+
+uint64_t Chip8Profile::getOpcodeCount(OpcodeKind kind) const
+{
+	return opcodeCounts[kind];
+}
+
+uint64_t Chip8Profile::getPcCount(uint16_t address) const
+{
+	return pcCounts[address % MEMORY_SIZE];
+}
+
+uint64_t Chip8Profile::getSpriteHeightCount(uint8_t height) const
+{
+	return spriteHeights[height & 0xFu];
+}
+
+uint64_t Chip8Profile::getKeyWaitCycles() const
+{
+	return keyWaitCycles;
+}
+
+std::vector<Chip8Profile::Loop> Chip8Profile::getLoops() const
+{
+	std::vector<Loop> loops;
+	for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+	{
+		if (!backEdgeCounts[address])
+		{
+			continue;
+		}
+		Loop loop{backEdgeTargets[address], static_cast<uint16_t>(address), backEdgeCounts[address], 0};
+		for (unsigned int a = loop.start; a <= loop.end; ++a)
+		{
+			loop.instructions += pcCounts[a];
+		}
+		loops.push_back(loop);
+	}
+	std::sort(loops.begin(), loops.end(), [](const Loop &a, const Loop &b)
+			  { return a.instructions > b.instructions; });
+	return loops;
+}
+
+void Chip8Profile::writeCsv(std::ostream &out) const
+{
+	out << "section,key,count\n";
+	for (unsigned int kind = 0; kind < K_COUNT; ++kind)
+	{
+		out << "opcode," << OPCODE_NAMES[kind] << "," << opcodeCounts[kind] << "\n";
+	}
+	for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+	{
+		if (pcCounts[address])
+		{
+			out << "pc," << hexAddress(address) << "," << pcCounts[address] << "\n";
+		}
+	}
+	for (unsigned int height = 0; height < 16; ++height)
+	{
+		out << "sprite_height," << height << "," << spriteHeights[height] << "\n";
+	}
+	out << "key_wait,Fx0A," << keyWaitCycles << "\n";
+	for (const Loop &loop : getLoops())
+	{
+		out << "loop," << hexAddress(loop.start) << "-" << hexAddress(loop.end) << "," << loop.instructions << "\n";
+	}
+}
+
+void Chip8Profile::writeJson(std::ostream &out) const
+{
+	out << "{\n  \"instructions\": " << instructions << ",\n  \"opcodes\": {";
+	for (unsigned int kind = 0; kind < K_COUNT; ++kind)
+	{
+		out << (kind ? ", " : "") << "\"" << OPCODE_NAMES[kind] << "\": " << opcodeCounts[kind];
+	}
+	out << "},\n  \"pcs\": [";
+	bool first = true;
+	for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+	{
+		if (pcCounts[address])
+		{
+			out << (first ? "\n" : ",\n") << "    {\"address\": " << address << ", \"opcode\": " << pcOpcodes[address]
+				<< ", \"count\": " << pcCounts[address] << "}";
+			first = false;
+		}
+	}
+	out << "\n  ],\n  \"spriteHeights\": [";
+	for (unsigned int height = 0; height < 16; ++height)
+	{
+		out << (height ? ", " : "") << spriteHeights[height];
+	}
+	out << "],\n  \"keyWaitCycles\": " << keyWaitCycles << ",\n  \"loops\": [";
+	first = true;
+	for (const Loop &loop : getLoops())
+	{
+		out << (first ? "\n" : ",\n") << "    {\"start\": " << loop.start << ", \"end\": " << loop.end
+			<< ", \"iterations\": " << loop.iterations << ", \"instructions\": " << loop.instructions << "}";
+		first = false;
+	}
+	out << "\n  ]\n}\n";
+}
+
+void Chip8Profile::writeReport(std::ostream &out, size_t top) const
+{
+	std::ios::fmtflags flags = out.flags();
+	out << std::fixed << std::setprecision(1);
+	out << "Instructions: " << instructions << "\n";
+	if (keyWaitCycles)
+	{
+		out << "Fx0A wait cycles: " << keyWaitCycles << " (" << percent(keyWaitCycles, instructions) << "%)\n";
+	}
+
+	// Opcode mix, most executed first
+	std::vector<unsigned int> kinds;
+	for (unsigned int kind = 0; kind < K_COUNT; ++kind)
+	{
+		if (opcodeCounts[kind])
+		{
+			kinds.push_back(kind);
+		}
+	}
+	std::sort(kinds.begin(), kinds.end(), [this](unsigned int a, unsigned int b)
+			  { return opcodeCounts[a] > opcodeCounts[b]; });
+	out << "\nOpcodes:\n";
+	for (unsigned int kind : kinds)
+	{
+		out << "  OP_" << std::left << std::setw(6) << OPCODE_NAMES[kind] << std::right << std::setw(14) << opcodeCounts[kind]
+			<< std::setw(7) << percent(opcodeCounts[kind], instructions) << "%\n";
+	}
+	if (opcodeCounts[K_Dxyn])
+	{
+		out << "\nDxyn by height:";
+		for (unsigned int height = 0; height < 16; ++height)
+		{
+			if (spriteHeights[height])
+			{
+				out << " " << height << ":" << spriteHeights[height];
+			}
+		}
+		out << "\n";
+	}
+
+	std::vector<unsigned int> addresses;
+	for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+	{
+		if (pcCounts[address])
+		{
+			addresses.push_back(address);
+		}
+	}
+	std::sort(addresses.begin(), addresses.end(), [this](unsigned int a, unsigned int b)
+			  { return pcCounts[a] > pcCounts[b]; });
+	addresses.resize(std::min(addresses.size(), top));
+	out << "\nHot addresses:\n";
+	for (unsigned int address : addresses)
+	{
+		out << "  " << hexAddress(address) << "  " << std::hex << std::setw(4) << std::setfill('0') << pcOpcodes[address]
+			<< std::dec << std::setfill(' ') << "  OP_" << std::left << std::setw(6) << OPCODE_NAMES[classifyOpcode(pcOpcodes[address])]
+			<< std::right << std::setw(14) << pcCounts[address] << std::setw(7) << percent(pcCounts[address], instructions) << "%\n";
+	}
+
+	std::vector<Loop> loops = getLoops();
+	loops.resize(std::min(loops.size(), top));
+	out << "\nHot loops (back edges, body = instructions in the address range):\n";
+	for (const Loop &loop : loops)
+	{
+		out << "  " << hexAddress(loop.start) << "-" << hexAddress(loop.end) << std::setw(12) << loop.iterations << " iterations"
+			<< std::setw(14) << loop.instructions << std::setw(7) << percent(loop.instructions, instructions) << "%"
+			<< std::setw(8) << static_cast<double>(loop.instructions) / loop.iterations << " per iteration\n";
+	}
+	out.flags(flags);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+#include "Chip8.h"
+#include "Chip8Opcodes.h"
+
+// Execution counts of a Chip8, collected by Chip8::step() in builds with
+// CHIP8_PROFILE defined (make profile). Other builds have no counters and
+// no profiling code at all.
+// Counts every executed instruction per handler and per address, Dxyn per
+// sprite height and the cycles spent waiting in Fx0A. Jumps back to an
+// address at or before the jump (1nnn, Bnnn) are counted as loop back
+// edges; the code between target and jump is taken as the loop body.
+class Chip8Profile
+{
+public:
+	// A back edge and the instructions executed in its address range
+	struct Loop
+	{
+		uint16_t start;
+		uint16_t end;
+		uint64_t iterations;
+		uint64_t instructions;
+	};
+
+	// Called after executing opcode at address, nextPC is the new PC
+	void record(uint16_t address, uint16_t opcode, uint16_t nextPC)
+	{
+		OpcodeKind kind = classifyOpcode(opcode);
+		++instructions;
+		++opcodeCounts[kind];
+		++pcCounts[address];
+		pcOpcodes[address] = opcode;
+		if (kind == K_Dxyn)
+		{
+			++spriteHeights[opcode & 0x000Fu];
+		}
+		else if (kind == K_Fx0A)
+		{
+			if (nextPC == address)
+			{
+				++keyWaitCycles;
+			}
+		}
+		else if ((kind == K_1nnn || kind == K_Bnnn) && nextPC <= address)
+		{
+			++backEdgeCounts[address];
+			backEdgeTargets[address] = nextPC;
+		}
+	}
+	void clear();
+
+	uint64_t getInstructionCount() const;
+	uint64_t getOpcodeCount(OpcodeKind kind) const;
+	uint64_t getPcCount(uint16_t address) const;
+	uint64_t getSpriteHeightCount(uint8_t height) const;
+	uint64_t getKeyWaitCycles() const;
+	// Loops by instructions executed in their body, most first
+	std::vector<Loop> getLoops() const;
+
+	// "section,key,count" lines: opcode, pc, sprite height, key wait
+	// and loop ("start-end" keys, count = instructions in the body)
+	void writeCsv(std::ostream &out) const;
+	void writeJson(std::ostream &out) const;
+	// Human readable: opcode mix and the hottest addresses and loops
+	void writeReport(std::ostream &out, size_t top) const;
+
+private:
+	uint64_t instructions{};
+	uint64_t opcodeCounts[K_COUNT]{};
+	uint64_t pcCounts[MEMORY_SIZE]{};
+	// Last opcode executed at each address
+	uint16_t pcOpcodes[MEMORY_SIZE]{};
+	uint64_t spriteHeights[16]{};
+	uint64_t keyWaitCycles{};
+	// Per jump address, the last target of the back edge
+	uint64_t backEdgeCounts[MEMORY_SIZE]{};
+	uint16_t backEdgeTargets[MEMORY_SIZE]{};
+};
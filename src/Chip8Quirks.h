@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Chip8.h"
+
+// Quirk policies, one per QuirkProfile. Handlers and engines take one as a
+// template parameter and test its constants with if constexpr, so every
+// profile compiles to its own handlers with no quirk checks left at run
+// time; only the profile switch (withQuirks) picks between them.
+//
+// SHIFT_USES_VY            8xy6/8xyE shift Vy into Vx instead of Vx in place
+// LOAD_STORE_INCREMENTS_I  Fx55/Fx65 leave I at I + x + 1
+// JUMP_USES_VX             Bxnn jumps to xnn + Vx instead of nnn + V0
+// CLIP_SPRITES             Dxyn drops pixels past the right and bottom
+//                          edges instead of wrapping them
+// LOGIC_RESETS_VF          8xy1/8xy2/8xy3 set VF to 0
+// LORES_BIG_SPRITES        Dxy0 draws a 16x16 sprite in lo-res too, as it
+//                          does in hi-res, instead of nothing
+struct QuirksDefault
+{
+	static constexpr bool SHIFT_USES_VY = false;
+	static constexpr bool LOAD_STORE_INCREMENTS_I = false;
+	static constexpr bool JUMP_USES_VX = false;
+	static constexpr bool CLIP_SPRITES = false;
+	static constexpr bool LOGIC_RESETS_VF = false;
+	static constexpr bool LORES_BIG_SPRITES = false;
+};
+
+struct QuirksChip8
+{
+	static constexpr bool SHIFT_USES_VY = true;
+	static constexpr bool LOAD_STORE_INCREMENTS_I = true;
+	static constexpr bool JUMP_USES_VX = false;
+	static constexpr bool CLIP_SPRITES = true;
+	static constexpr bool LOGIC_RESETS_VF = true;
+	static constexpr bool LORES_BIG_SPRITES = false;
+};
+
+struct QuirksSchip
+{
+	static constexpr bool SHIFT_USES_VY = false;
+	static constexpr bool LOAD_STORE_INCREMENTS_I = false;
+	static constexpr bool JUMP_USES_VX = true;
+	static constexpr bool CLIP_SPRITES = true;
+	static constexpr bool LOGIC_RESETS_VF = false;
+	static constexpr bool LORES_BIG_SPRITES = true;
+};
+
+struct QuirksXoChip
+{
+	static constexpr bool SHIFT_USES_VY = true;
+	static constexpr bool LOAD_STORE_INCREMENTS_I = true;
+	static constexpr bool JUMP_USES_VX = false;
+	static constexpr bool CLIP_SPRITES = false;
+	static constexpr bool LOGIC_RESETS_VF = false;
+	static constexpr bool LORES_BIG_SPRITES = true;
+};
+
+// Call f with the policy object of profile, f(QuirksSchip{}) for Schip
+template <typename F>
+decltype(auto) withQuirks(QuirkProfile profile, F &&f)
+{
+	switch (profile)
+	{
+	case QuirkProfile::Chip8:
+		return f(QuirksChip8{});
+	case QuirkProfile::Schip:
+		return f(QuirksSchip{});
+	case QuirkProfile::XoChip:
+		return f(QuirksXoChip{});
+	default:
+		return f(QuirksDefault{});
+	}
+}
@@ -0,0 +1,342 @@
+#include "Chip8.h"
+#include "Chip8Opcodes.h"
+#include "Chip8Quirks.h"
+
+// Threaded interpreter
+// One flat table maps every 16-bit opcode to a handler index, and each
+// handler ends with its own copy of the fetch + indirect jump (NEXT), so
+// the branch predictor sees one jump site per handler instead of the
+// shared routerTable -> sub-table member function calls of step().
+// PC, I, SP, timers and V0-VF live in locals for the whole run, which
+// never crosses a timer event (see Chip8::run).
+// Each quirk profile gets its own copy of the loop (runThreadedWith).
+// Needs the GCC/Clang "labels as values" extension, other compilers
+// use step().
+
+namespace
+{
+	// Handler index for every opcode, 64 KB shared by all instances
+	struct ThreadedTable
+	{
+		uint8_t index[0x10000];
+		ThreadedTable()
+		{
+			for (unsigned int opcode = 0; opcode < 0x10000; ++opcode)
+			{
+				index[opcode] = classifyOpcode(static_cast<uint16_t>(opcode));
+			}
+		}
+	};
+
+	const ThreadedTable &threadedTable()
+	{
+		static const ThreadedTable table;
+		return table;
+	}
+}
+
+void Chip8::runThreaded(unsigned int cycles)
+{
+	withQuirks(quirkProfile, [&](auto quirks)
+			   { runThreadedWith<decltype(quirks)>(cycles); });
+}
+
+template <typename Quirks>
+void Chip8::runThreadedWith(unsigned int cycles)
+{
+#if defined(__GNUC__)
+	if (cycles == 0)
+	{
+		return;
+	}
+
+	const ThreadedTable &table = threadedTable();
+	// Order must match OpcodeKind
+	static void *const labels[K_COUNT] = {
+		&&L_NOP, &&L_00Cn, &&L_00Dn, &&L_00E0, &&L_00EE, &&L_00FB, &&L_00FC,
+		&&L_00FD, &&L_00FE, &&L_00FF, &&L_1nnn, &&L_2nnn, &&L_3xkk, &&L_4xkk,
+		&&L_5xy0, &&L_6xkk, &&L_7xkk, &&L_8xy0, &&L_8xy1, &&L_8xy2, &&L_8xy3,
+		&&L_8xy4, &&L_8xy5, &&L_8xy6, &&L_8xy7, &&L_8xyE, &&L_9xy0, &&L_Annn,
+		&&L_Bnnn, &&L_Cxkk, &&L_Dxyn, &&L_Ex9E, &&L_ExA1, &&L_Fn01, &&L_Fx07,
+		&&L_Fx0A, &&L_Fx15, &&L_Fx18, &&L_Fx1E, &&L_Fx29, &&L_Fx30, &&L_Fx33,
+		&&L_Fx55, &&L_Fx65, &&L_Fx75, &&L_Fx85};
+
+	// Machine state in locals
+	uint16_t pc = R_PC;
+	uint16_t i = R_I;
+	uint8_t sp = R_SP;
+	uint8_t dt = R_DELAY_TIMER;
+	uint8_t st = R_BUZZER_TIMER;
+	uint8_t V[REGISTER_COUNT];
+	memcpy(V, REG, sizeof(V));
+	uint16_t opcode;
+
+// Operands of the current opcode
+#define X ((opcode & 0x0F00u) >> 8u)
+#define Y ((opcode & 0x00F0u) >> 4u)
+#define KK (opcode & 0x00FFu)
+#define NNN (opcode & 0x0FFFu)
+// Register 8xy6/8xyE shift from
+#define SHIFT_SOURCE (Quirks::SHIFT_USES_VY ? Y : X)
+
+// Fetch and jump to the handler of the instruction at pc
+#define DISPATCH()                                                                         \
+	opcode = (memory[pc % MEMORY_SIZE] << 8) | memory[(pc + 1) % MEMORY_SIZE]; \
+	pc += 2;                                                                               \
+	goto *labels[table.index[opcode]]
+
+// End of every handler: stop when the slice is done or go to the next instruction
+#define NEXT()         \
+	if (--cycles == 0) \
+	{                  \
+		goto done;     \
+	}                  \
+	DISPATCH()
+
+	DISPATCH();
+
+L_NOP:
+	NEXT();
+L_00Cn:
+	scrollDown(opcode & 0x000Fu);
+	NEXT();
+L_00Dn:
+	scrollUp(opcode & 0x000Fu);
+	NEXT();
+L_00E0:
+	clearVideo();
+	NEXT();
+L_00EE:
+	--sp;
+	pc = stackMemory[sp % STACK_LEVELS];
+	NEXT();
+L_00FB:
+	scrollRight();
+	NEXT();
+L_00FC:
+	scrollLeft();
+	NEXT();
+L_00FD:
+	pc -= 2;
+	NEXT();
+L_00FE:
+	setHires(false);
+	NEXT();
+L_00FF:
+	setHires(true);
+	NEXT();
+L_1nnn:
+	pc = NNN;
+	NEXT();
+L_2nnn:
+	stackMemory[sp % STACK_LEVELS] = pc;
+	++sp;
+	pc = NNN;
+	NEXT();
+L_3xkk:
+	if (V[X] == KK)
+	{
+		pc += 2;
+	}
+	NEXT();
+L_4xkk:
+	if (V[X] != KK)
+	{
+		pc += 2;
+	}
+	NEXT();
+L_5xy0:
+	if (V[X] == V[Y])
+	{
+		pc += 2;
+	}
+	NEXT();
+L_6xkk:
+	V[X] = KK;
+	NEXT();
+L_7xkk:
+	V[X] += KK;
+	NEXT();
+L_8xy0:
+	V[X] = V[Y];
+	NEXT();
+L_8xy1:
+	V[X] |= V[Y];
+	if constexpr (Quirks::LOGIC_RESETS_VF)
+	{
+		V[0xF] = 0;
+	}
+	NEXT();
+L_8xy2:
+	V[X] &= V[Y];
+	if constexpr (Quirks::LOGIC_RESETS_VF)
+	{
+		V[0xF] = 0;
+	}
+	NEXT();
+L_8xy3:
+	V[X] ^= V[Y];
+	if constexpr (Quirks::LOGIC_RESETS_VF)
+	{
+		V[0xF] = 0;
+	}
+	NEXT();
+L_8xy4:
+{
+	uint16_t sum = V[X] + V[Y];
+	V[0xF] = sum > 255u;
+	V[X] = sum & 0xFFu;
+	NEXT();
+}
+L_8xy5:
+	V[0xF] = V[X] > V[Y];
+	V[X] -= V[Y];
+	NEXT();
+L_8xy6:
+	V[0xF] = V[SHIFT_SOURCE] & 0x01u;
+	V[X] = V[SHIFT_SOURCE] >> 1;
+	NEXT();
+L_8xy7:
+	V[0xF] = V[Y] >= V[X];
+	V[X] = V[Y] - V[X];
+	NEXT();
+L_8xyE:
+	V[0xF] = (V[SHIFT_SOURCE] & 0x80u) >> 7u;
+	V[X] = V[SHIFT_SOURCE] << 1;
+	NEXT();
+L_9xy0:
+	if (V[X] != V[Y])
+	{
+		pc += 2;
+	}
+	NEXT();
+L_Annn:
+	i = NNN;
+	NEXT();
+L_Bnnn:
+	pc = V[Quirks::JUMP_USES_VX ? X : 0] + NNN;
+	NEXT();
+L_Cxkk:
+	V[X] = getRandomByte() & KK;
+	NEXT();
+L_Dxyn:
+	// VF is cleared before Vx and Vy are read, like OP_Dxyn
+	V[0xF] = 0;
+	V[0xF] = drawSprite<Quirks>(V[X], V[Y], i, opcode & 0x000Fu);
+	NEXT();
+L_Ex9E:
+	if (keypadMemory[V[X] % KEY_COUNT])
+	{
+		pc += 2;
+	}
+	NEXT();
+L_ExA1:
+	if (!keypadMemory[V[X] % KEY_COUNT])
+	{
+		pc += 2;
+	}
+	NEXT();
+L_Fn01:
+	planeMask = X & ((1u << VIDEO_PLANES) - 1);
+	NEXT();
+L_Fx07:
+	V[X] = dt;
+	NEXT();
+L_Fx0A:
+{
+	bool keyFound = false;
+	for (uint8_t k = 0; k < 16; k++)
+	{
+		if (keypadMemory[k])
+		{
+			V[X] = k;
+			keyFound = true;
+			break;
+		}
+	}
+	if (!keyFound)
+	{
+		pc -= 2;
+	}
+	NEXT();
+}
+L_Fx15:
+	dt = V[X];
+	NEXT();
+L_Fx18:
+	st = V[X];
+	// cycles still counts this instruction
+	buzzerSet(st, cycles - 1);
+	NEXT();
+L_Fx1E:
+	i += V[X];
+	NEXT();
+L_Fx29:
+	i = FONTSET_START_ADDRESS + (BYTES_PER_CHAR * V[X]);
+	NEXT();
+L_Fx30:
+	i = BIG_FONTSET_START_ADDRESS + (BYTES_PER_BIG_CHAR * V[X]);
+	NEXT();
+L_Fx33:
+{
+	uint8_t value = V[X];
+	writeMemory(i + 0, value / 100);
+	writeMemory(i + 1, (value / 10) % 10);
+	writeMemory(i + 2, value % 10);
+	NEXT();
+}
+L_Fx55:
+	for (uint8_t w = 0; w <= X; ++w)
+	{
+		writeMemory(i + w, V[w]);
+	}
+	if constexpr (Quirks::LOAD_STORE_INCREMENTS_I)
+	{
+		i += X + 1;
+	}
+	NEXT();
+L_Fx65:
+	for (uint8_t w = 0; w <= X; ++w)
+	{
+		V[w] = memory[(i + w) % MEMORY_SIZE];
+	}
+	if constexpr (Quirks::LOAD_STORE_INCREMENTS_I)
+	{
+		i += X + 1;
+	}
+	NEXT();
+L_Fx75:
+	for (uint8_t w = 0; w <= X; ++w)
+	{
+		rplFlags[w] = V[w];
+	}
+	NEXT();
+L_Fx85:
+	for (uint8_t w = 0; w <= X; ++w)
+	{
+		V[w] = rplFlags[w];
+	}
+	NEXT();
+
+#undef NEXT
+#undef DISPATCH
+#undef SHIFT_SOURCE
+#undef NNN
+#undef KK
+#undef Y
+#undef X
+
+done:
+	R_PC = pc;
+	R_I = i;
+	R_SP = sp;
+	R_DELAY_TIMER = dt;
+	R_BUZZER_TIMER = st;
+	memcpy(REG, V, sizeof(V));
+#else
+	for (unsigned int cycle = 0; cycle < cycles; ++cycle)
+	{
+		step();
+	}
+#endif
+}
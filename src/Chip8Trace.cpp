@@ -0,0 +1,258 @@
+#include "Chip8Trace.h"
+#include "Chip8Opcodes.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// Trace file header, followed by the records
+static const char TRACE_FILE_MAGIC[4] = {'C', '8', 'T', 'R'};
+static const uint32_t TRACE_FILE_VERSION = 1;
+
+Chip8Trace::Chip8Trace()
+	: records(TRACE_CAPACITY)
+{
+}
+
+void Chip8Trace::clear()
+{
+	count = 0;
+}
+
+void Chip8Trace::setTrigger(uint16_t address, const std::string &filepath)
+{
+	triggerAddress = address % MEMORY_SIZE;
+	triggerPath = filepath;
+	triggered = false;
+}
+
+bool Chip8Trace::isTriggered() const
+{
+	return triggered;
+}
+
+void Chip8Trace::fireTrigger()
+{
+	// Only the first time, later passes would overwrite the history
+	// leading up to it
+	triggerAddress = NO_TRIGGER;
+	triggered = save(triggerPath.c_str());
+}
+
+uint64_t Chip8Trace::getRecordCount() const
+{
+	return count;
+}
+
+std::vector<TraceRecord> Chip8Trace::getRecords() const
+{
+	std::vector<TraceRecord> ordered;
+	uint64_t first = count > TRACE_CAPACITY ? count - TRACE_CAPACITY : 0;
+	ordered.reserve(count - first);
+	for (uint64_t r = first; r < count; ++r)
+	{
+		ordered.push_back(records[r & (TRACE_CAPACITY - 1)]);
+	}
+	return ordered;
+}
+
+bool Chip8Trace::save(char const *filepath) const
+{
+	std::vector<TraceRecord> ordered = getRecords();
+	uint32_t version = TRACE_FILE_VERSION;
+	uint32_t recordCount = static_cast<uint32_t>(ordered.size());
+	std::ofstream file(filepath, std::ios::binary);
+	file.write(TRACE_FILE_MAGIC, sizeof(TRACE_FILE_MAGIC));
+	file.write(reinterpret_cast<const char *>(&version), sizeof(version));
+	file.write(reinterpret_cast<const char *>(&recordCount), sizeof(recordCount));
+	file.write(reinterpret_cast<const char *>(ordered.data()), ordered.size() * sizeof(TraceRecord));
+	if (!file)
+	{
+		std::cerr << "Failed to write trace: " << filepath << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool Chip8Trace::load(char const *filepath, std::vector<TraceRecord> &records)
+{
+	std::ifstream file(filepath, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "Failed to open trace: " << filepath << "\n";
+		return false;
+	}
+	char magic[sizeof(TRACE_FILE_MAGIC)];
+	uint32_t version, recordCount;
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char *>(&version), sizeof(version));
+	file.read(reinterpret_cast<char *>(&recordCount), sizeof(recordCount));
+	if (!file || std::memcmp(magic, TRACE_FILE_MAGIC, sizeof(magic)) != 0 || version != TRACE_FILE_VERSION)
+	{
+		std::cerr << "Not a trace file: " << filepath << "\n";
+		return false;
+	}
+	records.resize(recordCount);
+	file.read(reinterpret_cast<char *>(records.data()), records.size() * sizeof(TraceRecord));
+	if (!file)
+	{
+		std::cerr << "Truncated trace file: " << filepath << "\n";
+		return false;
+	}
+	return true;
+}
+
+std::string disassemble(uint16_t opcode)
+{
+	const unsigned int x = (opcode & 0x0F00u) >> 8u;
+	const unsigned int y = (opcode & 0x00F0u) >> 4u;
+	const unsigned int n = opcode & 0x000Fu;
+	const unsigned int kk = opcode & 0x00FFu;
+	const unsigned int nnn = opcode & 0x0FFFu;
+	char text[32];
+	switch (classifyOpcode(opcode))
+	{
+	case K_NOP:
+		if (opcode >> 12u)
+		{
+			std::snprintf(text, sizeof(text), "DW 0x%04X", opcode);
+		}
+		else
+		{
+			std::snprintf(text, sizeof(text), "SYS 0x%03X", nnn);
+		}
+		break;
+	case K_00Cn:
+		std::snprintf(text, sizeof(text), "SCD %u", n);
+		break;
+	case K_00Dn:
+		std::snprintf(text, sizeof(text), "SCU %u", n);
+		break;
+	case K_00E0:
+		return "CLS";
+	case K_00EE:
+		return "RET";
+	case K_00FB:
+		return "SCR";
+	case K_00FC:
+		return "SCL";
+	case K_00FD:
+		return "EXIT";
+	case K_00FE:
+		return "LOW";
+	case K_00FF:
+		return "HIGH";
+	case K_1nnn:
+		std::snprintf(text, sizeof(text), "JP 0x%03X", nnn);
+		break;
+	case K_2nnn:
+		std::snprintf(text, sizeof(text), "CALL 0x%03X", nnn);
+		break;
+	case K_3xkk:
+		std::snprintf(text, sizeof(text), "SE V%X, 0x%02X", x, kk);
+		break;
+	case K_4xkk:
+		std::snprintf(text, sizeof(text), "SNE V%X, 0x%02X", x, kk);
+		break;
+	case K_5xy0:
+		std::snprintf(text, sizeof(text), "SE V%X, V%X", x, y);
+		break;
+	case K_6xkk:
+		std::snprintf(text, sizeof(text), "LD V%X, 0x%02X", x, kk);
+		break;
+	case K_7xkk:
+		std::snprintf(text, sizeof(text), "ADD V%X, 0x%02X", x, kk);
+		break;
+	case K_8xy0:
+		std::snprintf(text, sizeof(text), "LD V%X, V%X", x, y);
+		break;
+	case K_8xy1:
+		std::snprintf(text, sizeof(text), "OR V%X, V%X", x, y);
+		break;
+	case K_8xy2:
+		std::snprintf(text, sizeof(text), "AND V%X, V%X", x, y);
+		break;
+	case K_8xy3:
+		std::snprintf(text, sizeof(text), "XOR V%X, V%X", x, y);
+		break;
+	case K_8xy4:
+		std::snprintf(text, sizeof(text), "ADD V%X, V%X", x, y);
+		break;
+	case K_8xy5:
+		std::snprintf(text, sizeof(text), "SUB V%X, V%X", x, y);
+		break;
+	case K_8xy6:
+		std::snprintf(text, sizeof(text), "SHR V%X, V%X", x, y);
+		break;
+	case K_8xy7:
+		std::snprintf(text, sizeof(text), "SUBN V%X, V%X", x, y);
+		break;
+	case K_8xyE:
+		std::snprintf(text, sizeof(text), "SHL V%X, V%X", x, y);
+		break;
+	case K_9xy0:
+		std::snprintf(text, sizeof(text), "SNE V%X, V%X", x, y);
+		break;
+	case K_Annn:
+		std::snprintf(text, sizeof(text), "LD I, 0x%03X", nnn);
+		break;
+	case K_Bnnn:
+		std::snprintf(text, sizeof(text), "JP V0, 0x%03X", nnn);
+		break;
+	case K_Cxkk:
+		std::snprintf(text, sizeof(text), "RND V%X, 0x%02X", x, kk);
+		break;
+	case K_Dxyn:
+		std::snprintf(text, sizeof(text), "DRW V%X, V%X, %u", x, y, n);
+		break;
+	case K_Ex9E:
+		std::snprintf(text, sizeof(text), "SKP V%X", x);
+		break;
+	case K_ExA1:
+		std::snprintf(text, sizeof(text), "SKNP V%X", x);
+		break;
+	case K_Fn01:
+		std::snprintf(text, sizeof(text), "PLANE %u", x);
+		break;
+	case K_Fx07:
+		std::snprintf(text, sizeof(text), "LD V%X, DT", x);
+		break;
+	case K_Fx0A:
+		std::snprintf(text, sizeof(text), "LD V%X, K", x);
+		break;
+	case K_Fx15:
+		std::snprintf(text, sizeof(text), "LD DT, V%X", x);
+		break;
+	case K_Fx18:
+		std::snprintf(text, sizeof(text), "LD ST, V%X", x);
+		break;
+	case K_Fx1E:
+		std::snprintf(text, sizeof(text), "ADD I, V%X", x);
+		break;
+	case K_Fx29:
+		std::snprintf(text, sizeof(text), "LD F, V%X", x);
+		break;
+	case K_Fx30:
+		std::snprintf(text, sizeof(text), "LD HF, V%X", x);
+		break;
+	case K_Fx33:
+		std::snprintf(text, sizeof(text), "LD B, V%X", x);
+		break;
+	case K_Fx55:
+		std::snprintf(text, sizeof(text), "LD [I], V%X", x);
+		break;
+	case K_Fx65:
+		std::snprintf(text, sizeof(text), "LD V%X, [I]", x);
+		break;
+	case K_Fx75:
+		std::snprintf(text, sizeof(text), "LD R, V%X", x);
+		break;
+	case K_Fx85:
+		std::snprintf(text, sizeof(text), "LD V%X, R", x);
+		break;
+	default:
+		std::snprintf(text, sizeof(text), "DW 0x%04X", opcode);
+		break;
+	}
+	return text;
+}
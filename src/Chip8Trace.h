@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+
+// One executed instruction, 16 bytes
+struct TraceRecord
+{
+	// getCycleCount() when the instruction ran
+	uint64_t cycle;
+	uint16_t pc;
+	uint16_t opcode;
+	// I after the instruction
+	uint16_t i;
+	// Lowest numbered V register the instruction changed and its new
+	// value, TRACE_NO_REGISTER if none (8xy4 also changes VF, Fx65 up to
+	// x more)
+	uint8_t reg;
+	uint8_t value;
+};
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord is a fixed width file record");
+
+const uint8_t TRACE_NO_REGISTER = 0xFF;
+// Records kept, the older ones are overwritten (1 MiB)
+const size_t TRACE_CAPACITY = 1 << 16;
+
+// Execution trace of a Chip8, written by Chip8::tick() and run() in builds
+// with CHIP8_TRACE defined (make trace). Other builds have no trace and no
+// tracing code at all.
+// Keeps the last TRACE_CAPACITY instructions in a ring, written to a file
+// on demand (save) or when the PC reaches a trigger address. The file is
+// decoded by chip8-tracedump (make tracedump).
+class Chip8Trace
+{
+public:
+	Chip8Trace();
+
+	// Called after executing opcode at address, before holds V0-VF from
+	// before the instruction
+	void record(uint64_t cycle, uint16_t address, uint16_t opcode, const uint8_t *before, const uint8_t *after, uint16_t i)
+	{
+		TraceRecord &r = records[count++ & (TRACE_CAPACITY - 1)];
+		r.cycle = cycle;
+		r.pc = address;
+		r.opcode = opcode;
+		r.i = i;
+		// Changed bytes of V0-V7 and V8-VF, the lowest one is the lowest
+		// set bit (little-endian)
+		uint64_t words[4];
+		std::memcpy(words, before, 16);
+		std::memcpy(words + 2, after, 16);
+		const uint64_t low = words[0] ^ words[2];
+		const uint64_t high = words[1] ^ words[3];
+		const uint8_t reg = low ? __builtin_ctzll(low) / 8 : high ? 8 + __builtin_ctzll(high) / 8 : TRACE_NO_REGISTER;
+		r.reg = reg;
+		r.value = after[reg & 0xF];
+		if (address == triggerAddress)
+		{
+			fireTrigger();
+		}
+	}
+	void clear();
+
+	// Write the ring to filepath the first time the PC reaches address,
+	// including the instruction there
+	void setTrigger(uint16_t address, const std::string &filepath);
+	// True once the trigger has written its file
+	bool isTriggered() const;
+
+	// Instructions recorded since power on, the ring holds the last
+	// TRACE_CAPACITY of them
+	uint64_t getRecordCount() const;
+	// The records in the ring, oldest first
+	std::vector<TraceRecord> getRecords() const;
+	// Trace file: "C8TR", version, record count and the records oldest
+	// first, returns false on I/O errors
+	bool save(char const *filepath) const;
+	static bool load(char const *filepath, std::vector<TraceRecord> &records);
+
+private:
+	void fireTrigger();
+
+	// No PC equals it
+	static const uint32_t NO_TRIGGER = 0x10000;
+
+	std::vector<TraceRecord> records;
+	uint64_t count{};
+	uint32_t triggerAddress = NO_TRIGGER;
+	std::string triggerPath;
+	bool triggered{};
+};
+
+// Assembly text of an opcode, "LD V1, 0x20" (Cowgod's mnemonics, SCHIP and
+// XO-CHIP ones for their opcodes)
+std::string disassemble(uint16_t opcode);
@@ -0,0 +1,87 @@
+#include "FramePacer.h"
+#include <algorithm>
+#include <cmath>
+
+FramePacer::FramePacer(double frameDurationMs)
+{
+	frequency = SDL_GetPerformanceFrequency();
+	basePeriod = static_cast<Uint64>(frameDurationMs * frequency / 1000.0);
+	period = basePeriod;
+	// Start pessimistic, 2 ms per SDL_Delay(1), and learn the real cost
+	sleepCost = frequency / 500;
+	nextDeadline = SDL_GetPerformanceCounter();
+}
+
+void FramePacer::waitForNextFrame(bool precise)
+{
+	Uint64 now = SDL_GetPerformanceCounter();
+
+	// Sleep while there is more than one sleep worth of time left, or
+	// any time at all when not precise
+	while (now + (precise ? sleepCost : 0) < nextDeadline)
+	{
+		SDL_Delay(1);
+		Uint64 after = SDL_GetPerformanceCounter();
+		// Slowly forget old worst cases so a single hiccup does not stick
+		sleepCost = std::max(after - now, sleepCost - sleepCost / 64);
+		now = after;
+	}
+	// Spin for the remainder
+	while (now < nextDeadline)
+	{
+		now = SDL_GetPerformanceCounter();
+	}
+
+	if (lastFrameStart)
+	{
+		frameTimesMs.push_back((now - lastFrameStart) * 1000.0 / frequency);
+	}
+	lastFrameStart = now;
+
+	// Deadlines advance by a fixed period so they do not drift,
+	// unless more than a whole frame was missed
+	nextDeadline += period;
+	if (nextDeadline < now)
+	{
+		nextDeadline = now + period;
+	}
+}
+
+bool FramePacer::isFrameDue() const
+{
+	return SDL_GetPerformanceCounter() >= nextDeadline;
+}
+
+void FramePacer::setRateScale(double scale)
+{
+	period = static_cast<Uint64>(basePeriod * scale);
+}
+
+void FramePacer::printStats(std::ostream &out) const
+{
+	if (frameTimesMs.empty())
+	{
+		return;
+	}
+	double sum = 0;
+	for (double ms : frameTimesMs)
+	{
+		sum += ms;
+	}
+	double mean = sum / frameTimesMs.size();
+	double variance = 0;
+	for (double ms : frameTimesMs)
+	{
+		variance += (ms - mean) * (ms - mean);
+	}
+	variance /= frameTimesMs.size();
+
+	std::vector<double> sorted = frameTimesMs;
+	size_t p99Index = std::min(sorted.size() - 1, sorted.size() * 99 / 100);
+	std::nth_element(sorted.begin(), sorted.begin() + p99Index, sorted.end());
+
+	out << "Frames: " << frameTimesMs.size() << "\n";
+	out << "Frame time mean ms: " << mean << "\n";
+	out << "Frame time p99 ms: " << sorted[p99Index] << "\n";
+	out << "Frame time jitter ms: " << std::sqrt(variance) << "\n";
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <SDL.h>
+
+// Paces the SDL main loop with the high resolution counter.
+// Sleeps for most of the frame interval and only spins for the last part,
+// sized from how much SDL_Delay actually overshoots on this host.
+class FramePacer
+{
+public:
+	explicit FramePacer(double frameDurationMs);
+
+	// Block until the next frame is due and record the frame time.
+	// Without precise it only sleeps, up to one sleep late, instead of
+	// spinning for the last stretch
+	void waitForNextFrame(bool precise = true);
+	// True once waitForNextFrame would return without waiting
+	bool isFrameDue() const;
+	// Stretch (> 1) or shrink (< 1) the frame interval from now on,
+	// relative to frameDurationMs
+	void setRateScale(double scale);
+	// Frame time mean, p99 and jitter (standard deviation)
+	void printStats(std::ostream &out) const;
+
+private:
+	Uint64 frequency;
+	// Frame interval in counter ticks, and before setRateScale
+	Uint64 period;
+	Uint64 basePeriod;
+	Uint64 nextDeadline;
+	Uint64 lastFrameStart{};
+	// Worst observed SDL_Delay(1) duration in counter ticks
+	Uint64 sleepCost;
+	std::vector<double> frameTimesMs;
+};
@@ -0,0 +1,176 @@
+#include "Movie.h"
+
+// Movie file header, followed by the runs
+static const char MOVIE_FILE_MAGIC[4] = {'C', '8', 'M', 'V'};
+static const uint32_t MOVIE_FILE_VERSION = 2;
+
+namespace
+{
+	template <typename T>
+	void writeValue(std::ofstream &file, T value)
+	{
+		file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+	}
+
+	template <typename T>
+	void readValue(std::ifstream &file, T &value)
+	{
+		file.read(reinterpret_cast<char *>(&value), sizeof(value));
+	}
+}
+
+Movie::Movie(uint64_t romHash, uint64_t seed, unsigned int cpuFrequency, QuirkProfile quirkProfile)
+	: romHash(romHash), seed(seed), cpuFrequency(cpuFrequency), quirkProfile(quirkProfile)
+{
+}
+
+void Movie::record(uint64_t frame, uint16_t keys)
+{
+	// Rewound: forget the frames after it
+	while (!runs.empty() && runs.back().frame >= frame)
+	{
+		runs.pop_back();
+	}
+	// Skipped frames keep the last keys, which is what the run already says
+	if (runs.empty() && frame > 0)
+	{
+		runs.push_back({0, 0});
+	}
+	if (runs.empty() || runs.back().keys != keys)
+	{
+		runs.push_back({frame, keys});
+	}
+	frameCount = frame + 1;
+}
+
+uint16_t Movie::getKeys(uint64_t frame) const
+{
+	if (frame >= frameCount)
+	{
+		return 0;
+	}
+	auto next = std::upper_bound(runs.begin(), runs.end(), frame, [](uint64_t f, const Run &run)
+								 { return f < run.frame; });
+	return std::prev(next)->keys;
+}
+
+uint64_t Movie::getFrameCount() const
+{
+	return frameCount;
+}
+
+size_t Movie::getRunCount() const
+{
+	return runs.size();
+}
+
+uint64_t Movie::getRomHash() const
+{
+	return romHash;
+}
+
+uint64_t Movie::getSeed() const
+{
+	return seed;
+}
+
+unsigned int Movie::getCpuFrequency() const
+{
+	return cpuFrequency;
+}
+
+QuirkProfile Movie::getQuirkProfile() const
+{
+	return quirkProfile;
+}
+
+bool Movie::save(char const *filepath) const
+{
+	// Runs are stored as lengths, split the ones that do not fit 32 bits
+	std::vector<std::pair<uint32_t, uint16_t>> lengths;
+	for (size_t r = 0; r < runs.size(); ++r)
+	{
+		uint64_t end = r + 1 < runs.size() ? runs[r + 1].frame : frameCount;
+		for (uint64_t left = end - runs[r].frame; left > 0;)
+		{
+			uint32_t length = static_cast<uint32_t>(std::min<uint64_t>(left, UINT32_MAX));
+			lengths.emplace_back(length, runs[r].keys);
+			left -= length;
+		}
+	}
+
+	std::ofstream file(filepath, std::ios::binary);
+	file.write(MOVIE_FILE_MAGIC, sizeof(MOVIE_FILE_MAGIC));
+	writeValue<uint32_t>(file, MOVIE_FILE_VERSION);
+	writeValue<uint64_t>(file, romHash);
+	writeValue<uint64_t>(file, seed);
+	writeValue<uint32_t>(file, cpuFrequency);
+	writeValue<uint32_t>(file, static_cast<uint32_t>(quirkProfile));
+	writeValue<uint32_t>(file, static_cast<uint32_t>(lengths.size()));
+	for (const auto &run : lengths)
+	{
+		writeValue<uint32_t>(file, run.first);
+		writeValue<uint16_t>(file, run.second);
+	}
+	if (!file)
+	{
+		std::cerr << "Failed to write movie: " << filepath << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool Movie::load(char const *filepath)
+{
+	std::ifstream file(filepath, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "Failed to open movie: " << filepath << "\n";
+		return false;
+	}
+	char magic[sizeof(MOVIE_FILE_MAGIC)];
+	uint32_t version, frequency, runCount;
+	uint32_t profile = static_cast<uint32_t>(QuirkProfile::Default);
+	uint64_t hash, movieSeed;
+	file.read(magic, sizeof(magic));
+	readValue(file, version);
+	readValue(file, hash);
+	readValue(file, movieSeed);
+	readValue(file, frequency);
+	if (version >= 2)
+	{
+		readValue(file, profile);
+	}
+	readValue(file, runCount);
+	if (!file || std::memcmp(magic, MOVIE_FILE_MAGIC, sizeof(magic)) != 0 || version < 1 || version > MOVIE_FILE_VERSION ||
+		profile > static_cast<uint32_t>(QuirkProfile::XoChip))
+	{
+		std::cerr << "Not a movie file: " << filepath << "\n";
+		return false;
+	}
+	romHash = hash;
+	seed = movieSeed;
+	cpuFrequency = frequency;
+	quirkProfile = static_cast<QuirkProfile>(profile);
+
+	runs.clear();
+	frameCount = 0;
+	for (uint32_t r = 0; r < runCount; ++r)
+	{
+		uint32_t length;
+		uint16_t keys;
+		readValue(file, length);
+		readValue(file, keys);
+		if (!file)
+		{
+			std::cerr << "Truncated movie file: " << filepath << "\n";
+			return false;
+		}
+		if (length > 0 && (runs.empty() || runs.back().keys != keys))
+		{
+			runs.push_back({frameCount, keys});
+		}
+		frameCount += length;
+	}
+	return true;
+}
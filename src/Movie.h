@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "Chip8.h"
+
+// Recorded keypad input of a run, one 16-bit key mask per 60 Hz frame
+// (bit k = key k), with what is needed to replay it: the ROM hash, the
+// seed, the CPU frequency and the quirk profile. Frames are stored as runs of equal masks,
+// so holding a key for a second costs one run instead of 60 masks.
+// File: "C8MV", version, ROM hash, seed, CPU frequency, quirk profile,
+// run count, then "<frames> <keys>" per run. Version 1 files have no
+// quirk profile and load as Default.
+class Movie
+{
+public:
+	Movie() = default;
+	Movie(uint64_t romHash, uint64_t seed, unsigned int cpuFrequency, QuirkProfile quirkProfile);
+
+	// Set the keys of frame, dropping every frame after it.
+	// Frames between the last recorded one and frame repeat its keys
+	void record(uint64_t frame, uint16_t keys);
+	// Keys of frame, 0 past the end
+	uint16_t getKeys(uint64_t frame) const;
+	uint64_t getFrameCount() const;
+	size_t getRunCount() const;
+	uint64_t getRomHash() const;
+	uint64_t getSeed() const;
+	unsigned int getCpuFrequency() const;
+	QuirkProfile getQuirkProfile() const;
+	// Returns false on I/O errors or a file that is not a movie
+	bool save(char const *filepath) const;
+	bool load(char const *filepath);
+
+private:
+	struct Run
+	{
+		// First frame of the run
+		uint64_t frame;
+		uint16_t keys;
+	};
+
+	uint64_t romHash{};
+	uint64_t seed{};
+	unsigned int cpuFrequency = DEFAULT_CPU_FREQUENCY;
+	QuirkProfile quirkProfile = QuirkProfile::Default;
+	uint64_t frameCount{};
+	// Sorted by frame, runs[0].frame == 0
+	std::vector<Run> runs;
+};
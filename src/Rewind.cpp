@@ -0,0 +1,105 @@
+#include "Rewind.h"
+
+RewindBuffer::RewindBuffer(size_t maxBytes) : maxBytes(maxBytes)
+{
+}
+
+uint64_t RewindBuffer::loadWord(const Chip8State &state, size_t index)
+{
+	uint64_t word;
+	std::memcpy(&word, reinterpret_cast<const uint8_t *>(&state) + index * sizeof(uint64_t), sizeof(word));
+	return word;
+}
+
+void RewindBuffer::storeWord(Chip8State &state, size_t index, uint64_t word)
+{
+	std::memcpy(reinterpret_cast<uint8_t *>(&state) + index * sizeof(uint64_t), &word, sizeof(word));
+}
+
+size_t RewindBuffer::deltaBytes(const Delta &delta)
+{
+	return sizeof(Delta) + delta.size() * sizeof(uint64_t);
+}
+
+void RewindBuffer::push(const Chip8 &chip8)
+{
+	if (!hasNewest)
+	{
+		chip8.saveState(newest);
+		hasNewest = true;
+		return;
+	}
+
+	chip8.saveState(current);
+	Delta delta;
+	for (size_t i = 0; i < WORDS;)
+	{
+		if (loadWord(newest, i) == loadWord(current, i))
+		{
+			++i;
+			continue;
+		}
+		size_t header = delta.size();
+		delta.push_back(0);
+		size_t first = i;
+		for (; i < WORDS; ++i)
+		{
+			uint64_t diff = loadWord(newest, i) ^ loadWord(current, i);
+			if (!diff)
+			{
+				break;
+			}
+			delta.push_back(diff);
+		}
+		delta[header] = (static_cast<uint64_t>(first) << 32) | (i - first);
+	}
+	std::memcpy(&newest, &current, sizeof(Chip8State));
+
+	byteCount += deltaBytes(delta);
+	deltas.push_back(std::move(delta));
+	while (byteCount > maxBytes && !deltas.empty())
+	{
+		byteCount -= deltaBytes(deltas.front());
+		deltas.pop_front();
+	}
+}
+
+bool RewindBuffer::rewind(Chip8 &chip8)
+{
+	if (deltas.empty())
+	{
+		return false;
+	}
+	const Delta &delta = deltas.back();
+	for (size_t d = 0; d < delta.size();)
+	{
+		size_t first = static_cast<size_t>(delta[d] >> 32);
+		size_t count = static_cast<uint32_t>(delta[d]);
+		++d;
+		for (size_t i = first; i < first + count; ++i, ++d)
+		{
+			storeWord(newest, i, loadWord(newest, i) ^ delta[d]);
+		}
+	}
+	byteCount -= deltaBytes(delta);
+	deltas.pop_back();
+	chip8.loadState(newest);
+	return true;
+}
+
+void RewindBuffer::clear()
+{
+	deltas.clear();
+	byteCount = 0;
+	hasNewest = false;
+}
+
+size_t RewindBuffer::getFrameCount() const
+{
+	return deltas.size();
+}
+
+size_t RewindBuffer::getByteCount() const
+{
+	return byteCount;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <vector>
+#include "Chip8.h"
+
+// Per-frame history of a Chip8 for rewinding. The newest frame is kept
+// as a whole Chip8State, every older frame as the XOR of its state with
+// the state of the frame after it, stored as runs of non-zero 64-bit
+// words: a frame that changed a few registers and rows takes tens of
+// bytes instead of the whole state (about 6 KB). Once the deltas take
+// more than maxBytes the oldest frames are dropped.
+class RewindBuffer
+{
+public:
+	explicit RewindBuffer(size_t maxBytes);
+	// Record the state of chip8, once per frame
+	void push(const Chip8 &chip8);
+	// Restore the frame before the newest one and drop the newest,
+	// returns false if there is none
+	bool rewind(Chip8 &chip8);
+	void clear();
+	// Frames rewind() can still step back
+	size_t getFrameCount() const;
+	size_t getByteCount() const;
+
+private:
+	static constexpr size_t WORDS = sizeof(Chip8State) / sizeof(uint64_t);
+	static_assert(sizeof(Chip8State) % sizeof(uint64_t) == 0, "Chip8State is diffed in 64-bit words");
+
+	// Runs of "(first word << 32) | word count" followed by the XOR words
+	using Delta = std::vector<uint64_t>;
+
+	static uint64_t loadWord(const Chip8State &state, size_t index);
+	static void storeWord(Chip8State &state, size_t index, uint64_t word);
+	static size_t deltaBytes(const Delta &delta);
+
+	size_t maxBytes;
+	size_t byteCount{};
+	bool hasNewest{};
+	Chip8State newest;
+	Chip8State current;
+	// Oldest first, deltas.back() turns newest into the frame before it
+	std::deque<Delta> deltas;
+};
@@ -0,0 +1,221 @@
+#include "RomCorpus.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ROM_CORPUS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define ROM_CORPUS_MMAP 0
+#endif
+
+// Corpus file header, followed by the ROM table
+static const char CORPUS_FILE_MAGIC[4] = {'C', '8', 'R', 'C'};
+static const uint32_t CORPUS_FILE_VERSION = 1;
+static const size_t CORPUS_ALIGNMENT = 64;
+
+namespace
+{
+	struct TableEntry
+	{
+		uint32_t dataOffset;
+		uint32_t dataSize;
+		uint32_t nameOffset;
+		uint32_t nameSize;
+	};
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t romCount;
+	};
+
+	size_t alignUp(size_t value)
+	{
+		return (value + CORPUS_ALIGNMENT - 1) / CORPUS_ALIGNMENT * CORPUS_ALIGNMENT;
+	}
+}
+
+RomCorpus::~RomCorpus()
+{
+	close();
+}
+
+bool RomCorpus::write(char const *filepath, const std::vector<std::string> &romPaths)
+{
+	std::vector<std::vector<uint8_t>> data(romPaths.size());
+	for (size_t i = 0; i < romPaths.size(); ++i)
+	{
+		std::ifstream file(romPaths[i], std::ios::binary);
+		if (!file)
+		{
+			std::cerr << "Failed to open ROM: " << romPaths[i] << "\n";
+			return false;
+		}
+		data[i].assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		if (data[i].size() > MEMORY_SIZE - ROM_START_ADDRESS)
+		{
+			std::cerr << "ROM too large: " << romPaths[i] << "\n";
+			return false;
+		}
+	}
+
+	// Header, table, names, then the aligned ROM data
+	std::vector<TableEntry> table(romPaths.size());
+	size_t offset = sizeof(Header) + table.size() * sizeof(TableEntry);
+	for (size_t i = 0; i < romPaths.size(); ++i)
+	{
+		table[i].nameOffset = static_cast<uint32_t>(offset);
+		table[i].nameSize = static_cast<uint32_t>(romPaths[i].size());
+		offset += romPaths[i].size();
+	}
+	for (size_t i = 0; i < romPaths.size(); ++i)
+	{
+		offset = alignUp(offset);
+		table[i].dataOffset = static_cast<uint32_t>(offset);
+		table[i].dataSize = static_cast<uint32_t>(data[i].size());
+		offset += data[i].size();
+	}
+	if (offset > UINT32_MAX)
+	{
+		std::cerr << "Corpus too large: " << filepath << "\n";
+		return false;
+	}
+
+	std::vector<uint8_t> image(offset);
+	Header header;
+	std::memcpy(header.magic, CORPUS_FILE_MAGIC, sizeof(header.magic));
+	header.version = CORPUS_FILE_VERSION;
+	header.romCount = static_cast<uint32_t>(romPaths.size());
+	std::memcpy(image.data(), &header, sizeof(header));
+	if (!table.empty())
+	{
+		std::memcpy(image.data() + sizeof(Header), table.data(), table.size() * sizeof(TableEntry));
+	}
+	for (size_t i = 0; i < romPaths.size(); ++i)
+	{
+		std::copy(romPaths[i].begin(), romPaths[i].end(), image.begin() + table[i].nameOffset);
+		std::copy(data[i].begin(), data[i].end(), image.begin() + table[i].dataOffset);
+	}
+
+	std::ofstream file(filepath, std::ios::binary);
+	file.write(reinterpret_cast<const char *>(image.data()), image.size());
+	if (!file)
+	{
+		std::cerr << "Failed to write corpus: " << filepath << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool RomCorpus::open(char const *filepath)
+{
+	close();
+#if ROM_CORPUS_MMAP
+	int fd = ::open(filepath, O_RDONLY);
+	struct stat info;
+	if (fd >= 0 && fstat(fd, &info) == 0 && info.st_size > 0)
+	{
+		void *mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+		if (mapping != MAP_FAILED)
+		{
+			base = static_cast<const uint8_t *>(mapping);
+			size = static_cast<size_t>(info.st_size);
+			mapped = true;
+		}
+	}
+	if (fd >= 0)
+	{
+		// The mapping stays valid without the descriptor
+		::close(fd);
+	}
+#endif
+	if (!mapped)
+	{
+		std::ifstream file(filepath, std::ios::binary);
+		if (!file)
+		{
+			std::cerr << "Failed to open corpus: " << filepath << "\n";
+			return false;
+		}
+		buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		base = buffer.data();
+		size = buffer.size();
+	}
+
+	Header header;
+	bool valid = size >= sizeof(Header);
+	if (valid)
+	{
+		std::memcpy(&header, base, sizeof(header));
+		valid = std::memcmp(header.magic, CORPUS_FILE_MAGIC, sizeof(header.magic)) == 0 &&
+				header.version == CORPUS_FILE_VERSION &&
+				header.romCount <= (size - sizeof(Header)) / sizeof(TableEntry);
+	}
+	for (uint32_t i = 0; valid && i < header.romCount; ++i)
+	{
+		TableEntry entry;
+		std::memcpy(&entry, base + sizeof(Header) + i * sizeof(TableEntry), sizeof(entry));
+		valid = entry.dataSize <= MEMORY_SIZE - ROM_START_ADDRESS &&
+				uint64_t(entry.dataOffset) + entry.dataSize <= size &&
+				uint64_t(entry.nameOffset) + entry.nameSize <= size;
+		if (valid)
+		{
+			names.emplace_back(reinterpret_cast<const char *>(base + entry.nameOffset), entry.nameSize);
+			roms.push_back({base + entry.dataOffset, entry.dataSize, hashBytes(base + entry.dataOffset, entry.dataSize)});
+			index.emplace(names.back(), i);
+		}
+	}
+	if (!valid)
+	{
+		std::cerr << "Not a ROM corpus: " << filepath << "\n";
+		close();
+		return false;
+	}
+	return true;
+}
+
+void RomCorpus::close()
+{
+#if ROM_CORPUS_MMAP
+	if (mapped)
+	{
+		munmap(const_cast<uint8_t *>(base), size);
+	}
+#endif
+	base = nullptr;
+	size = 0;
+	mapped = false;
+	buffer.clear();
+	names.clear();
+	roms.clear();
+	index.clear();
+}
+
+size_t RomCorpus::getRomCount() const
+{
+	return roms.size();
+}
+
+const std::string &RomCorpus::getName(size_t index) const
+{
+	return names[index];
+}
+
+RomView RomCorpus::getRom(size_t index) const
+{
+	return roms[index];
+}
+
+bool RomCorpus::find(const std::string &name, RomView &rom) const
+{
+	auto found = index.find(name);
+	if (found == index.end())
+	{
+		return false;
+	}
+	rom = roms[found->second];
+	return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Chip8.h"
+
+// Many ROMs packed into one file and mapped read-only once, so starting
+// an instance is a single bounded memcpy from shared pages
+// (Chip8::loadROM(RomView)) with no file I/O per ROM or per instance.
+// Platforms without mmap read the whole file instead.
+// File: "C8RC", version, ROM count, then per ROM the data offset, size,
+// name offset and name size (uint32 each), then the names and the data.
+// ROM data starts on 64-byte boundaries.
+class RomCorpus
+{
+public:
+	RomCorpus() = default;
+	~RomCorpus();
+	RomCorpus(const RomCorpus &) = delete;
+	RomCorpus &operator=(const RomCorpus &) = delete;
+
+	// Pack the files as ROMs named by their path as given,
+	// returns false if one is missing or does not fit in memory
+	static bool write(char const *filepath, const std::vector<std::string> &romPaths);
+	// Map a corpus, returns false on I/O errors or an invalid file
+	bool open(char const *filepath);
+	void close();
+
+	size_t getRomCount() const;
+	const std::string &getName(size_t index) const;
+	RomView getRom(size_t index) const;
+	// Returns false if there is no ROM with that name
+	bool find(const std::string &name, RomView &rom) const;
+
+private:
+	const uint8_t *base{};
+	size_t size{};
+	// Set when mapped, unset when read into buffer
+	bool mapped{};
+	std::vector<uint8_t> buffer;
+	std::vector<std::string> names;
+	std::vector<RomView> roms;
+	std::unordered_map<std::string, size_t> index;
+};
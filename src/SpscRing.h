@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Fixed size ring buffer for one producer thread and one consumer thread.
+// Each side only writes its own index, so push and pop never lock or wait.
+// Capacity must be a power of two; the indices run freely and wrap.
+template <typename T, size_t Capacity>
+class SpscRing
+{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+	// Producer: returns false if the ring is full
+	bool push(const T &value)
+	{
+		size_t tail = tailIndex.load(std::memory_order_relaxed);
+		if (tail - headIndex.load(std::memory_order_acquire) == Capacity)
+		{
+			return false;
+		}
+		items[tail & (Capacity - 1)] = value;
+		tailIndex.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer: oldest item without removing it, nullptr if empty
+	const T *peek() const
+	{
+		size_t head = headIndex.load(std::memory_order_relaxed);
+		if (head == tailIndex.load(std::memory_order_acquire))
+		{
+			return nullptr;
+		}
+		return &items[head & (Capacity - 1)];
+	}
+
+	// Consumer: drop the item returned by peek()
+	void pop()
+	{
+		headIndex.store(headIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+private:
+	T items[Capacity]{};
+	// Own cache lines so the two threads do not share one
+	alignas(64) std::atomic<size_t> headIndex{0};
+	alignas(64) std::atomic<size_t> tailIndex{0};
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Hands the newest complete value from one producer thread to one
+// consumer thread. The producer writes into its own buffer and publishes
+// it by swapping it with the middle one; the consumer swaps the middle
+// one with its own buffer when a newer value is there. Neither side ever
+// waits for the other, values the consumer was too slow for are dropped.
+template <typename T>
+class TripleBuffer
+{
+public:
+	// Producer: buffer to fill before publish()
+	T &writeBuffer()
+	{
+		return buffers[writeIndex];
+	}
+
+	// Producer: make the write buffer the newest value
+	void publish()
+	{
+		uint8_t old = middle.exchange(writeIndex | FRESH, std::memory_order_acq_rel);
+		writeIndex = old & INDEX_MASK;
+	}
+
+	// Consumer: take the newest value if one was published since the
+	// last call, returns false (keeping readBuffer) otherwise
+	bool update()
+	{
+		if (!(middle.load(std::memory_order_relaxed) & FRESH))
+		{
+			return false;
+		}
+		uint8_t old = middle.exchange(readIndex, std::memory_order_acq_rel);
+		readIndex = old & INDEX_MASK;
+		return true;
+	}
+
+	// Consumer: the value taken by the last successful update()
+	const T &readBuffer() const
+	{
+		return buffers[readIndex];
+	}
+
+private:
+	static constexpr uint8_t INDEX_MASK = 3;
+	// Set in middle when it holds a value the consumer has not taken
+	static constexpr uint8_t FRESH = 4;
+
+	T buffers[3]{};
+	uint8_t writeIndex = 0;
+	std::atomic<uint8_t> middle{1};
+	uint8_t readIndex = 2;
+};
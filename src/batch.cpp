@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <chrono>
+#include "Batch.h"
+
+// Batch runner: runs every job of a job list on all cores and prints one
+// CSV line per job (in job list order) to stdout, throughput to stderr.
+// Job list lines are "<rom> <cycles> [input script|-] [seed]", input
+// scripts are "<frame> <hex key mask>" lines. With --corpus, ROMs named
+// like a corpus entry come from the mapped corpus (see chip8-corpus).
+
+static void printUsage(char const *program)
+{
+	std::cerr << "Usage: " << program << " <job list> [--threads N] [--cycles-per-frame N] [--engine interpreter|jit|threaded|aot] [--quirks default|chip8|schip|xochip] [--lockstep] [--corpus FILE]\n";
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	char const *jobListPath = argv[1];
+
+	unsigned int threads = 0;
+	int cyclesPerFrame = 10;
+	Engine engine = Engine::Interpreter;
+	bool lockstep = false;
+	char const *corpusPath = nullptr;
+	// By ROM extension per job unless --quirks is given
+	bool quirksSet = false;
+	QuirkProfile quirks = QuirkProfile::Default;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--lockstep")
+		{
+			lockstep = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		if (arg == "--threads")
+		{
+			threads = std::stoul(argv[++i]);
+		}
+		else if (arg == "--cycles-per-frame")
+		{
+			cyclesPerFrame = std::stoi(argv[++i]);
+		}
+		else if (arg == "--engine")
+		{
+			if (!engineFromName(argv[++i], engine))
+			{
+				printUsage(argv[0]);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (arg == "--quirks")
+		{
+			if (!quirkProfileFromName(argv[++i], quirks))
+			{
+				printUsage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			quirksSet = true;
+		}
+		else if (arg == "--corpus")
+		{
+			corpusPath = argv[++i];
+		}
+		else
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<BatchJob> jobs;
+	if (!loadJobList(jobListPath, jobs))
+	{
+		return EXIT_FAILURE;
+	}
+	// Fail early instead of once per job, aot depends on each job's ROM
+	if (engine != Engine::Aot && !Chip8().setEngine(engine))
+	{
+		return EXIT_FAILURE;
+	}
+
+	RomCorpus corpus;
+	if (corpusPath && !corpus.open(corpusPath))
+	{
+		return EXIT_FAILURE;
+	}
+
+	BatchRunner runner(threads, engine, cyclesPerFrame * TIMER_FREQUENCY);
+	runner.setLockstep(lockstep);
+	runner.setCorpus(corpusPath ? &corpus : nullptr);
+	if (quirksSet)
+	{
+		runner.setQuirkProfile(quirks);
+	}
+	auto start = std::chrono::steady_clock::now();
+	std::vector<BatchResult> results = runner.run(jobs);
+	auto end = std::chrono::steady_clock::now();
+
+	int status = EXIT_SUCCESS;
+	uint64_t cycles = 0;
+	std::cout << "job,rom,ok,cycles,frames,hash,pc,i,v0-vf,ms\n";
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		const BatchResult &result = results[i];
+		if (!result.ok)
+		{
+			status = EXIT_FAILURE;
+		}
+		cycles += result.cycles;
+		std::cout << i << "," << jobs[i].romPath << "," << result.ok << "," << result.cycles << "," << result.frames << ","
+				  << std::hex << std::setfill('0') << std::setw(16) << result.videoHash << ","
+				  << std::setw(4) << result.R_PC << "," << std::setw(4) << result.R_I << ",";
+		for (uint8_t r = 0; r < REGISTER_COUNT; ++r)
+		{
+			std::cout << std::setw(2) << static_cast<unsigned int>(result.REG[r]);
+		}
+		std::cout << std::dec << "," << std::fixed << std::setprecision(3) << result.elapsedMs << "\n";
+	}
+
+	double elapsedNs = std::chrono::duration<double, std::nano>(end - start).count();
+	std::cerr << "Jobs: " << jobs.size() << "\n";
+	std::cerr << "Threads: " << runner.getThreadCount() << "\n";
+	std::cerr << "Instructions: " << cycles << "\n";
+	std::cerr << "Elapsed ms: " << std::fixed << std::setprecision(3) << elapsedNs / 1e6 << "\n";
+	std::cerr << "Instructions/s: " << std::setprecision(0) << (elapsedNs > 0 ? cycles * 1e9 / elapsedNs : 0.0) << "\n";
+
+	return status;
+}
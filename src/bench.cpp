@@ -0,0 +1,489 @@
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include "Chip8.h"
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+// Microbenchmarks: dispatch cost of Chip8::tick(), every opcode handler
+// on its own, Dxyn at every height, and whole ROMs. Each handler case is
+// a program that repeats one instruction (or a short pattern) through
+// most of memory and jumps back, so the loop jump is under 0.1% of it.
+// One line per case and engine, CSV or JSON on stdout, with the
+// min/median/mean/stddev of ns per instruction over the repetitions and
+// the median minus the NOP median of the same engine ("net").
+
+namespace
+{
+	// Memory layout of the generated programs
+	const uint16_t CODE_END = 0xE00;
+	// I points here: Fx33/Fx55/Fx65 target and Dxyn sprite
+	const uint16_t DATA_ADDRESS = 0xE00;
+	// 00EE, target of 2nnn
+	const uint16_t RETURN_ADDRESS = 0xFF0;
+	// Timer events are rare enough not to split the runs
+	const unsigned int BENCH_CPU_FREQUENCY = 60000000;
+
+	struct Case
+	{
+		std::string name;
+		// Repeated from after the prologue up to CODE_END
+		std::vector<uint16_t> pattern;
+		// Byte of every sprite row at DATA_ADDRESS
+		uint8_t spriteByte = 0xFF;
+		uint16_t keys = 0;
+		// Switch to 128x64 (00FF) before the pattern
+		bool hires = false;
+		// Call tick() per instruction instead of run()
+		bool tick = false;
+		// ROM file instead of a generated program
+		std::string romPath;
+	};
+
+	struct Options
+	{
+		std::vector<Engine> engines;
+		std::string filter;
+		std::string romDir = "./roms";
+		std::string format = "csv";
+		unsigned int repetitions = 10;
+		unsigned int warmup = 2;
+		unsigned long long instructions = 1000000;
+		int cyclesPerFrame = 10;
+		int cpu = -1;
+	};
+
+	struct Result
+	{
+		std::string name;
+		Engine engine;
+		std::vector<double> nsPerInstruction;
+		double min{}, median{}, mean{}, stddev{};
+		double net{};
+	};
+
+	// V0 = 0, V1 = 8, V2 = 60, V3 = 30, V4 = 1, I = DATA_ADDRESS
+	const std::vector<uint16_t> PROLOGUE = {0x6000, 0x6108, 0x623C, 0x631E, 0x6401, 0xA000 | DATA_ADDRESS};
+
+	std::vector<uint8_t> buildImage(const Case &c)
+	{
+		std::vector<uint16_t> code = PROLOGUE;
+		if (c.hires)
+		{
+			code.push_back(0x00FF);
+		}
+		const uint16_t bodyStart = ROM_START_ADDRESS + 2 * code.size();
+		const size_t codeWords = (CODE_END - ROM_START_ADDRESS) / 2 - 1;
+		while (code.size() + c.pattern.size() <= codeWords)
+		{
+			code.insert(code.end(), c.pattern.begin(), c.pattern.end());
+		}
+		code.push_back(0x1000 | bodyStart);
+
+		std::vector<uint8_t> image(MEMORY_SIZE - ROM_START_ADDRESS);
+		for (size_t i = 0; i < code.size(); ++i)
+		{
+			image[2 * i] = code[i] >> 8;
+			image[2 * i + 1] = code[i] & 0xFFu;
+		}
+		for (unsigned int row = 0; row < 16; ++row)
+		{
+			image[DATA_ADDRESS - ROM_START_ADDRESS + row] = c.spriteByte;
+		}
+		image[RETURN_ADDRESS - ROM_START_ADDRESS] = 0x00;
+		image[RETURN_ADDRESS - ROM_START_ADDRESS + 1] = 0xEE;
+		return image;
+	}
+
+	// A 1nnn to the next address at every address
+	std::vector<uint16_t> jumpChain()
+	{
+		std::vector<uint16_t> pattern;
+		for (uint16_t address = ROM_START_ADDRESS + 2 * PROLOGUE.size(); address < CODE_END - 2; address += 2)
+		{
+			pattern.push_back(0x1000 | (address + 2));
+		}
+		return pattern;
+	}
+
+	std::vector<Case> handlerCases()
+	{
+		auto op = [](std::string name, std::vector<uint16_t> pattern)
+		{
+			Case c;
+			c.name = name;
+			c.pattern = pattern;
+			return c;
+		};
+		std::vector<Case> cases;
+
+		// 0x0001 decodes to DO_NOTHING: dispatch alone
+		Case tick = op("tick/NOP", {0x0001});
+		tick.tick = true;
+		cases.push_back(tick);
+		cases.push_back(op("NOP", {0x0001}));
+
+		cases.push_back(op("00E0", {0x00E0}));
+		cases.push_back(op("1nnn", jumpChain()));
+		cases.push_back(op("2nnn+00EE", {0x2000 | RETURN_ADDRESS}));
+		cases.push_back(op("3xkk/skip", {0x3000, 0x0001}));
+		cases.push_back(op("3xkk/noskip", {0x3001}));
+		cases.push_back(op("4xkk/skip", {0x4001, 0x0001}));
+		cases.push_back(op("4xkk/noskip", {0x4000}));
+		cases.push_back(op("5xy0/skip", {0x5000, 0x0001}));
+		cases.push_back(op("5xy0/noskip", {0x5010}));
+		cases.push_back(op("6xkk", {0x6A55}));
+		cases.push_back(op("7xkk", {0x7A01}));
+		cases.push_back(op("8xy0", {0x8A10}));
+		cases.push_back(op("8xy1", {0x8A11}));
+		cases.push_back(op("8xy2", {0x8A12}));
+		cases.push_back(op("8xy3", {0x8A13}));
+		cases.push_back(op("8xy4", {0x8A14}));
+		cases.push_back(op("8xy5", {0x8A15}));
+		cases.push_back(op("8xy6", {0x8A16}));
+		cases.push_back(op("8xy7", {0x8A17}));
+		cases.push_back(op("8xyE", {0x8A1E}));
+		cases.push_back(op("9xy0/skip", {0x9010, 0x0001}));
+		cases.push_back(op("9xy0/noskip", {0x9000}));
+		cases.push_back(op("Annn", {0xA000 | DATA_ADDRESS}));
+		// V0 = 0, so Bnnn jumps to nnn like 1nnn
+		std::vector<uint16_t> jumps = jumpChain();
+		for (uint16_t &ins : jumps)
+		{
+			ins = 0xB000 | (ins & 0x0FFFu);
+		}
+		cases.push_back(op("Bnnn", jumps));
+		cases.push_back(op("Cxkk", {0xCAFF}));
+		Case pressed = op("Ex9E/skip", {0xE09E, 0x0001});
+		pressed.keys = 1;
+		cases.push_back(pressed);
+		cases.push_back(op("Ex9E/noskip", {0xE09E}));
+		cases.push_back(op("ExA1/skip", {0xE0A1, 0x0001}));
+		Case notPressed = op("ExA1/noskip", {0xE0A1});
+		notPressed.keys = 1;
+		cases.push_back(notPressed);
+		cases.push_back(op("Fx07", {0xFA07}));
+		Case key = op("Fx0A/pressed", {0xFA0A});
+		key.keys = 1u << 5;
+		cases.push_back(key);
+		cases.push_back(op("Fx0A/waiting", {0xFA0A}));
+		cases.push_back(op("Fx15", {0xF015}));
+		cases.push_back(op("Fx18", {0xF018}));
+		cases.push_back(op("Fx1E", {0xF01E}));
+		cases.push_back(op("Fx29", {0xF429}));
+		// I stays at DATA_ADDRESS, away from the code
+		cases.push_back(op("Fx33", {0xF433}));
+		for (unsigned int x = 0; x < REGISTER_COUNT; ++x)
+		{
+			cases.push_back(op("Fx55/x=" + std::to_string(x), {static_cast<uint16_t>(0xF055 | (x << 8))}));
+		}
+		for (unsigned int x = 0; x < REGISTER_COUNT; ++x)
+		{
+			cases.push_back(op("Fx65/x=" + std::to_string(x), {static_cast<uint16_t>(0xF065 | (x << 8))}));
+		}
+
+		// Dxyn at every height. nowrap draws at (8, 0), wrap at (60, 30)
+		// so both axes wrap. collide draws 0xFF rows, which collide on
+		// every other draw; clear draws 0x00 rows, which never do
+		for (unsigned int n = 0; n < 16; ++n)
+		{
+			for (bool wrap : {false, true})
+			{
+				for (bool collide : {true, false})
+				{
+					uint16_t opcode = static_cast<uint16_t>(wrap ? 0xD230 | n : 0xD100 | n);
+					Case draw = op("Dxyn/n=" + std::to_string(n) + (wrap ? "/wrap" : "/nowrap") + (collide ? "/collide" : "/clear"),
+								   {opcode});
+					draw.spriteByte = collide ? 0xFF : 0x00;
+					cases.push_back(draw);
+				}
+			}
+		}
+
+		// SCHIP/XO-CHIP display, in both modes: hi-res rows are two words
+		for (bool hires : {false, true})
+		{
+			const std::string mode = hires ? "/hires" : "/lores";
+			std::vector<Case> display = {
+				op("00Cn/n=4" + mode, {0x00C4}),
+				op("00Dn/n=4" + mode, {0x00D4}),
+				op("00FB" + mode, {0x00FB}),
+				op("00FC" + mode, {0x00FC}),
+				op("Dxy0" + mode, {0xD100}),
+				op("Fn01+00E0/planes=3" + mode, {0xF301, 0x00E0})};
+			for (Case &c : display)
+			{
+				c.hires = hires;
+				cases.push_back(c);
+			}
+		}
+		return cases;
+	}
+
+	std::vector<Case> romCases(const std::string &romDir)
+	{
+		std::vector<Case> cases;
+		std::error_code error;
+		for (const auto &entry : std::filesystem::directory_iterator(romDir, error))
+		{
+			if (entry.path().extension() == ".ch8")
+			{
+				Case c;
+				c.name = "rom/" + entry.path().stem().string();
+				c.romPath = entry.path().string();
+				cases.push_back(c);
+			}
+		}
+		std::sort(cases.begin(), cases.end(), [](const Case &a, const Case &b)
+				  { return a.name < b.name; });
+		return cases;
+	}
+
+	bool readRom(const std::string &path, std::vector<uint8_t> &data)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+		{
+			return false;
+		}
+		data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		return true;
+	}
+
+	// ns per instruction of one repetition
+	double runOnce(const Case &c, const std::vector<uint8_t> &image, Engine engine, const Options &options)
+	{
+		auto chip8 = std::make_unique<Chip8>();
+		chip8->loadROM(image.data(), image.size());
+		chip8->setEngine(engine);
+		chip8->setCpuFrequency(c.romPath.empty() ? BENCH_CPU_FREQUENCY : options.cyclesPerFrame * TIMER_FREQUENCY);
+		chip8->setKeys(c.keys);
+		// Every instruction counted is run: Fx0A/waiting and the ROMs' timer
+		// polls would be skipped as idle loops otherwise
+		chip8->setIdleSkip(false);
+		// Prologue and first decode/translation outside the measurement
+		chip8->run(PROLOGUE.size() + 1);
+
+		const unsigned long long count = options.instructions;
+		auto start = std::chrono::steady_clock::now();
+		if (c.tick)
+		{
+			for (unsigned long long i = 0; i < count; ++i)
+			{
+				chip8->tick();
+			}
+		}
+		else if (c.romPath.empty())
+		{
+			chip8->run(static_cast<unsigned int>(count));
+		}
+		else
+		{
+			// Whole frames, like the front ends
+			uint64_t end = chip8->getCycleCount() + count;
+			while (chip8->getCycleCount() < end)
+			{
+				chip8->runFrame();
+			}
+		}
+		auto stop = std::chrono::steady_clock::now();
+		// Keep the result alive
+		volatile uint64_t hash = chip8->videoHash();
+		(void)hash;
+		return std::chrono::duration<double, std::nano>(stop - start).count() / count;
+	}
+
+	Result runCase(const Case &c, Engine engine, const Options &options)
+	{
+		std::vector<uint8_t> image;
+		if (c.romPath.empty())
+		{
+			image = buildImage(c);
+		}
+		else
+		{
+			readRom(c.romPath, image);
+		}
+
+		Result result;
+		result.name = c.name;
+		result.engine = engine;
+		for (unsigned int i = 0; i < options.warmup; ++i)
+		{
+			runOnce(c, image, engine, options);
+		}
+		for (unsigned int i = 0; i < options.repetitions; ++i)
+		{
+			result.nsPerInstruction.push_back(runOnce(c, image, engine, options));
+		}
+
+		std::vector<double> sorted = result.nsPerInstruction;
+		std::sort(sorted.begin(), sorted.end());
+		size_t count = sorted.size();
+		result.min = sorted.front();
+		result.median = count % 2 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+		for (double ns : sorted)
+		{
+			result.mean += ns;
+		}
+		result.mean /= count;
+		for (double ns : sorted)
+		{
+			result.stddev += (ns - result.mean) * (ns - result.mean);
+		}
+		result.stddev = std::sqrt(result.stddev / count);
+		return result;
+	}
+
+	void printUsage(char const *program)
+	{
+		std::cerr << "Usage: " << program << " [--engine interpreter|jit|threaded]... [--filter TEXT] [--roms DIR] [--instructions N]"
+				  << " [--repetitions N] [--warmup N] [--cycles-per-frame N] [--cpu N] [--format csv|json]\n";
+	}
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (i + 1 >= argc)
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		std::string value = argv[++i];
+		Engine engine;
+		if (arg == "--engine" && engineFromName(value, engine))
+		{
+			options.engines.push_back(engine);
+		}
+		else if (arg == "--filter")
+		{
+			options.filter = value;
+		}
+		else if (arg == "--roms")
+		{
+			options.romDir = value;
+		}
+		else if (arg == "--instructions")
+		{
+			options.instructions = std::max(1ull, std::stoull(value));
+		}
+		else if (arg == "--repetitions")
+		{
+			options.repetitions = std::max(1ul, std::stoul(value));
+		}
+		else if (arg == "--warmup")
+		{
+			options.warmup = std::stoul(value);
+		}
+		else if (arg == "--cycles-per-frame")
+		{
+			options.cyclesPerFrame = std::stoi(value);
+		}
+		else if (arg == "--cpu")
+		{
+			options.cpu = std::stoi(value);
+		}
+		else if (arg == "--format" && (value == "csv" || value == "json"))
+		{
+			options.format = value;
+		}
+		else
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (options.engines.empty())
+	{
+		options.engines.push_back(Engine::Interpreter);
+	}
+	for (Engine engine : options.engines)
+	{
+		if (!Chip8().setEngine(engine))
+		{
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (options.cpu >= 0)
+	{
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(options.cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) != 0)
+		{
+			std::cerr << "Failed to pin to CPU " << options.cpu << "\n";
+			return EXIT_FAILURE;
+		}
+#else
+		std::cerr << "--cpu is only supported on Linux\n";
+		return EXIT_FAILURE;
+#endif
+	}
+
+	std::vector<Case> cases = handlerCases();
+	std::vector<Case> roms = romCases(options.romDir);
+	cases.insert(cases.end(), roms.begin(), roms.end());
+
+	// Results go to stdout, progress to stderr
+	std::vector<Result> results;
+	for (Engine engine : options.engines)
+	{
+		double nop = 0;
+		for (const Case &c : cases)
+		{
+			if (c.name == "NOP")
+			{
+				// The baseline always runs, net needs it
+				nop = runCase(c, engine, options).median;
+			}
+		}
+		for (const Case &c : cases)
+		{
+			if (c.name.find(options.filter) == std::string::npos)
+			{
+				continue;
+			}
+			Result result = runCase(c, engine, options);
+			result.net = result.median - nop;
+			results.push_back(result);
+			std::cerr << engineName(engine) << " " << result.name << " " << std::fixed << std::setprecision(3) << result.median << " ns\n";
+		}
+	}
+
+	std::cout << std::fixed << std::setprecision(3);
+	if (options.format == "json")
+	{
+		std::cout << "{\n  \"instructions\": " << options.instructions << ",\n  \"repetitions\": " << options.repetitions
+				  << ",\n  \"results\": [";
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const Result &r = results[i];
+			std::cout << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"engine\": \"" << engineName(r.engine)
+					  << "\", \"min_ns\": " << r.min << ", \"median_ns\": " << r.median << ", \"mean_ns\": " << r.mean
+					  << ", \"stddev_ns\": " << r.stddev << ", \"net_ns\": " << r.net << "}";
+		}
+		std::cout << "\n  ]\n}\n";
+	}
+	else
+	{
+		std::cout << "name,engine,instructions,repetitions,min_ns,median_ns,mean_ns,stddev_ns,net_ns\n";
+		for (const Result &r : results)
+		{
+			std::cout << r.name << "," << engineName(r.engine) << "," << options.instructions << "," << options.repetitions << ","
+					  << r.min << "," << r.median << "," << r.mean << "," << r.stddev << "," << r.net << "\n";
+		}
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,45 @@
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "RomCorpus.h"
+
+// Corpus tool: packs ROM files into one RomCorpus for chip8-batch
+// --corpus, or lists the ROMs of a corpus.
+
+static void printUsage(char const *program)
+{
+	std::cerr << "Usage: " << program << " <corpus> <rom>...\n";
+	std::cerr << "       " << program << " --list <corpus>\n";
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (std::string(argv[1]) == "--list")
+	{
+		RomCorpus corpus;
+		if (!corpus.open(argv[2]))
+		{
+			return EXIT_FAILURE;
+		}
+		for (size_t i = 0; i < corpus.getRomCount(); ++i)
+		{
+			std::cout << corpus.getName(i) << " " << corpus.getRom(i).size << "\n";
+		}
+		return EXIT_SUCCESS;
+	}
+
+	std::vector<std::string> romPaths(argv + 2, argv + argc);
+	if (!RomCorpus::write(argv[1], romPaths))
+	{
+		return EXIT_FAILURE;
+	}
+	std::cout << "Packed " << romPaths.size() << " ROMs into " << argv[1] << "\n";
+	return EXIT_SUCCESS;
+}
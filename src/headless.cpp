@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <chrono>
+#include "Chip8.h"
+#include "Movie.h"
+#include "Chip8Profile.h"
+#include "Chip8Trace.h"
+
+// Headless runner: drives the Chip8 core without SDL (no window, renderer or audio)
+// and reports the emulated throughput. Useful to measure the core on machines
+// without a display and to compare builds against each other.
+
+static void printUsage(char const *program)
+{
+	std::cerr << "Usage: " << program << " <ROM> [--cycles N | --frames N] [--cycles-per-frame N] [--engine interpreter|jit|threaded|aot] [--quirks default|chip8|schip|xochip] [--seed N] [--movie FILE] [--profile PREFIX] [--trace FILE [--trace-trigger ADDR]] [--no-idle-skip]\n";
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	char const *romPath = argv[1];
+
+	// Defaults match the Makefile "run" target
+	unsigned long long frames = 600;
+	unsigned long long cycles = 0;
+	int cyclesPerFrame = 10;
+	Engine engine = Engine::Interpreter;
+	// By ROM extension unless --quirks is given
+	QuirkProfile quirks = quirkProfileForRom(romPath);
+	uint64_t seed = 0;
+	char const *moviePath = nullptr;
+	std::string profilePrefix;
+	std::string tracePath;
+	int traceTrigger = -1;
+	bool lengthGiven = false;
+	bool idleSkip = true;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--no-idle-skip")
+		{
+			idleSkip = false;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		if (arg == "--cycles")
+		{
+			cycles = std::stoull(argv[++i]);
+			frames = 0;
+			lengthGiven = true;
+		}
+		else if (arg == "--frames")
+		{
+			frames = std::stoull(argv[++i]);
+			cycles = 0;
+			lengthGiven = true;
+		}
+		else if (arg == "--cycles-per-frame")
+		{
+			cyclesPerFrame = std::stoi(argv[++i]);
+		}
+		else if (arg == "--seed")
+		{
+			seed = std::stoull(argv[++i]);
+		}
+		else if (arg == "--movie")
+		{
+			moviePath = argv[++i];
+		}
+		else if (arg == "--profile")
+		{
+			profilePrefix = argv[++i];
+		}
+		else if (arg == "--trace")
+		{
+			tracePath = argv[++i];
+		}
+		else if (arg == "--trace-trigger")
+		{
+			// 0x2a4 or 676
+			traceTrigger = std::stoi(argv[++i], nullptr, 0);
+		}
+		else if (arg == "--quirks")
+		{
+			if (!quirkProfileFromName(argv[++i], quirks))
+			{
+				printUsage(argv[0]);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (arg == "--engine")
+		{
+			if (!engineFromName(argv[++i], engine))
+			{
+				printUsage(argv[0]);
+				return EXIT_FAILURE;
+			}
+		}
+		else
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	// Initialize Chip-8 system
+	Chip8 chip8;
+	chip8.loadROM(romPath);
+	chip8.setQuirkProfile(quirks);
+	chip8.setIdleSkip(idleSkip);
+	if (!chip8.setEngine(engine))
+	{
+		return EXIT_FAILURE;
+	}
+
+	if (!profilePrefix.empty() && !chip8.getProfile())
+	{
+		std::cerr << "Built without CHIP8_PROFILE, use make profile\n";
+		return EXIT_FAILURE;
+	}
+	if ((!tracePath.empty() || traceTrigger >= 0) && !chip8.getTrace())
+	{
+		std::cerr << "Built without CHIP8_TRACE, use make trace\n";
+		return EXIT_FAILURE;
+	}
+	if (traceTrigger >= 0)
+	{
+		if (tracePath.empty())
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		chip8.getTrace()->setTrigger(static_cast<uint16_t>(traceTrigger), tracePath);
+	}
+
+	chip8.setCpuFrequency(cyclesPerFrame * TIMER_FREQUENCY);
+	chip8.setSeed(seed);
+
+	// A movie replays its inputs with its own seed, CPU frequency and
+	// quirk profile, by default for as many frames as it was recorded
+	Movie movie;
+	if (moviePath)
+	{
+		if (!movie.load(moviePath))
+		{
+			return EXIT_FAILURE;
+		}
+		if (movie.getRomHash() != chip8.getRomHash())
+		{
+			std::cerr << "Movie was recorded with another ROM: " << moviePath << "\n";
+			return EXIT_FAILURE;
+		}
+		chip8.setCpuFrequency(movie.getCpuFrequency());
+		chip8.setSeed(movie.getSeed());
+		chip8.setQuirkProfile(movie.getQuirkProfile());
+		if (!lengthGiven)
+		{
+			frames = movie.getFrameCount();
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	if (frames > 0)
+	{
+		// Whole 60 Hz frames, like the SDL front end
+		for (unsigned long long frame = 0; frame < frames; ++frame)
+		{
+			if (moviePath)
+			{
+				chip8.setKeys(movie.getKeys(frame));
+			}
+			chip8.runFrame();
+		}
+	}
+	else
+	{
+		// Inputs change on timer events, so with a movie run up to each one
+		const unsigned long long chunk = 1u << 20;
+		for (unsigned long long done = 0; done < cycles;)
+		{
+			unsigned long long slice = std::min(chunk, cycles - done);
+			if (moviePath)
+			{
+				chip8.setKeys(movie.getKeys(chip8.getFrameCount()));
+				slice = std::min<unsigned long long>(slice, chip8.getCyclesUntilTimer());
+			}
+			chip8.run(static_cast<unsigned int>(slice));
+			done += slice;
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	cycles = chip8.getCycleCount();
+	// Skipped idle loop passes take no time, the rates only count the
+	// instructions that ran
+	const unsigned long long executed = cycles - chip8.getIdleCycleCount();
+
+	double elapsedNs = std::chrono::duration<double, std::nano>(end - start).count();
+	double nsPerInstruction = executed ? elapsedNs / executed : 0.0;
+	double instructionsPerSecond = elapsedNs > 0 ? executed * 1e9 / elapsedNs : 0.0;
+
+	std::cout << "Instructions: " << cycles << "\n";
+	std::cout << "Executed instructions: " << executed << "\n";
+	std::cout << "Elapsed ms: " << std::fixed << std::setprecision(3) << elapsedNs / 1e6 << "\n";
+	std::cout << "Instructions/s: " << std::setprecision(0) << instructionsPerSecond << "\n";
+	std::cout << "ns/instruction: " << std::setprecision(3) << nsPerInstruction << "\n";
+	std::cout << "Idle instructions skipped: " << chip8.getIdleCycleCount() << "\n";
+	std::cout << "Framebuffer hash: " << std::hex << std::setw(16) << std::setfill('0') << chip8.videoHash() << std::dec << "\n";
+
+	if (!profilePrefix.empty())
+	{
+		// <prefix>.csv, <prefix>.json and the top 10 on stdout
+		const Chip8Profile &profile = *chip8.getProfile();
+		std::ofstream csv(profilePrefix + ".csv");
+		profile.writeCsv(csv);
+		std::ofstream json(profilePrefix + ".json");
+		profile.writeJson(json);
+		if (!csv || !json)
+		{
+			std::cerr << "Failed to write profile: " << profilePrefix << "\n";
+			return EXIT_FAILURE;
+		}
+		std::cout << std::setfill(' ') << "\n";
+		profile.writeReport(std::cout, 10);
+	}
+
+	// With a trigger the file was written when the PC reached it,
+	// otherwise it holds the end of the run
+	if (traceTrigger >= 0)
+	{
+		if (!chip8.getTrace()->isTriggered())
+		{
+			std::cerr << "Trace trigger not reached: " << std::hex << traceTrigger << std::dec << "\n";
+			return EXIT_FAILURE;
+		}
+	}
+	else if (!tracePath.empty() && !chip8.getTrace()->save(tracePath.c_str()))
+	{
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
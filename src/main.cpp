@@ -1,15 +1,57 @@
 #include <stdlib.h>
 #include <iostream>
 #include <array>
+#include <string>
+#include <random>
+#include <atomic>
+#include <vector>
+#include <thread>
 #include <SDL.h>
 #include "Chip8.h"
+#include "FramePacer.h"
+#include "Rewind.h"
+#include "Movie.h"
+#include "SpscRing.h"
+#include "TripleBuffer.h"
 
+// Square wave pitch of the buzzer
+const double BUZZER_FREQUENCY = 180.0;
+// Largest speed change dynamic rate control makes, as a fraction
+const double MAX_RATE_ADJUST = 0.005;
+
+const char *const WINDOW_TITLE = "CHIP8 EMULATOR";
+// Emulated frames per frame while fast-forwarding (Tab held)
+const unsigned int DEFAULT_TURBO_SPEED = 8;
+// How often the emulated speed in the window title is updated, in ms
+const Uint32 SPEED_DISPLAY_INTERVAL_MS = 500;
+
+// Rewind history, a frame usually takes well under 200 bytes
+const size_t REWIND_BYTES = 16 << 20;
+
+// Buzzer edge on the emulated audio clock, in samples
+struct AudioEvent
+{
+	uint64_t sample;
+	bool on;
+};
+
+// Shared by the main thread (producer) and the SDL audio thread.
+// The main thread turns buzzer edges into AudioEvents and publishes how
+// many samples of emulated time exist; the audio thread plays them back
+// at the emulated sample they belong to, without locks.
 struct AudioState
 {
-	double sampleIndex = 0.0;
-	double freq = 180.0;
-	int sampleRate = 44100;
-	bool play = false;
+	SpscRing<AudioEvent, 1024> events;
+	std::atomic<uint64_t> producedSamples{0};
+	std::atomic<uint64_t> playedSamples{0};
+	std::atomic<unsigned int> underruns{0};
+	// Set before the device starts
+	uint64_t targetLag{};
+	uint64_t maxLag{};
+	uint32_t phaseStep{};
+	// Audio thread only
+	bool on = false;
+	uint32_t phase = 0;
 };
 
 // SDL calls this function when it needs more audio samples
@@ -20,24 +62,267 @@ void audioCallback(void *userdata, Uint8 *streamToFill, int amountSamplesToFill)
 	// format = AUDIO_F32   → float (4 bytes)
 	float *buffer = (float *)streamToFill;
 	int amountFloatSamples = amountSamplesToFill / sizeof(float);
+
+	uint64_t played = state->playedSamples.load(std::memory_order_relaxed);
+	uint64_t produced = state->producedSamples.load(std::memory_order_acquire);
+	// Fell far behind (window dragged, host hiccup): catch up
+	if (produced > played + state->maxLag)
+	{
+		played = produced - state->targetLag;
+	}
+	bool starved = false;
 	for (int i = 0; i < amountFloatSamples; i++)
 	{
+		if (played < produced)
+		{
+			// Apply the edges due at this sample
+			while (const AudioEvent *event = state->events.peek())
+			{
+				if (event->sample > played)
+				{
+					break;
+				}
+				state->on = event->on;
+				state->events.pop();
+			}
+			++played;
+		}
+		else
+		{
+			// Emulation is late, hold the emulated clock
+			starved = true;
+		}
+		// Square wave from the top bit of the phase accumulator
 		float sample = 0.0f;
-		if (state->play)
+		if (state->on)
 		{
-			double time = state->sampleIndex / state->sampleRate;
-			sample = (fmod(time * state->freq, 1.0) < 0.5) ? 0.5f : -0.5f;
+			sample = (state->phase & 0x80000000u) ? -0.5f : 0.5f;
 		}
+		state->phase += state->phaseStep;
 		buffer[i] = sample;
-		state->sampleIndex += 1.0;
+	}
+	if (starved)
+	{
+		state->underruns.fetch_add(1, std::memory_order_relaxed);
+	}
+	state->playedSamples.store(played, std::memory_order_release);
+}
+
+// Keyboard key of each CHIP-8 key
+const SDL_Scancode KEYMAP[KEY_COUNT] = {
+	SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, SDL_SCANCODE_4,
+	SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_R,
+	SDL_SCANCODE_A, SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_F,
+	SDL_SCANCODE_Z, SDL_SCANCODE_X, SDL_SCANCODE_C, SDL_SCANCODE_V};
+
+// A finished display, copied out of the Chip8 by the emulation thread
+struct VideoFrame
+{
+	uint64_t planes[VIDEO_PLANES][VIDEO_WORDS];
+	bool hires;
+};
+
+// The emulation thread owns the Chip8 and everything that runs with it,
+// the main thread only polls input and presents. Frames go out through a
+// triple buffer, input and commands come in through atomics, so neither
+// thread ever waits for the other
+struct Emulation
+{
+	Chip8 chip8;
+	RewindBuffer rewind{REWIND_BYTES};
+	Movie movie;
+	char const *recordPath{};
+	char const *playPath{};
+	std::string statePath;
+	// Paces emulated frames, never presents
+	FramePacer *pacer{};
+	// nullptr without an audio device
+	AudioState *audio{};
+	int sampleRate{};
+
+	// Main thread to emulation thread
+	std::atomic<uint16_t> keys{0};
+	std::atomic<bool> rewinding{false};
+	// Emulated frames per paced frame, 0 for as many as fit
+	std::atomic<unsigned int> speed{1};
+	std::atomic<bool> saveRequested{false};
+	std::atomic<bool> loadRequested{false};
+	std::atomic<bool> quit{false};
+
+	// Emulation thread to main thread, frameEvent (an SDL user event)
+	// wakes the main thread, at most one is queued at a time
+	TripleBuffer<VideoFrame> frames;
+	Uint32 frameEvent{};
+	std::atomic<bool> frameEventQueued{false};
+	// Frames run or rewound so far, for the speed shown in the title
+	std::atomic<uint64_t> emulatedFrames{0};
+};
+
+static void emulationLoop(Emulation &emu)
+{
+	Chip8 &chip8 = emu.chip8;
+	AudioState *audio = emu.audio;
+
+	// Buzzer edges, at the cycle of the Fx18 or timer tick behind each
+	std::vector<BuzzerEvent> buzzerEvents;
+	if (audio)
+	{
+		chip8.setBuzzerEvents(true);
+	}
+	// Emulated cycles played so far, they never go back on rewind
+	uint64_t audioCycles = 0;
+	// Emulated buzzer, and what the audio thread was last told
+	bool buzzerOn = false;
+	bool audioOn = false;
+	double audioFill = 0;
+	const uint64_t frameCycles = chip8.getCpuFrequency() / TIMER_FREQUENCY;
+	auto cyclesToSamples = [&](uint64_t cycles)
+	{
+		return cycles * emu.sampleRate / chip8.getCpuFrequency();
+	};
+	auto setAudio = [&](bool on, uint64_t cycle)
+	{
+		if (on != audioOn && audio)
+		{
+			audio->events.push({cyclesToSamples(cycle), on});
+		}
+		audioOn = on;
+	};
+
+	// The last frame ended in an idle loop (waiting for a key or the
+	// delay timer), the next one can start a little late
+	bool idle = false;
+	emu.rewind.push(chip8);
+	while (!emu.quit.load(std::memory_order_relaxed))
+	{
+		// Time control
+		// Sleep/spin until the frame is due, only sleep while idle
+		emu.pacer->waitForNextFrame(!idle);
+
+		if (emu.saveRequested.exchange(false))
+		{
+			chip8.saveState(emu.statePath.c_str());
+		}
+		// A loaded state is not part of the movie
+		if (emu.loadRequested.exchange(false) && !emu.playPath && !emu.recordPath)
+		{
+			chip8.loadState(emu.statePath.c_str());
+		}
+		chip8.setKeys(emu.keys.load(std::memory_order_relaxed));
+		unsigned int speed = emu.speed.load(std::memory_order_relaxed);
+		bool rewinding = emu.rewinding.load(std::memory_order_relaxed);
+		bool turbo = speed != 1 && !rewinding;
+
+		// Dynamic rate control: the audio queued at the start of a frame
+		// should stay at targetLag, run slower when there is more and
+		// faster when there is less, by at most MAX_RATE_ADJUST
+		if (audio && !turbo)
+		{
+			uint64_t produced = audio->producedSamples.load(std::memory_order_relaxed);
+			uint64_t played = audio->playedSamples.load(std::memory_order_acquire);
+			double fill = produced > played ? static_cast<double>(produced - played) : 0.0;
+			audioFill += (fill - audioFill) / 16;
+			double error = (audioFill - audio->targetLag) / audio->targetLag;
+			emu.pacer->setRateScale(1.0 + MAX_RATE_ADJUST * std::max(-1.0, std::min(1.0, error)));
+		}
+		else
+		{
+			emu.pacer->setRateScale(1.0);
+		}
+
+		// One 60 Hz frame of emulated time, or one frame back.
+		// Fast-forward runs speed frames back to back instead, or with
+		// speed 0 as many as fit until the next frame is due
+		bool dirty = false;
+		if (rewinding)
+		{
+			emu.rewind.rewind(chip8);
+			// The restored buzzer state, from the start of the frame
+			buzzerOn = chip8.R_BUZZER_TIMER > 0;
+			setAudio(buzzerOn, audioCycles);
+			audioCycles += frameCycles;
+			dirty = chip8.takeDirtyRows() != 0;
+			emu.emulatedFrames.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			// Resumed from fast-forward with the buzzer on
+			if (!turbo)
+			{
+				setAudio(buzzerOn, audioCycles);
+			}
+			unsigned int frames = 0;
+			do
+			{
+				uint64_t frameStartCycle = chip8.getCycleCount();
+				// Rewound frames are recorded again
+				uint64_t frame = chip8.getFrameCount();
+				if (emu.playPath && frame < emu.movie.getFrameCount())
+				{
+					chip8.setKeys(emu.movie.getKeys(frame));
+				}
+				else if (emu.recordPath)
+				{
+					emu.movie.record(frame, chip8.getKeys());
+				}
+				chip8.runFrame();
+				emu.rewind.push(chip8);
+
+				buzzerEvents.clear();
+				chip8.takeBuzzerEvents(buzzerEvents);
+				for (const BuzzerEvent &event : buzzerEvents)
+				{
+					buzzerOn = event.on;
+					if (!turbo)
+					{
+						setAudio(buzzerOn, audioCycles + event.cycle - frameStartCycle);
+					}
+				}
+				if (!turbo)
+				{
+					audioCycles += chip8.getCycleCount() - frameStartCycle;
+				}
+				dirty |= chip8.takeDirtyRows() != 0;
+				emu.emulatedFrames.fetch_add(1, std::memory_order_relaxed);
+				++frames;
+			} while (speed == 0 ? !emu.pacer->isFrameDue() : frames < speed);
+		}
+		idle = !turbo && !rewinding && chip8.isIdle();
+		if (turbo)
+		{
+			// Muted, the audio clock follows host time, one frame per frame
+			setAudio(false, audioCycles);
+			audioCycles += frameCycles;
+		}
+		if (audio)
+		{
+			// Everything up to here may be played
+			audio->producedSamples.store(cyclesToSamples(audioCycles), std::memory_order_release);
+		}
+
+		// Publish only frames that changed something on screen, in
+		// fast-forward only the last one of the frames run back to back
+		if (dirty)
+		{
+			VideoFrame &frame = emu.frames.writeBuffer();
+			std::memcpy(frame.planes, chip8.videoMemory, sizeof(VideoFrame::planes));
+			frame.hires = chip8.isHires();
+			emu.frames.publish();
+			if (!emu.frameEventQueued.exchange(true))
+			{
+				SDL_Event event{};
+				event.type = emu.frameEvent;
+				SDL_PushEvent(&event);
+			}
+		}
 	}
 }
 
 int main(int argc, char **argv)
 {
-	if (argc != 5)
+	if (argc < 5)
 	{
-		std::cerr << "Usage: " << argv[0] << "<CyclesPerFrame> <frameDurationTargetMs> <Scale> <ROM>\n";
+		std::cerr << "Usage: " << argv[0] << "<CyclesPerFrame> <frameDurationTargetMs> <Scale> <ROM> [--engine interpreter|jit|threaded] [--quirks default|chip8|schip|xochip] [--vsync] [--seed N] [--record FILE | --play FILE] [--turbo N]\n";
 		return EXIT_FAILURE;
 	}
 	int cyclesPerFrame = std::stoi(argv[1]);
@@ -45,6 +330,54 @@ int main(int argc, char **argv)
 	int videoScale = std::stoi(argv[3]);
 	char const *romPath = argv[4];
 
+	// Optional arguments
+	Engine engine = Engine::Interpreter;
+	// By ROM extension unless --quirks is given
+	QuirkProfile quirks = quirkProfileForRom(romPath);
+	bool vsync = false;
+	// A new game every start unless --seed is given
+	uint64_t seed = (static_cast<uint64_t>(std::random_device{}()) << 32) | std::random_device{}();
+	char const *recordPath = nullptr;
+	char const *playPath = nullptr;
+	unsigned int turboSpeed = DEFAULT_TURBO_SPEED;
+	for (int i = 5; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--engine" && i + 1 < argc && engineFromName(argv[i + 1], engine))
+		{
+			++i;
+		}
+		else if (arg == "--quirks" && i + 1 < argc && quirkProfileFromName(argv[i + 1], quirks))
+		{
+			++i;
+		}
+		else if (arg == "--seed" && i + 1 < argc)
+		{
+			seed = std::stoull(argv[++i]);
+		}
+		else if (arg == "--record" && i + 1 < argc)
+		{
+			recordPath = argv[++i];
+		}
+		else if (arg == "--play" && i + 1 < argc)
+		{
+			playPath = argv[++i];
+		}
+		else if (arg == "--turbo" && i + 1 < argc)
+		{
+			turboSpeed = std::stoul(argv[++i]);
+		}
+		else if (arg == "--vsync")
+		{
+			vsync = true;
+		}
+		else
+		{
+			std::cerr << "Unknown argument: " << arg << "\n";
+			return EXIT_FAILURE;
+		}
+	}
+
 	// uint32_t videoMemory[VIDEO_WIDTH * VIDEO_HEIGHT]{};
 	SDL_Window *sdlWindow{};
 	SDL_Renderer *sdlRenderer{};
@@ -63,7 +396,7 @@ int main(int argc, char **argv)
 
 	// Create SDL Window
 	sdlWindow = SDL_CreateWindow(
-		"CHIP8 EMULATOR",
+		WINDOW_TITLE,
 		SDL_WINDOWPOS_CENTERED,
 		SDL_WINDOWPOS_CENTERED,
 		WINDOW_W,
@@ -78,19 +411,28 @@ int main(int argc, char **argv)
 	}
 
 	// Initialize SDL Renderer
-	sdlRenderer = SDL_CreateRenderer(sdlWindow, -1, SDL_RENDERER_ACCELERATED);
+	// With vsync only the main thread waits for the display
+	Uint32 rendererFlags = SDL_RENDERER_ACCELERATED;
+	if (vsync)
+	{
+		rendererFlags |= SDL_RENDERER_PRESENTVSYNC;
+	}
+	sdlRenderer = SDL_CreateRenderer(sdlWindow, -1, rendererFlags);
 
 	// Initialize SDL Texture
+	// Always hi-res, lo-res frames are expanded with doubled pixels
 	sdlTexture = SDL_CreateTexture(
-		sdlRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, VIDEO_WIDTH, VIDEO_HEIGHT);
+		sdlRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, HIRES_WIDTH, HIRES_HEIGHT);
 
 	// Audio
+	// Small device buffer for low latency, dynamic rate control
+	// keeps it from running dry
 	AudioState audio;
 	SDL_AudioSpec want{}, have{};
-	want.freq = audio.sampleRate;
+	want.freq = 44100;
 	want.format = AUDIO_F32; // float 32 format
 	want.channels = 1;		 // mono
-	want.samples = 1024;
+	want.samples = 512;
 	want.callback = audioCallback;
 	want.userdata = &audio;
 	SDL_AudioDeviceID audioDev =
@@ -101,6 +443,11 @@ int main(int argc, char **argv)
 	}
 	else
 	{
+		// Keep two device buffers of emulated audio queued when a frame
+		// starts, give up on the backlog past four frames more than that
+		audio.targetLag = 2 * have.samples;
+		audio.maxLag = audio.targetLag + 4 * have.freq / TIMER_FREQUENCY;
+		audio.phaseStep = static_cast<uint32_t>(BUZZER_FREQUENCY * 4294967296.0 / have.freq);
 		SDL_PauseAudioDevice(audioDev, 0);
 	}
 
@@ -109,43 +456,108 @@ int main(int argc, char **argv)
 
 	// Application state
 	bool quit = false;
+	// F2 toggles fast-forward without a speed limit
+	bool unbounded = false;
+	// Present even if the display did not change
+	bool redraw = true;
 
 	// Timing
-	float lastFrameTimeMs = 0;
+	FramePacer pacer(frameDurationTargetMs);
 
 	// Initialize Chip-8 system
-	Chip8 chip8;
+	// Emulation is large (decode cache, rewind state), keep it off the stack
+	auto emu = std::make_unique<Emulation>();
+	Chip8 &chip8 = emu->chip8;
 	chip8.loadROM(romPath);
+	chip8.setEngine(engine);
+	chip8.setQuirkProfile(quirks);
+	chip8.setCpuFrequency(cyclesPerFrame * TIMER_FREQUENCY);
+	chip8.setSeed(seed);
 
-	// Main loop
-	while (!quit)
+	// Input movie: --play replays one with its own seed, CPU speed and quirks,
+	// the keyboard takes over when it ends. --record writes one on exit
+	if (playPath)
 	{
-		// Time control
-		Uint32 nowMs = SDL_GetTicks();
-		float deltaTimeMs = (nowMs - lastFrameTimeMs);
-		// Wait to meet cycle delay
-		if (deltaTimeMs < frameDurationTargetMs)
+		if (!emu->movie.load(playPath))
 		{
-			continue;
+			return EXIT_FAILURE;
 		}
-		lastFrameTimeMs = nowMs;
+		if (emu->movie.getRomHash() != chip8.getRomHash())
+		{
+			std::cerr << "Movie was recorded with another ROM: " << playPath << "\n";
+			return EXIT_FAILURE;
+		}
+		chip8.setCpuFrequency(emu->movie.getCpuFrequency());
+		chip8.setSeed(emu->movie.getSeed());
+		chip8.setQuirkProfile(emu->movie.getQuirkProfile());
+	}
+	else if (recordPath)
+	{
+		emu->movie = Movie(chip8.getRomHash(), seed, chip8.getCpuFrequency(), chip8.getQuirkProfile());
+	}
+	emu->recordPath = recordPath;
+	emu->playPath = playPath;
+
+	// Backspace (held) rewinds, F5/F9 save/load <ROM>.state
+	emu->statePath = std::string(romPath) + ".state";
+	emu->pacer = &pacer;
+	emu->audio = audioDev ? &audio : nullptr;
+	emu->sampleRate = have.freq;
+	emu->frameEvent = SDL_RegisterEvents(1);
+
+	std::thread emulationThread(emulationLoop, std::ref(*emu));
+
+	// Emulated frame count at speedTicks
+	Uint32 speedTicks = SDL_GetTicks();
+	uint64_t speedFrames = 0;
+	bool titleShowsSpeed = false;
+
+	// Rows currently in the texture
+	VideoFrame shown{};
+	unsigned int presentCount = 0;
 
-		// Poll events from queue
+	// Main loop: input and presenting, emulation runs on its own thread
+	while (!quit)
+	{
+		// Sleep until there is input or a new frame
 		SDL_Event e;
-		while (SDL_PollEvent(&e))
+		bool hasEvent = SDL_WaitEventTimeout(&e, 100);
+		while (hasEvent)
 		{
 			if (e.type == SDL_QUIT)
 			{
 				quit = true;
 			}
+			if (e.type == emu->frameEvent)
+			{
+				emu->frameEventQueued.store(false);
+			}
 			if (e.type == SDL_KEYDOWN)
 			{
 				keyDown[e.key.keysym.scancode] = true;
+				if (e.key.keysym.scancode == SDL_SCANCODE_F5 && !e.key.repeat)
+				{
+					emu->saveRequested.store(true);
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_F9 && !e.key.repeat)
+				{
+					emu->loadRequested.store(true);
+				}
+				if (e.key.keysym.scancode == SDL_SCANCODE_F2 && !e.key.repeat)
+				{
+					unbounded = !unbounded;
+				}
 			}
 			if (e.type == SDL_KEYUP)
 			{
 				keyDown[e.key.keysym.scancode] = false;
 			}
+			if (e.type == SDL_WINDOWEVENT)
+			{
+				// Resized/exposed, the window needs the frame again
+				redraw = true;
+			}
+			hasEvent = SDL_PollEvent(&e);
 		}
 
 		// Process input
@@ -153,45 +565,91 @@ int main(int argc, char **argv)
 		{
 			quit = true;
 		}
-		// Map keyboard state to Chip-8 memory
-		chip8.keypadMemory[0x0] = keyDown[SDL_SCANCODE_1];
-		chip8.keypadMemory[0x1] = keyDown[SDL_SCANCODE_2];
-		chip8.keypadMemory[0x2] = keyDown[SDL_SCANCODE_3];
-		chip8.keypadMemory[0x3] = keyDown[SDL_SCANCODE_4];
-		chip8.keypadMemory[0x4] = keyDown[SDL_SCANCODE_Q];
-		chip8.keypadMemory[0x5] = keyDown[SDL_SCANCODE_W];
-		chip8.keypadMemory[0x6] = keyDown[SDL_SCANCODE_E];
-		chip8.keypadMemory[0x7] = keyDown[SDL_SCANCODE_R];
-		chip8.keypadMemory[0x8] = keyDown[SDL_SCANCODE_A];
-		chip8.keypadMemory[0x9] = keyDown[SDL_SCANCODE_S];
-		chip8.keypadMemory[0xA] = keyDown[SDL_SCANCODE_D];
-		chip8.keypadMemory[0xB] = keyDown[SDL_SCANCODE_F];
-		chip8.keypadMemory[0xC] = keyDown[SDL_SCANCODE_Z];
-		chip8.keypadMemory[0xD] = keyDown[SDL_SCANCODE_X];
-		chip8.keypadMemory[0xE] = keyDown[SDL_SCANCODE_C];
-		chip8.keypadMemory[0xF] = keyDown[SDL_SCANCODE_V];
-
-		// Update object color based on frame time
-		// for(unsigned int y = 0; y < VIDEO_HEIGHT; ++y) {
-		// 	for(unsigned int x = 0; x < VIDEO_WIDTH; ++x) {
-		// 		uint32_t *pixelAddr = &videoMemory[y * VIDEO_WIDTH + x];
-		// 		*pixelAddr = ((x ^ y) & 0x1) ? 0xFFFFFFFF : 0xFF000000;
-		// 	}
-		// }
-
-		for (unsigned int cycle = 0; cycle < cyclesPerFrame; ++cycle)
-		{
-			chip8.tick();
-		}
-
-		// Update audio state
-		audio.play = (chip8.R_BUZZER_TIMER > 0);
-
-		// Copy video memory to texture
-		int rowSizeBytes = sizeof(uint32_t) * VIDEO_WIDTH;
-		// void const* framebuffer = videoMemory;
-		void const *framebuffer = chip8.videoMemory;
-		SDL_UpdateTexture(sdlTexture, nullptr, framebuffer, rowSizeBytes);
+		// Map keyboard state to the Chip-8 keypad
+		uint16_t keys = 0;
+		for (unsigned int key = 0; key < KEY_COUNT; ++key)
+		{
+			keys |= (keyDown[KEYMAP[key]] ? 1u : 0u) << key;
+		}
+		emu->keys.store(keys, std::memory_order_relaxed);
+		emu->rewinding.store(keyDown[SDL_SCANCODE_BACKSPACE], std::memory_order_relaxed);
+		// Tab (held) fast-forwards
+		unsigned int speed = unbounded ? 0 : keyDown[SDL_SCANCODE_TAB] ? turboSpeed : 1;
+		emu->speed.store(speed, std::memory_order_relaxed);
+
+		// Emulated speed as a multiple of real time, in the title while
+		// fast-forwarding
+		Uint32 ticks = SDL_GetTicks();
+		if (ticks - speedTicks >= SPEED_DISPLAY_INTERVAL_MS)
+		{
+			uint64_t frames = emu->emulatedFrames.load(std::memory_order_relaxed);
+			double multiplier = (frames - speedFrames) * 1000.0 / (ticks - speedTicks) / TIMER_FREQUENCY;
+			speedTicks = ticks;
+			speedFrames = frames;
+			if (speed != 1)
+			{
+				char title[64];
+				snprintf(title, sizeof(title), "%s - %.1fx", WINDOW_TITLE, multiplier);
+				SDL_SetWindowTitle(sdlWindow, title);
+				titleShowsSpeed = true;
+			}
+			else if (titleShowsSpeed)
+			{
+				SDL_SetWindowTitle(sdlWindow, WINDOW_TITLE);
+				titleShowsSpeed = false;
+			}
+		}
+
+		// Expand the newest frame straight into the texture, only the
+		// rows that differ from the texture, one lock per run of them
+		uint64_t dirtyRows = 0;
+		if (emu->frames.update())
+		{
+			const VideoFrame &frame = emu->frames.readBuffer();
+			const unsigned int words = (frame.hires ? HIRES_WIDTH : VIDEO_WIDTH) / 64;
+			for (unsigned int word = 0; word < VIDEO_WORDS; ++word)
+			{
+				for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+				{
+					if (frame.planes[plane][word] != shown.planes[plane][word] || frame.hires != shown.hires)
+					{
+						dirtyRows |= 1ull << (word / words % 64);
+					}
+				}
+			}
+			shown = frame;
+		}
+		const unsigned int rowCount = shown.hires ? HIRES_HEIGHT : VIDEO_HEIGHT;
+		const unsigned int rowScale = HIRES_HEIGHT / rowCount;
+		for (unsigned int row = 0; row < rowCount;)
+		{
+			if (!(dirtyRows & (1ull << row)))
+			{
+				++row;
+				continue;
+			}
+			unsigned int firstRow = row;
+			while (row < rowCount && (dirtyRows & (1ull << row)))
+			{
+				++row;
+			}
+			SDL_Rect rect{0, static_cast<int>(firstRow * rowScale), HIRES_WIDTH, static_cast<int>((row - firstRow) * rowScale)};
+			void *texturePixels;
+			int texturePitch;
+			if (SDL_LockTexture(sdlTexture, &rect, &texturePixels, &texturePitch) == 0)
+			{
+				Chip8::expandRows(shown.planes, shown.hires, firstRow, row - firstRow, static_cast<uint32_t *>(texturePixels), texturePitch / sizeof(uint32_t));
+				SDL_UnlockTexture(sdlTexture);
+			}
+		}
+
+		// Nothing changed on screen, keep the last presented frame
+		if (!dirtyRows && !redraw)
+		{
+			continue;
+		}
+		redraw = false;
+
 		// Clear renderer
 		SDL_RenderClear(sdlRenderer);
 		// Copy texture to renderer
@@ -199,6 +657,21 @@ int main(int argc, char **argv)
 		SDL_RenderCopy(sdlRenderer, sdlTexture, nullptr, nullptr);
 		// Present renderer
 		SDL_RenderPresent(sdlRenderer);
+		++presentCount;
+	}
+
+	emu->quit.store(true);
+	emulationThread.join();
+
+	pacer.printStats(std::cout);
+	std::cout << "Presents: " << presentCount << "\n";
+	if (audioDev)
+	{
+		std::cout << "Audio underruns: " << audio.underruns.load() << "\n";
+	}
+	if (recordPath)
+	{
+		emu->movie.save(recordPath);
 	}
 
 	// Cleanup audio
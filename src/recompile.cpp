@@ -0,0 +1,431 @@
+#include <stdlib.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+#include "Chip8Opcodes.h"
+#include "Chip8Quirks.h"
+#include "Chip8Trace.h"
+
+// Ahead-of-time recompiler: walks the code of ROMs from ROM_START_ADDRESS
+// through 1nnn, 2nnn (target and return address), skips and fall through,
+// and writes one C++ translation unit for Chip8Aot with one function per
+// basic block. Operands are constants in the generated code, so the C++
+// compiler folds away all decoding and dispatch inside a block.
+// Register, ALU, I, timer, jump, call, return and skip opcodes are
+// translated; display, random, key wait and memory writes call the
+// interpreter (Chip8Aot::stepAt). A block ends at the first instruction
+// that can change PC or write memory (Fx33, Fx55).
+
+namespace
+{
+	struct Rom
+	{
+		std::string path;
+		QuirkProfile quirks;
+		std::vector<uint8_t> bytes;
+	};
+
+	struct Block
+	{
+		uint16_t address;
+		uint16_t length;
+	};
+
+	uint16_t opcodeAt(const Rom &rom, unsigned int address)
+	{
+		const unsigned int offset = address - ROM_START_ADDRESS;
+		return (rom.bytes[offset] << 8) | rom.bytes[offset + 1];
+	}
+
+	// Both bytes of the instruction come from the ROM
+	bool inRom(const Rom &rom, unsigned int address)
+	{
+		return address >= ROM_START_ADDRESS && address - ROM_START_ADDRESS + 1 < rom.bytes.size();
+	}
+
+	bool endsBlock(OpcodeKind kind)
+	{
+		switch (kind)
+		{
+		case K_00EE:
+		case K_00FD:
+		case K_1nnn:
+		case K_2nnn:
+		case K_Bnnn:
+		case K_3xkk:
+		case K_4xkk:
+		case K_5xy0:
+		case K_9xy0:
+		case K_Ex9E:
+		case K_ExA1:
+		case K_Fx0A:
+		case K_Fx33:
+		case K_Fx55:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// Addresses execution can continue at after the instruction, the
+	// ones known statically
+	std::vector<unsigned int> successors(uint16_t opcode, unsigned int address)
+	{
+		const unsigned int nnn = opcode & 0x0FFFu;
+		switch (classifyOpcode(opcode))
+		{
+		case K_00EE:
+		case K_00FD:
+		case K_Bnnn:
+			return {};
+		case K_1nnn:
+			return {nnn};
+		case K_2nnn:
+			return {nnn, address + 2};
+		case K_3xkk:
+		case K_4xkk:
+		case K_5xy0:
+		case K_9xy0:
+		case K_Ex9E:
+		case K_ExA1:
+			return {address + 2, address + 4};
+		default:
+			return {address + 2};
+		}
+	}
+
+	// Straight-line runs of the instructions reachable from the start
+	// address, each instruction in one block
+	std::vector<Block> findBlocks(const Rom &rom)
+	{
+		std::vector<bool> reachable(MEMORY_SIZE);
+		std::vector<unsigned int> work{ROM_START_ADDRESS};
+		while (!work.empty())
+		{
+			unsigned int address = work.back();
+			work.pop_back();
+			if (!inRom(rom, address) || reachable[address])
+			{
+				continue;
+			}
+			reachable[address] = true;
+			for (unsigned int next : successors(opcodeAt(rom, address), address))
+			{
+				work.push_back(next);
+			}
+		}
+
+		std::vector<Block> blocks;
+		std::vector<bool> covered(MEMORY_SIZE);
+		for (unsigned int start = 0; start < MEMORY_SIZE; ++start)
+		{
+			if (!reachable[start] || covered[start])
+			{
+				continue;
+			}
+			Block block{static_cast<uint16_t>(start), 0};
+			for (unsigned int address = start;; address += 2)
+			{
+				covered[address] = true;
+				++block.length;
+				const unsigned int next = address + 2;
+				if (endsBlock(classifyOpcode(opcodeAt(rom, address))) || next >= MEMORY_SIZE || !reachable[next] || covered[next])
+				{
+					break;
+				}
+			}
+			blocks.push_back(block);
+		}
+		return blocks;
+	}
+
+	std::string hex(unsigned int value, int digits)
+	{
+		std::ostringstream text;
+		text << "0x" << std::hex << std::uppercase << std::setw(digits) << std::setfill('0') << value;
+		return text.str();
+	}
+
+	// QuirkProfile enumerator, for the generated code
+	const char *enumeratorName(QuirkProfile profile)
+	{
+		switch (profile)
+		{
+		case QuirkProfile::Chip8:
+			return "Chip8";
+		case QuirkProfile::Schip:
+			return "Schip";
+		case QuirkProfile::XoChip:
+			return "XoChip";
+		default:
+			return "Default";
+		}
+	}
+
+	// "s.REG[0xA]"
+	std::string reg(unsigned int index)
+	{
+		return "s.REG[" + hex(index, 1) + "]";
+	}
+
+	// Statements of the instruction at address, mirroring the interpreter
+	// handler statement by statement so aliasing (x or y = F) matches.
+	// Instructions that end the block set R_PC (or step) and return
+	template <typename Quirks>
+	std::string translate(uint16_t opcode, unsigned int address)
+	{
+		const unsigned int x = (opcode & 0x0F00u) >> 8u;
+		const unsigned int y = (opcode & 0x00F0u) >> 4u;
+		const unsigned int kk = opcode & 0x00FFu;
+		const unsigned int nnn = opcode & 0x0FFFu;
+		const std::string Vx = reg(x);
+		const std::string Vy = reg(y);
+		const std::string next = hex(address + 2, 3);
+		const std::string skip = hex(address + 4, 3);
+		const std::string step = "Chip8Aot::stepAt(chip8, " + hex(address, 3) + ");";
+		switch (classifyOpcode(opcode))
+		{
+		case K_NOP:
+			return "";
+		case K_00EE:
+			return "--s.R_SP; s.R_PC = s.stackMemory[s.R_SP % STACK_LEVELS]; return;";
+		case K_1nnn:
+			return "s.R_PC = " + hex(nnn, 3) + "; return;";
+		case K_2nnn:
+			return "s.stackMemory[s.R_SP % STACK_LEVELS] = " + next + "; ++s.R_SP; s.R_PC = " + hex(nnn, 3) + "; return;";
+		case K_Bnnn:
+			return "s.R_PC = " + reg(Quirks::JUMP_USES_VX ? x : 0) + " + " + hex(nnn, 3) + "; return;";
+		case K_3xkk:
+			return "s.R_PC = " + Vx + " == " + hex(kk, 2) + " ? " + skip + " : " + next + "; return;";
+		case K_4xkk:
+			return "s.R_PC = " + Vx + " != " + hex(kk, 2) + " ? " + skip + " : " + next + "; return;";
+		case K_5xy0:
+			return "s.R_PC = " + Vx + " == " + Vy + " ? " + skip + " : " + next + "; return;";
+		case K_9xy0:
+			return "s.R_PC = " + Vx + " != " + Vy + " ? " + skip + " : " + next + "; return;";
+		case K_Ex9E:
+			return "s.R_PC = s.keypadMemory[" + Vx + " % KEY_COUNT] ? " + skip + " : " + next + "; return;";
+		case K_ExA1:
+			return "s.R_PC = !s.keypadMemory[" + Vx + " % KEY_COUNT] ? " + skip + " : " + next + "; return;";
+		case K_00FD:
+		case K_Fx0A:
+		case K_Fx33:
+		case K_Fx55:
+			return step + " return;";
+		case K_6xkk:
+			return Vx + " = " + hex(kk, 2) + ";";
+		case K_7xkk:
+			return Vx + " += " + hex(kk, 2) + ";";
+		case K_8xy0:
+			return Vx + " = " + Vy + ";";
+		case K_8xy1:
+			return Vx + " |= " + Vy + ";" + (Quirks::LOGIC_RESETS_VF ? " s.REG[0xF] = 0;" : "");
+		case K_8xy2:
+			return Vx + " &= " + Vy + ";" + (Quirks::LOGIC_RESETS_VF ? " s.REG[0xF] = 0;" : "");
+		case K_8xy3:
+			return Vx + " ^= " + Vy + ";" + (Quirks::LOGIC_RESETS_VF ? " s.REG[0xF] = 0;" : "");
+		case K_8xy4:
+			return "{ uint16_t sum = " + Vx + " + " + Vy + "; s.REG[0xF] = sum > 255u; " + Vx + " = sum & 0xFFu; }";
+		case K_8xy5:
+			return "s.REG[0xF] = " + Vx + " > " + Vy + "; " + Vx + " -= " + Vy + ";";
+		case K_8xy6:
+		{
+			const std::string source = reg(Quirks::SHIFT_USES_VY ? y : x);
+			return "s.REG[0xF] = " + source + " & 0x01u; " + Vx + " = " + source + " >> 1;";
+		}
+		case K_8xy7:
+			return "s.REG[0xF] = " + Vy + " >= " + Vx + "; " + Vx + " = " + Vy + " - " + Vx + ";";
+		case K_8xyE:
+		{
+			const std::string source = reg(Quirks::SHIFT_USES_VY ? y : x);
+			return "s.REG[0xF] = (" + source + " & 0x80u) >> 7u; " + Vx + " = " + source + " << 1;";
+		}
+		case K_Annn:
+			return "s.R_I = " + hex(nnn, 3) + ";";
+		case K_Fx07:
+			return Vx + " = s.R_DELAY_TIMER;";
+		case K_Fx15:
+			return "s.R_DELAY_TIMER = " + Vx + ";";
+		case K_Fx18:
+			return "s.R_BUZZER_TIMER = " + Vx + "; Chip8Aot::buzzerSet(chip8, count);";
+		case K_Fx1E:
+			return "s.R_I += " + Vx + ";";
+		case K_Fx29:
+			return "s.R_I = FONTSET_START_ADDRESS + (BYTES_PER_CHAR * " + Vx + ");";
+		case K_Fx30:
+			return "s.R_I = BIG_FONTSET_START_ADDRESS + (BYTES_PER_BIG_CHAR * " + Vx + ");";
+		case K_Fx65:
+		{
+			std::string code;
+			for (unsigned int w = 0; w <= x; ++w)
+			{
+				code += reg(w) + " = s.memory[(s.R_I + " + std::to_string(w) + ") % MEMORY_SIZE]; ";
+			}
+			if (Quirks::LOAD_STORE_INCREMENTS_I)
+			{
+				code += "s.R_I += " + std::to_string(x + 1) + "; ";
+			}
+			code.pop_back();
+			return code;
+		}
+		case K_Fx75:
+		{
+			std::string code;
+			for (unsigned int w = 0; w <= x; ++w)
+			{
+				code += "s.rplFlags[" + std::to_string(w) + "] = " + reg(w) + "; ";
+			}
+			code.pop_back();
+			return code;
+		}
+		case K_Fx85:
+		{
+			std::string code;
+			for (unsigned int w = 0; w <= x; ++w)
+			{
+				code += reg(w) + " = s.rplFlags[" + std::to_string(w) + "]; ";
+			}
+			code.pop_back();
+			return code;
+		}
+		default:
+			// Display, random and planes
+			return step;
+		}
+	}
+
+	// One namespace per ROM: its bytes, block functions and program
+	template <typename Quirks>
+	void writeProgram(std::ostream &out, const Rom &rom, size_t index)
+	{
+		std::vector<Block> blocks = findBlocks(rom);
+		out << "\n// " << rom.path << ", quirk profile " << quirkProfileName(rom.quirks) << ", " << blocks.size() << " blocks\n";
+		out << "namespace rom" << index << "\n{\n";
+		out << "\tconst uint8_t ROM[] = {";
+		for (size_t b = 0; b < rom.bytes.size(); ++b)
+		{
+			out << (b % 16 ? " " : "\n\t\t") << hex(rom.bytes[b], 2) << ",";
+		}
+		out << "};\n";
+
+		for (const Block &block : blocks)
+		{
+			out << "\n\tvoid block" << hex(block.address, 3) << "(Chip8 &chip8, Chip8State &s, unsigned int entry, unsigned int count)\n";
+			out << "\t{\n\t\tswitch (entry)\n\t\t{\n";
+			for (unsigned int i = 0; i < block.length; ++i)
+			{
+				const unsigned int address = block.address + i * 2;
+				const uint16_t opcode = opcodeAt(rom, address);
+				out << "\t\tcase " << i << ":\n";
+				out << "\t\t\t// " << hex(address, 3) << ": " << hex(opcode, 4) << "  " << disassemble(opcode) << "\n";
+				std::string code = translate<Quirks>(opcode, address);
+				if (!code.empty())
+				{
+					out << "\t\t\t" << code << "\n";
+				}
+				if (!endsBlock(classifyOpcode(opcode)))
+				{
+					// count > 0 on entry, stop after count instructions
+					// or at the end of the block
+					const std::string next = hex(address + 2, 3);
+					if (i + 1 < block.length)
+					{
+						out << "\t\t\tif (--count == 0)\n\t\t\t{\n\t\t\t\ts.R_PC = " << next << ";\n\t\t\t\treturn;\n\t\t\t}\n";
+						out << "\t\t\t[[fallthrough]];\n";
+					}
+					else
+					{
+						out << "\t\t\ts.R_PC = " << next << ";\n";
+					}
+				}
+			}
+			out << "\t\t}\n\t}\n";
+		}
+
+		out << "\n\tconst AotBlock BLOCKS[] = {";
+		for (const Block &block : blocks)
+		{
+			out << "\n\t\t{block" << hex(block.address, 3) << ", " << hex(block.address, 3) << ", " << block.length << "},";
+		}
+		out << "};\n\n";
+		out << "\tconst AotProgram PROGRAM = {0x" << std::hex << hashBytes(rom.bytes.data(), rom.bytes.size()) << std::dec
+			<< "ull, QuirkProfile::" << enumeratorName(rom.quirks) << ", ROM, sizeof(ROM), BLOCKS, sizeof(BLOCKS) / sizeof(BLOCKS[0])};\n";
+		out << "\t[[maybe_unused]] const bool registered = Chip8Aot::registerProgram(PROGRAM);\n";
+		out << "}\n";
+	}
+}
+
+static void printUsage(char const *program)
+{
+	std::cerr << "Usage: " << program << " <output.cpp> <ROM>... [--quirks default|chip8|schip|xochip]\n";
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	// Profile of every ROM, by default each one's comes from its extension
+	bool quirksGiven = false;
+	QuirkProfile quirks = QuirkProfile::Default;
+	std::vector<std::string> romPaths;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--quirks")
+		{
+			if (i + 1 >= argc || !quirkProfileFromName(argv[++i], quirks))
+			{
+				printUsage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			quirksGiven = true;
+		}
+		else
+		{
+			romPaths.push_back(arg);
+		}
+	}
+
+	std::vector<Rom> roms;
+	for (const std::string &path : romPaths)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+		{
+			std::cerr << "Failed to open ROM: " << path << "\n";
+			return EXIT_FAILURE;
+		}
+		Rom rom{path, quirksGiven ? quirks : quirkProfileForRom(path), {}};
+		rom.bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		if (rom.bytes.empty() || rom.bytes.size() > MEMORY_SIZE - ROM_START_ADDRESS)
+		{
+			std::cerr << "ROM empty or too large: " << path << "\n";
+			return EXIT_FAILURE;
+		}
+		roms.push_back(std::move(rom));
+	}
+
+	std::ofstream out(argv[1]);
+	out << "// Generated by chip8-recompile, do not edit\n";
+	out << "#include \"Chip8Aot.h\"\n\nnamespace\n{";
+	for (size_t r = 0; r < roms.size(); ++r)
+	{
+		withQuirks(roms[r].quirks, [&](auto policy)
+				   { writeProgram<decltype(policy)>(out, roms[r], r); });
+	}
+	out << "}\n";
+	if (!out)
+	{
+		std::cerr << "Failed to write: " << argv[1] << "\n";
+		return EXIT_FAILURE;
+	}
+	std::cout << "Recompiled " << roms.size() << " ROMs into " << argv[1] << "\n";
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,222 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Chip8Opcodes.h"
+#include "Chip8Trace.h"
+
+// Trace decoder: disassembles the last instructions of a trace written by
+// chip8-trace (--trace) and summarizes the loops and the call graph of the
+// whole trace.
+
+namespace
+{
+	// Function of the code running when the trace starts, its address is
+	// not in the trace
+	const uint32_t TRACE_START = 0x10000;
+
+	struct Loop
+	{
+		uint16_t start;
+		uint16_t end;
+		uint64_t iterations;
+		uint64_t instructions;
+	};
+
+	struct Function
+	{
+		uint64_t calls;
+		uint64_t instructions;
+	};
+
+	// "0x2a4"
+	std::string hexAddress(unsigned int address)
+	{
+		std::ostringstream text;
+		text << "0x" << std::hex << std::setw(3) << std::setfill('0') << address;
+		return text.str();
+	}
+
+	std::string functionName(uint32_t address)
+	{
+		return address == TRACE_START ? "(start)" : hexAddress(address);
+	}
+
+	double percent(uint64_t count, uint64_t total)
+	{
+		return total ? count * 100.0 / total : 0.0;
+	}
+
+	void printRecord(const TraceRecord &r)
+	{
+		std::cout << std::setw(12) << r.cycle << "  " << hexAddress(r.pc) << "  " << std::hex << std::setw(4) << std::setfill('0')
+				  << r.opcode << std::setfill(' ') << "  " << std::left << std::setw(18) << disassemble(r.opcode) << std::right;
+		if (r.reg != TRACE_NO_REGISTER)
+		{
+			std::cout << "V" << std::uppercase << static_cast<unsigned int>(r.reg) << std::nouppercase << "=" << std::setw(2)
+					  << std::setfill('0') << static_cast<unsigned int>(r.value) << std::setfill(' ');
+		}
+		else
+		{
+			std::cout << "    ";
+		}
+		std::cout << "  I=" << hexAddress(r.i) << std::dec << "\n";
+	}
+
+	// Jumps back to an address at or before the jump, like Chip8Profile,
+	// with the body taken as the instructions in the address range
+	std::vector<Loop> findLoops(const std::vector<TraceRecord> &records)
+	{
+		std::vector<uint64_t> pcCounts(MEMORY_SIZE);
+		std::map<uint16_t, Loop> loops;
+		for (size_t r = 0; r < records.size(); ++r)
+		{
+			++pcCounts[records[r].pc % MEMORY_SIZE];
+			if (r + 1 == records.size())
+			{
+				break;
+			}
+			OpcodeKind kind = classifyOpcode(records[r].opcode);
+			uint16_t next = records[r + 1].pc;
+			if ((kind == K_1nnn || kind == K_Bnnn) && next <= records[r].pc)
+			{
+				Loop &loop = loops.emplace(records[r].pc, Loop{next, records[r].pc, 0, 0}).first->second;
+				loop.start = next;
+				++loop.iterations;
+			}
+		}
+		std::vector<Loop> sorted;
+		for (auto &entry : loops)
+		{
+			Loop loop = entry.second;
+			for (unsigned int a = loop.start; a <= loop.end; ++a)
+			{
+				loop.instructions += pcCounts[a];
+			}
+			sorted.push_back(loop);
+		}
+		std::sort(sorted.begin(), sorted.end(), [](const Loop &a, const Loop &b)
+				  { return a.instructions > b.instructions; });
+		return sorted;
+	}
+}
+
+static void printUsage(char const *program)
+{
+	std::cerr << "Usage: " << program << " <trace> [--list N] [--top N]\n";
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	size_t listCount = 32;
+	size_t top = 10;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--list" && i + 1 < argc)
+		{
+			listCount = std::stoul(argv[++i]);
+		}
+		else if (arg == "--top" && i + 1 < argc)
+		{
+			top = std::stoul(argv[++i]);
+		}
+		else
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	std::vector<TraceRecord> records;
+	if (!Chip8Trace::load(argv[1], records))
+	{
+		return EXIT_FAILURE;
+	}
+	std::cout << "Records: " << records.size();
+	if (!records.empty())
+	{
+		std::cout << ", cycles " << records.front().cycle << "-" << records.back().cycle;
+	}
+	std::cout << "\n";
+	if (records.empty())
+	{
+		return EXIT_SUCCESS;
+	}
+
+	// Disassembly of the last instructions, the ones leading up to the
+	// dump or the trigger
+	listCount = std::min(listCount, records.size());
+	std::cout << "\nLast " << listCount << " instructions (cycle, address, opcode, changed register, I after):\n";
+	for (size_t r = records.size() - listCount; r < records.size(); ++r)
+	{
+		printRecord(records[r]);
+	}
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::vector<Loop> loops = findLoops(records);
+	loops.resize(std::min(loops.size(), top));
+	std::cout << "\nHot loops (back edges, body = instructions in the address range):\n";
+	for (const Loop &loop : loops)
+	{
+		std::cout << "  " << hexAddress(loop.start) << "-" << hexAddress(loop.end) << std::setw(12) << loop.iterations
+				  << " iterations" << std::setw(14) << loop.instructions << std::setw(7) << percent(loop.instructions, records.size())
+				  << "%" << std::setw(8) << static_cast<double>(loop.instructions) / loop.iterations << " per iteration\n";
+	}
+
+	// Call graph: follow 2nnn/00EE on a shadow stack of function entry
+	// addresses. Instructions count for the function on top; a return
+	// with an empty stack leaves the function the trace started in
+	std::vector<uint32_t> stack{TRACE_START};
+	std::map<uint32_t, Function> functions;
+	std::map<std::pair<uint32_t, uint32_t>, uint64_t> calls;
+	for (const TraceRecord &r : records)
+	{
+		++functions[stack.back()].instructions;
+		OpcodeKind kind = classifyOpcode(r.opcode);
+		if (kind == K_2nnn)
+		{
+			uint32_t callee = r.opcode & 0x0FFFu;
+			++calls[{stack.back(), callee}];
+			++functions[callee].calls;
+			stack.push_back(callee);
+		}
+		else if (kind == K_00EE && stack.size() > 1)
+		{
+			stack.pop_back();
+		}
+	}
+
+	std::vector<std::pair<uint32_t, Function>> byInstructions(functions.begin(), functions.end());
+	std::sort(byInstructions.begin(), byInstructions.end(), [](const auto &a, const auto &b)
+			  { return a.second.instructions > b.second.instructions; });
+	byInstructions.resize(std::min(byInstructions.size(), top));
+	std::cout << "\nFunctions (2nnn targets, instructions outside their calls):\n";
+	for (const auto &function : byInstructions)
+	{
+		std::cout << "  " << std::left << std::setw(8) << functionName(function.first) << std::right << std::setw(10)
+				  << function.second.calls << " calls" << std::setw(14) << function.second.instructions << std::setw(7)
+				  << percent(function.second.instructions, records.size()) << "%\n";
+	}
+
+	std::vector<std::pair<std::pair<uint32_t, uint32_t>, uint64_t>> edges(calls.begin(), calls.end());
+	std::sort(edges.begin(), edges.end(), [](const auto &a, const auto &b)
+			  { return a.second > b.second; });
+	edges.resize(std::min(edges.size(), top));
+	std::cout << "\nCalls (caller -> callee):\n";
+	for (const auto &edge : edges)
+	{
+		std::cout << "  " << std::left << std::setw(8) << functionName(edge.first.first) << " -> " << std::setw(8)
+				  << functionName(edge.first.second) << std::right << std::setw(10) << edge.second << "\n";
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,633 @@
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+#include "Chip8Lockstep.h"
+#include "Chip8Trace.h"
+#include "Movie.h"
+
+// Differential verification: runs a ROM on the reference interpreter
+// (Chip8::tick() one instruction at a time, decoding every instruction from
+// memory) and on other engines with the same seed and inputs, and compares
+// stateHash() every --interval instructions. When an engine's hash differs
+// it bisects the interval to the first instruction after which the states
+// differ and prints that instruction and the fields that differ.
+// Chip8Lockstep runs --lanes lanes with seeds seed, seed + 1, ..., each
+// checked against a reference of its own.
+
+namespace
+{
+	const Engine ENGINES[] = {Engine::Interpreter, Engine::Jit, Engine::Threaded, Engine::Aot};
+	// Differing memory bytes listed before the rest are only counted
+	const unsigned int MAX_LISTED_BYTES = 8;
+
+	struct Options
+	{
+		// ROM image, and the name printed before the results of --cases
+		std::vector<uint8_t> rom;
+		std::string name;
+		// Held from power on, unless a movie sets the keys
+		uint16_t keys{};
+		std::vector<Engine> engines;
+		bool lockstep{};
+		unsigned int lanes = 8;
+		QuirkProfile quirks = QuirkProfile::Default;
+		unsigned long long cycles = 10000000;
+		unsigned long long interval = 10000;
+		int cyclesPerFrame = 10;
+		uint64_t seed = 0;
+		char const *moviePath{};
+		bool idleSkip = true;
+		// The program waits in idle loops, so with idleSkip the engines
+		// must skip some of its instructions
+		bool idle{};
+	};
+
+	// A Chip8 running one engine, or the lockstep group
+	struct Candidate
+	{
+		std::string name;
+		Engine engine{};
+		std::unique_ptr<Chip8> chip8;
+		std::unique_ptr<Chip8Lockstep> group;
+		bool diverged{};
+	};
+
+	unsigned int cpuFrequency(const Options &options, const Movie *movie)
+	{
+		return movie ? movie->getCpuFrequency() : options.cyclesPerFrame * TIMER_FREQUENCY;
+	}
+
+	// Machine with the ROM loaded and the seed of lane (0 for the engines)
+	std::unique_ptr<Chip8> makeMachine(const Options &options, const Movie *movie, unsigned int lane)
+	{
+		auto chip8 = std::make_unique<Chip8>();
+		chip8->loadROM(options.rom.data(), options.rom.size());
+		chip8->setKeys(options.keys);
+		chip8->setQuirkProfile(movie ? movie->getQuirkProfile() : options.quirks);
+		chip8->setCpuFrequency(cpuFrequency(options, movie));
+		chip8->setSeed((movie ? movie->getSeed() : options.seed) + lane);
+		chip8->setIdleSkip(options.idleSkip);
+		// Buzzer edges are checked on lane 0, lockstep lanes record none
+		chip8->setBuzzerEvents(lane == 0);
+		return chip8;
+	}
+
+	std::unique_ptr<Chip8> makeReference(const Options &options, const Movie *movie, unsigned int lane)
+	{
+		std::unique_ptr<Chip8> chip8 = makeMachine(options, movie, lane);
+		chip8->setDecodeCache(false);
+		return chip8;
+	}
+
+	std::unique_ptr<Chip8Lockstep> makeGroup(const Options &options, const Movie *movie)
+	{
+		auto group = std::make_unique<Chip8Lockstep>();
+		group->setQuirkProfile(movie ? movie->getQuirkProfile() : options.quirks);
+		group->loadROM(options.rom.data(), options.rom.size(), options.lanes);
+		group->setCpuFrequency(cpuFrequency(options, movie));
+		for (unsigned int l = 0; l < options.lanes; ++l)
+		{
+			group->lane(l).setKeys(options.keys);
+			group->lane(l).setSeed((movie ? movie->getSeed() : options.seed) + l);
+			group->lane(l).setIdleSkip(options.idleSkip);
+		}
+		return group;
+	}
+
+	// Run count instructions, the reference one tick() at a time, the
+	// others with run(). Keys change on timer events, so with a movie run
+	// up to each one
+	void advance(Chip8 &chip8, bool reference, unsigned long long count, const Movie *movie)
+	{
+		const unsigned long long chunk = 1u << 20;
+		while (count > 0)
+		{
+			unsigned long long slice = std::min(chunk, count);
+			if (movie)
+			{
+				chip8.setKeys(movie->getKeys(chip8.getFrameCount()));
+				slice = std::min<unsigned long long>(slice, chip8.getCyclesUntilTimer());
+			}
+			if (reference)
+			{
+				for (unsigned long long i = 0; i < slice; ++i)
+				{
+					chip8.tick();
+				}
+			}
+			else
+			{
+				chip8.run(static_cast<unsigned int>(slice));
+			}
+			count -= slice;
+		}
+	}
+
+	// Same for every lane of a group, then sync() so the lanes' Chip8
+	// hold their registers
+	void advance(Chip8Lockstep &group, unsigned long long count, const Movie *movie)
+	{
+		while (count > 0)
+		{
+			unsigned int slice = static_cast<unsigned int>(std::min<unsigned long long>(count, group.getCyclesUntilTimer()));
+			if (movie)
+			{
+				for (unsigned int l = 0; l < group.getLaneCount(); ++l)
+				{
+					group.lane(l).setKeys(movie->getKeys(group.getFrameCount()));
+				}
+			}
+			group.run(slice);
+			count -= slice;
+		}
+		group.sync();
+	}
+
+	// Returns false if the file cannot be read or does not fit
+	bool readRom(char const *path, std::vector<uint8_t> &rom)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+		{
+			std::cerr << "Failed to open ROM: " << path << "\n";
+			return false;
+		}
+		rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		if (rom.size() > MEMORY_SIZE - ROM_START_ADDRESS)
+		{
+			std::cerr << "ROM does not fit in memory: " << path << "\n";
+			return false;
+		}
+		return true;
+	}
+
+	// Big-endian ROM image of a program
+	std::vector<uint8_t> assemble(const std::vector<uint16_t> &program)
+	{
+		std::vector<uint8_t> rom;
+		for (uint16_t opcode : program)
+		{
+			rom.push_back(opcode >> 8);
+			rom.push_back(opcode & 0xFF);
+		}
+		return rom;
+	}
+
+	// "0x02a4", decimal for width 0
+	std::string hex(unsigned long long value, int width)
+	{
+		if (width == 0)
+		{
+			return std::to_string(value);
+		}
+		std::ostringstream text;
+		text << "0x" << std::hex << std::setw(width) << std::setfill('0') << value;
+		return text.str();
+	}
+
+	// One line per differing field, reference value first
+	void printDifferences(const Chip8State &a, const Chip8State &b)
+	{
+		auto field = [](const std::string &name, unsigned long long x, unsigned long long y, int width)
+		{
+			if (x != y)
+			{
+				std::cout << "    " << std::left << std::setw(16) << name << std::setw(18) << hex(x, width) << std::right << hex(y, width) << "\n";
+			}
+		};
+		field("PC", a.R_PC, b.R_PC, 3);
+		field("I", a.R_I, b.R_I, 3);
+		for (unsigned int r = 0; r < REGISTER_COUNT; ++r)
+		{
+			std::ostringstream name;
+			name << "V" << std::uppercase << std::hex << r;
+			field(name.str(), a.REG[r], b.REG[r], 2);
+		}
+		field("SP", a.R_SP, b.R_SP, 2);
+		for (unsigned int level = 0; level < STACK_LEVELS; ++level)
+		{
+			field("stack[" + std::to_string(level) + "]", a.stackMemory[level], b.stackMemory[level], 3);
+		}
+		field("delay timer", a.R_DELAY_TIMER, b.R_DELAY_TIMER, 2);
+		field("buzzer timer", a.R_BUZZER_TIMER, b.R_BUZZER_TIMER, 2);
+		field("hires", a.hires, b.hires, 1);
+		field("plane mask", a.planeMask, b.planeMask, 1);
+		for (unsigned int flag = 0; flag < RPL_FLAG_COUNT; ++flag)
+		{
+			field("rpl[" + std::to_string(flag) + "]", a.rplFlags[flag], b.rplFlags[flag], 2);
+		}
+		for (unsigned int key = 0; key < KEY_COUNT; ++key)
+		{
+			field("key[" + std::to_string(key) + "]", a.keypadMemory[key], b.keypadMemory[key], 1);
+		}
+		field("cpu frequency", a.cpuFrequency, b.cpuFrequency, 0);
+		field("cycles to timer", a.cyclesUntilTimer, b.cyclesUntilTimer, 0);
+		field("cycle count", a.cycleCount, b.cycleCount, 0);
+		field("timer base", a.timerBaseCycle, b.timerBaseCycle, 0);
+		field("timer ticks", a.timerTicks, b.timerTicks, 0);
+		field("frame count", a.frameCount, b.frameCount, 0);
+		field("rng state", a.rngState, b.rngState, 16);
+
+		unsigned int bytes = 0;
+		for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+		{
+			if (a.memory[address] != b.memory[address] && bytes++ < MAX_LISTED_BYTES)
+			{
+				field("memory[" + hex(address, 3) + "]", a.memory[address], b.memory[address], 2);
+			}
+		}
+		if (bytes > MAX_LISTED_BYTES)
+		{
+			std::cout << "    " << bytes - MAX_LISTED_BYTES << " more memory bytes\n";
+		}
+		unsigned int pixels = 0;
+		for (unsigned int plane = 0; plane < VIDEO_PLANES; ++plane)
+		{
+			for (unsigned int word = 0; word < VIDEO_WORDS; ++word)
+			{
+				pixels += __builtin_popcountll(a.videoMemory[plane][word] ^ b.videoMemory[plane][word]);
+			}
+		}
+		if (pixels)
+		{
+			std::cout << "    " << pixels << " video pixels\n";
+		}
+	}
+
+	// Find the first of the count instructions run from the checkpoint at
+	// cycle base after which lane's reference and the candidate differ,
+	// count is known to end with them different. Engines restore the
+	// checkpoint, the lockstep group has no save states and replays from
+	// power on
+	void bisect(const Options &options, const Movie *movie, const Chip8State &checkpoint, unsigned long long base,
+				unsigned long long count, Candidate &candidate, unsigned int lane)
+	{
+		std::unique_ptr<Chip8> reference = makeReference(options, movie, lane);
+		auto runCandidate = [&](unsigned long long n) -> Chip8 &
+		{
+			if (candidate.group)
+			{
+				candidate.group = makeGroup(options, movie);
+				advance(*candidate.group, base + n, movie);
+				return candidate.group->lane(lane);
+			}
+			candidate.chip8->loadState(checkpoint);
+			advance(*candidate.chip8, false, n, movie);
+			return *candidate.chip8;
+		};
+		auto runReference = [&](unsigned long long n)
+		{
+			reference->loadState(checkpoint);
+			advance(*reference, true, n, movie);
+		};
+
+		// Same after good instructions, different after bad
+		unsigned long long good = 0;
+		unsigned long long bad = count;
+		while (bad - good > 1)
+		{
+			unsigned long long middle = good + (bad - good) / 2;
+			runReference(middle);
+			(reference->stateHash() == runCandidate(middle).stateHash() ? good : bad) = middle;
+		}
+
+		runReference(good);
+		Chip8State before;
+		reference->saveState(before);
+		advance(*reference, true, 1, movie);
+		Chip8State expected;
+		Chip8State actual;
+		reference->saveState(expected);
+		runCandidate(good + 1).saveState(actual);
+
+		const uint16_t pc = before.R_PC % MEMORY_SIZE;
+		const uint16_t opcode = (before.memory[pc] << 8) | before.memory[(pc + 1) % MEMORY_SIZE];
+		std::string name = candidate.name + (candidate.group ? " lane " + std::to_string(lane) : "");
+		std::cout << name << ": diverged at cycle " << before.cycleCount << ", " << hex(pc, 3) << "  " << hex(opcode, 4).substr(2)
+				  << "  " << disassemble(opcode) << "\n";
+		std::cout << "    " << std::left << std::setw(16) << "field" << std::setw(18) << "reference" << std::right << name << "\n";
+		printDifferences(expected, actual);
+	}
+
+	bool sameEdges(const std::vector<BuzzerEvent> &a, const std::vector<BuzzerEvent> &b)
+	{
+		return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const BuzzerEvent &x, const BuzzerEvent &y)
+						  { return x.cycle == y.cycle && x.on == y.on; });
+	}
+
+	// Buzzer edges of the same instructions, the state matched
+	void printEdges(const std::string &name, const std::vector<BuzzerEvent> &actual, const std::vector<BuzzerEvent> &expected)
+	{
+		std::cout << name << ": buzzer edges differ\n";
+		for (size_t e = 0; e < std::max(actual.size(), expected.size()); ++e)
+		{
+			auto edge = [](const std::vector<BuzzerEvent> &edges, size_t e)
+			{ return e < edges.size() ? std::to_string(edges[e].cycle) + (edges[e].on ? " on" : " off") : std::string("-"); };
+			std::cout << "    " << std::left << std::setw(16) << "edge " + std::to_string(e) << std::setw(18) << edge(expected, e) << std::right
+					  << edge(actual, e) << "\n";
+		}
+	}
+
+	// Run the candidates next to the references, returns true if no
+	// candidate diverged
+	bool verify(Options options, const Movie *movie)
+	{
+		// Without --engine every engine this build and machine has, including
+		// the interpreter's run() path (decode cache, idle loop skipping), and
+		// the lockstep group
+		const bool allEngines = options.engines.empty() && !options.lockstep;
+		if (allEngines)
+		{
+			options.engines.assign(std::begin(ENGINES), std::end(ENGINES));
+			options.lockstep = true;
+		}
+		const std::string prefix = options.name.empty() ? "" : options.name + " ";
+
+		// One reference per lane, the engines are checked against lane 0
+		const unsigned int references = options.lockstep ? options.lanes : 1;
+		std::vector<std::unique_ptr<Chip8>> reference;
+		for (unsigned int l = 0; l < references; ++l)
+		{
+			reference.push_back(makeReference(options, movie, l));
+		}
+
+		std::vector<Candidate> candidates;
+		for (Engine engine : options.engines)
+		{
+			Candidate candidate{prefix + engineName(engine), engine, makeMachine(options, movie, 0)};
+			if (!candidate.chip8->setEngine(engine))
+			{
+				if (!allEngines)
+				{
+					return false;
+				}
+				std::cout << candidate.name << ": skipped\n";
+				continue;
+			}
+			candidates.push_back(std::move(candidate));
+		}
+		if (options.lockstep)
+		{
+			Candidate candidate{prefix + "lockstep"};
+			candidate.group = makeGroup(options, movie);
+			candidates.push_back(std::move(candidate));
+		}
+
+		// Every machine matched its reference at the checkpoints
+		std::vector<Chip8State> checkpoints(references);
+		for (unsigned int l = 0; l < references; ++l)
+		{
+			reference[l]->saveState(checkpoints[l]);
+		}
+		unsigned long long checks = 0;
+		for (unsigned long long done = 0; done < options.cycles;)
+		{
+			const unsigned long long count = std::min(options.interval, options.cycles - done);
+			std::vector<uint64_t> expected(references);
+			for (unsigned int l = 0; l < references; ++l)
+			{
+				advance(*reference[l], true, count, movie);
+				expected[l] = reference[l]->stateHash();
+			}
+			std::vector<BuzzerEvent> expectedEdges;
+			reference[0]->takeBuzzerEvents(expectedEdges);
+			for (Candidate &candidate : candidates)
+			{
+				if (candidate.diverged)
+				{
+					continue;
+				}
+				if (candidate.group)
+				{
+					advance(*candidate.group, count, movie);
+					for (unsigned int l = 0; l < references && !candidate.diverged; ++l)
+					{
+						if (candidate.group->lane(l).stateHash() != expected[l])
+						{
+							candidate.diverged = true;
+							bisect(options, movie, checkpoints[l], done, count, candidate, l);
+						}
+					}
+				}
+				else
+				{
+					advance(*candidate.chip8, false, count, movie);
+					std::vector<BuzzerEvent> edges;
+					candidate.chip8->takeBuzzerEvents(edges);
+					if (candidate.chip8->stateHash() != expected[0])
+					{
+						candidate.diverged = true;
+						bisect(options, movie, checkpoints[0], done, count, candidate, 0);
+					}
+					else if (!sameEdges(edges, expectedEdges))
+					{
+						candidate.diverged = true;
+						printEdges(candidate.name, edges, expectedEdges);
+					}
+				}
+			}
+			for (unsigned int l = 0; l < references; ++l)
+			{
+				reference[l]->saveState(checkpoints[l]);
+			}
+			done += count;
+			++checks;
+		}
+
+		bool identical = true;
+		for (const Candidate &candidate : candidates)
+		{
+			if (!candidate.diverged)
+			{
+				std::cout << candidate.name << ": identical, " << checks << " checks over " << options.cycles << " instructions"
+						  << (candidate.group ? ", " + std::to_string(options.lanes) + " lanes" : "") << "\n";
+			}
+			identical = identical && !candidate.diverged;
+			if (options.idle && options.idleSkip && candidate.chip8 && candidate.chip8->getIdleCycleCount() == 0)
+			{
+				std::cout << candidate.name << ": no idle loop skipped\n";
+				identical = false;
+			}
+		}
+		return identical;
+	}
+
+	// Programs for --cases, each covers an opcode the engines got wrong
+	// before. They loop forever and run under every quirk profile
+	struct Case
+	{
+		const char *name;
+		std::vector<uint16_t> program;
+		uint16_t keys;
+		bool idle;
+	};
+
+	std::vector<Case> cases()
+	{
+		return {
+			// Dxyn clears VF before reading Vx and Vy, so a sprite drawn at
+			// VF lands at 0 whatever the last collision was
+			{"dxyn-vf-coordinates",
+			 {0x6F05, 0x6103, 0xA050, 0xD1F5, 0xDF15, 0xD1F5, 0xDFF5, 0x7F07, 0xDF1F, 0x6F21, 0xD1F8, 0xDF13, 0x1206},
+			 0,
+			 false},
+			// Dxy0 in lo-res draws nothing under default/chip8, 16x16 under
+			// schip/xochip and in hi-res under every profile
+			{"dxy0-modes", {0x6105, 0xA200, 0xD110, 0xD110, 0x7103, 0x00FF, 0xD110, 0x7109, 0x00FE, 0x1202}, 0, false},
+			// Ex9E/ExA1 with Vx past 0xF test key Vx % 16
+			{"exnn-key-wrap", {0x6210, 0xE29E, 0x7301, 0xE2A1, 0x7302, 0x7211, 0x1202}, 0x0101, false},
+			// Fx07/3000/1nnn polls the delay timer: V0 holds the value read
+			// before the last tick, yet the wait is still skipped
+			{"delay-timer-wait", {0x6005, 0xF015, 0xF007, 0x3000, 0x1204, 0x7101, 0x1200}, 0, true},
+			// Fx55 rewrites the kk of a 7xkk the JIT has chained into the
+			// loop, the next pass must add the new value
+			// Fx18 switching the buzzer mid-slice and a tick running it
+			// out, the edges carry the cycle after the Fx18 in every engine
+			{"buzzer-edges", {0x6002, 0xF018, 0x7101, 0x3100, 0x1204, 0x6005, 0xF018, 0x6000, 0xF018, 0x1200}, 0, false},
+			{"self-modifying-loop", {0xA209, 0x7001, 0xF055, 0x1208, 0x7100, 0x3100, 0x1202, 0x1200}, 0, false},
+		};
+	}
+
+	const QuirkProfile QUIRK_PROFILES[] = {QuirkProfile::Default, QuirkProfile::Chip8, QuirkProfile::Schip, QuirkProfile::XoChip};
+
+	void printUsage(char const *program)
+	{
+		std::cerr << "Usage: " << program << " <ROM> [--engine interpreter|jit|threaded|aot|lockstep]... [--lanes N] [--cycles N]"
+				  << " [--interval N] [--cycles-per-frame N] [--quirks default|chip8|schip|xochip] [--seed N] [--movie FILE]"
+				  << " [--no-idle-skip]\n";
+		std::cerr << "       " << program << " --cases [--engine NAME]... [--lanes N] [--cycles N] [--interval N] [--no-idle-skip]\n";
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		printUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	Options options;
+	const std::string romPath = argv[1];
+	const bool runCases = romPath == "--cases";
+	if (runCases)
+	{
+		// Short programs, short runs
+		options.cycles = 100000;
+		options.interval = 1000;
+	}
+	else
+	{
+		// By ROM extension unless --quirks is given
+		options.quirks = quirkProfileForRom(romPath);
+	}
+	char const *moviePath = nullptr;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--no-idle-skip")
+		{
+			options.idleSkip = false;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		std::string value = argv[++i];
+		Engine engine;
+		if (arg == "--engine" && value == "lockstep")
+		{
+			options.lockstep = true;
+		}
+		else if (arg == "--engine" && engineFromName(value, engine))
+		{
+			options.engines.push_back(engine);
+		}
+		else if (arg == "--lanes")
+		{
+			options.lanes = std::min<unsigned long>(std::max(1ul, std::stoul(value)), Chip8Lockstep::LANES);
+		}
+		else if (arg == "--cycles")
+		{
+			options.cycles = std::stoull(value);
+		}
+		else if (arg == "--interval")
+		{
+			options.interval = std::max(1ull, std::stoull(value));
+		}
+		else if (arg == "--cycles-per-frame" && !runCases)
+		{
+			options.cyclesPerFrame = std::stoi(value);
+		}
+		else if (arg == "--quirks" && !runCases)
+		{
+			if (!quirkProfileFromName(value, options.quirks))
+			{
+				printUsage(argv[0]);
+				return EXIT_FAILURE;
+			}
+		}
+		else if (arg == "--seed" && !runCases)
+		{
+			options.seed = std::stoull(value);
+		}
+		else if (arg == "--movie" && !runCases)
+		{
+			moviePath = argv[i];
+		}
+		else
+		{
+			printUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (runCases)
+	{
+		bool identical = true;
+		for (const Case &c : cases())
+		{
+			for (QuirkProfile profile : QUIRK_PROFILES)
+			{
+				Options caseOptions = options;
+				caseOptions.name = std::string(c.name) + " " + quirkProfileName(profile);
+				caseOptions.rom = assemble(c.program);
+				caseOptions.keys = c.keys;
+				caseOptions.idle = c.idle;
+				caseOptions.quirks = profile;
+				identical = verify(caseOptions, nullptr) && identical;
+			}
+		}
+		return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (!readRom(romPath.c_str(), options.rom))
+	{
+		return EXIT_FAILURE;
+	}
+	// A movie replays its inputs with its own seed, CPU frequency and
+	// quirk profile
+	Movie movie;
+	if (moviePath)
+	{
+		if (!movie.load(moviePath))
+		{
+			return EXIT_FAILURE;
+		}
+		if (movie.getRomHash() != hashBytes(options.rom.data(), options.rom.size()))
+		{
+			std::cerr << "Movie was recorded with another ROM: " << moviePath << "\n";
+			return EXIT_FAILURE;
+		}
+	}
+	return verify(options, moviePath ? &movie : nullptr) ? EXIT_SUCCESS : EXIT_FAILURE;
+}